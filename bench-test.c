@@ -0,0 +1,1696 @@
+/*
+ *  bench-test.c
+ *  judy-arrays
+ *
+ *  License: same as for judy-arrays.c
+ *
+ *  Timing driver for the judy array calls.
+ *  usage: bench-test [<benchmark> [<key file> [<threads>]]]
+ *
+ *  cc -O2 -o bench-test bench-test.c -lpthread
+ *  The stress and readers benchmarks need -DJUDY_CONCURRENT as well,
+ *  the counts benchmark -DJUDY_COUNTS, the instrument and churn
+ *  benchmarks -DJUDY_INSTRUMENT or -DJUDY_CYCLES.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#endif
+
+#include "judy-shard.c"
+#include "judy-utilities.c"
+
+
+#define DICTIONARY	"/usr/share/dict/words"
+#define ROUNDS		5
+#define THREADS		8
+#define SECONDS		1.0
+#define SHARDS		64
+#define IMAGE		"/tmp/bench-test.judy"
+#define COMPACT		10000
+#define SCAN		256
+#define CHURN		40
+#define CYCLES		1000
+
+typedef struct {
+	uchar **keys;
+	uint *lens;
+	uint count;
+} bench_keys;
+
+double bench_now(void) {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Read one key per line, dropping the line end.
+int bench_read_keys(const char *path, bench_keys *k) {
+	uchar buff[1024];
+	uint size = 1024;
+	uint len;
+	FILE *in;
+
+	if (!(in = fopen(path, "r"))) {
+		fprintf(stderr, "unable to open input file %s\n", path);
+		return 0;
+	}
+
+	k->keys = malloc(size * sizeof(uchar *));
+	k->lens = malloc(size * sizeof(uint));
+	k->count = 0;
+
+	while (fgets((char *)buff, sizeof(buff), in)) {
+		len = strlen((const char *)buff);
+		if (len && buff[len - 1] == '\n')
+			len--;
+		if (len && buff[len - 1] == 0x0d)
+			len--;
+		if (!len)
+			continue;
+
+		if (k->count == size) {
+			size *= 2;
+			k->keys = realloc(k->keys, size * sizeof(uchar *));
+			k->lens = realloc(k->lens, size * sizeof(uint));
+		}
+
+		k->keys[k->count] = malloc(len + 1);
+		memcpy(k->keys[k->count], buff, len);
+		k->keys[k->count][len] = 0;
+		k->lens[k->count++] = len;
+	}
+
+	fclose(in);
+	return k->count;
+}
+
+// Fisher-Yates with a fixed seed so runs are comparable.
+void bench_shuffle(bench_keys *k) {
+	uint idx, other, len;
+	uchar *key;
+
+	srand(1);
+
+	for (idx = k->count; idx > 1; idx--) {
+		other = rand() % idx;
+		key = k->keys[idx - 1], k->keys[idx - 1] = k->keys[other], k->keys[other] = key;
+		len = k->lens[idx - 1], k->lens[idx - 1] = k->lens[other], k->lens[other] = len;
+	}
+}
+
+// Drop repeated keys so every key owns exactly one value.
+void bench_unique(bench_keys *k) {
+	Judy *judy = judy_open(1024);
+	judyslot *cell;
+	uint idx, count = 0;
+
+	for (idx = 0; idx < k->count; idx++) {
+		cell = judy_cell(judy, k->keys[idx], k->lens[idx]);
+		if (*cell)
+			continue;
+		*cell = 1;
+		k->keys[count] = k->keys[idx];
+		k->lens[count++] = k->lens[idx];
+	}
+
+	k->count = count;
+	judy_close(judy);
+}
+
+// judy_slot one key at a time against judy_slot_batch.
+void bench_slot(bench_keys *k) {
+	judyslot **cells = malloc(k->count * sizeof(judyslot *));
+	double start, single = 0, batch = 0, t;
+	judyvalue sum = 0;
+	uint idx, round;
+	Judy *judy;
+
+	judy = judy_open(1024);
+
+	for (idx = 0; idx < k->count; idx++)
+		*(judy_cell(judy, k->keys[idx], k->lens[idx])) = idx + 1;
+
+	bench_shuffle(k);
+
+	for (round = 0; round < ROUNDS; round++) {
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			cells[idx] = judy_slot(judy, k->keys[idx], k->lens[idx]);
+		t = bench_now() - start;
+		if (!round || t < single)
+			single = t;
+
+		for (idx = 0; idx < k->count; idx++)
+			sum += *cells[idx];
+
+		start = bench_now();
+		judy_slot_batch(judy, k->keys, k->lens, k->count, cells);
+		t = bench_now() - start;
+		if (!round || t < batch)
+			batch = t;
+
+		for (idx = 0; idx < k->count; idx++)
+			sum -= *cells[idx];
+	}
+
+	if (sum)
+		fprintf(stderr, "judy_slot_batch results differ from judy_slot\n");
+
+	printf("judy_slot       %8.1f ns/key\n", single * 1e9 / k->count);
+	printf("judy_slot_batch %8.1f ns/key  (%.2fx)\n", batch * 1e9 / k->count, single / batch);
+
+	judy_close(judy);
+	free(cells);
+}
+
+// A full forward scan copying each key out with judy_key against one
+// reading it in place with judy_keyref.
+int bench_export(bench_keys *k) {
+	double start, copy = 0, ref = 0, t;
+	uint64_t bytes[2] = {0, 0};
+	uchar buff[1024], *key;
+	judyslot *cell;
+	uint idx, round, len;
+	Judy *judy;
+
+	judy = judy_open(1024);
+
+	for (idx = 0; idx < k->count; idx++)
+		*(judy_cell(judy, k->keys[idx], k->lens[idx])) = 1;
+
+	for (round = 0; round < ROUNDS; round++) {
+		bytes[0] = bytes[1] = 0;
+
+		start = bench_now();
+		for (cell = judy_strt(judy, NULL, 0); cell; cell = judy_nxt(judy)) {
+			judy_key(judy, buff, sizeof(buff));
+			bytes[0] += strlen((char *)buff) + buff[0];
+		}
+		t = bench_now() - start;
+		if (!round || t < copy)
+			copy = t;
+
+		start = bench_now();
+		for (cell = judy_strt(judy, NULL, 0); cell; cell = judy_nxt(judy)) {
+			key = judy_keyref(judy, &len);
+			bytes[1] += len + key[0];
+		}
+		t = bench_now() - start;
+		if (!round || t < ref)
+			ref = t;
+	}
+
+	judy_close(judy);
+
+	if (bytes[0] != bytes[1]) {
+		fprintf(stderr, "judy_keyref results differ from judy_key\n");
+		return 1;
+	}
+
+	printf("judy_key        %8.1f ns/key\n", copy * 1e9 / k->count);
+	printf("judy_keyref     %8.1f ns/key  (%.2fx)\n", ref * 1e9 / k->count, copy / ref);
+	return 0;
+}
+
+// A full forward scan taking each key and cell with judy_nxt and
+// judy_keyref against one taking them SCAN at a time with judy_nxt_batch.
+int bench_scan(bench_keys *k) {
+	JudyPair *pairs = malloc(SCAN * sizeof(JudyPair));
+	double start, single = 0, batch = 0, t;
+	judyvalue sum[2] = {0, 0};
+	uint idx, round, len, cnt;
+	judyslot *cell;
+	uchar *key;
+	Judy *judy;
+
+	bench_unique(k);
+	judy = judy_open(1024);
+
+	for (idx = 0; idx < k->count; idx++)
+		*(judy_cell(judy, k->keys[idx], k->lens[idx])) = idx + 1;
+
+	for (round = 0; round < ROUNDS; round++) {
+		sum[0] = sum[1] = 0;
+
+		start = bench_now();
+		for (cell = judy_strt(judy, NULL, 0); cell; cell = judy_nxt(judy)) {
+			key = judy_keyref(judy, &len);
+			sum[0] += *cell + len + key[len - 1];
+		}
+		t = bench_now() - start;
+		if (!round || t < single)
+			single = t;
+
+		// the judy_nxt loop leaves the cursor before the first key
+
+		start = bench_now();
+		while ((cnt = judy_nxt_batch(judy, pairs, SCAN)))
+			for (idx = 0; idx < cnt; idx++)
+				sum[1] += *pairs[idx].cell + pairs[idx].len + pairs[idx].key[pairs[idx].len - 1];
+		t = bench_now() - start;
+		if (!round || t < batch)
+			batch = t;
+	}
+
+	judy_close(judy);
+	free(pairs);
+
+	if (sum[0] != sum[1]) {
+		fprintf(stderr, "judy_nxt_batch results differ from judy_nxt\n");
+		return 1;
+	}
+
+	printf("judy_nxt        %8.1f ns/key\n", single * 1e9 / k->count);
+	printf("judy_nxt_batch  %8.1f ns/key  (%.2fx)\n", batch * 1e9 / k->count, single / batch);
+	return 0;
+}
+
+// Loading by reinsertion against judy_save / judy_map, and lookups on the
+// live array against the mapped image, one at a time and batched.
+int bench_image(bench_keys *k) {
+	double start, insert = 0, map = 0, live = 0, mapped = 0, batch = 0, t;
+	judyslot **cells = malloc(k->count * sizeof(judyslot *));
+	judyvalue sum = 0, batchsum = 0;
+	judyslot *cell, size;
+	uint idx, round;
+	Judy *judy, *image;
+
+	for (round = 0; round < ROUNDS; round++) {
+		start = bench_now();
+		judy = judy_open(1024);
+		for (idx = 0; idx < k->count; idx++)
+			*(judy_cell(judy, k->keys[idx], k->lens[idx])) = idx + 1;
+		t = bench_now() - start;
+		if (!round || t < insert)
+			insert = t;
+		if (round < ROUNDS - 1)
+			judy_close(judy);
+	}
+
+	if (!(size = judy_save(judy, IMAGE))) {
+		fprintf(stderr, "unable to save image %s\n", IMAGE);
+		judy_close(judy);
+		return 1;
+	}
+
+	for (round = 0; round < ROUNDS; round++) {
+		start = bench_now();
+		image = judy_map(IMAGE, 1024);
+		t = bench_now() - start;
+		if (!round || t < map)
+			map = t;
+		if (!image) {
+			fprintf(stderr, "unable to map image %s\n", IMAGE);
+			judy_close(judy);
+			free(cells);
+			return 1;
+		}
+		if (round < ROUNDS - 1)
+			judy_close(image);
+	}
+
+	bench_shuffle(k);
+
+	for (round = 0; round < ROUNDS; round++) {
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			if ((cell = judy_slot(judy, k->keys[idx], k->lens[idx])))
+				sum += *cell, batchsum += *cell;
+		t = bench_now() - start;
+		if (!round || t < live)
+			live = t;
+
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			if ((cell = judy_slot(image, k->keys[idx], k->lens[idx])))
+				sum -= *cell;
+		t = bench_now() - start;
+		if (!round || t < mapped)
+			mapped = t;
+
+		start = bench_now();
+		judy_slot_batch(image, k->keys, k->lens, k->count, cells);
+		t = bench_now() - start;
+		if (!round || t < batch)
+			batch = t;
+
+		for (idx = 0; idx < k->count; idx++)
+			if (cells[idx])
+				batchsum -= *cells[idx];
+	}
+
+	if (sum || batchsum)
+		fprintf(stderr, "mapped image results differ from the live array\n");
+
+	printf("image size      %8.1f MB\n", size / 1048576.0);
+	printf("judy_cell load  %8.1f ms\n", insert * 1e3);
+	printf("judy_map load   %8.3f ms\n", map * 1e3);
+	printf("judy_slot live  %8.1f ns/key\n", live * 1e9 / k->count);
+	printf("judy_slot image %8.1f ns/key\n", mapped * 1e9 / k->count);
+	printf("batch image     %8.1f ns/key\n", batch * 1e9 / k->count);
+
+	judy_close(image);
+	judy_close(judy);
+	unlink(IMAGE);
+	free(cells);
+	return sum || batchsum;
+}
+
+// Checkpoint by walking the array and reinserting every key, against
+// judy_dump and judy_restore of the node image.
+int bench_dump(bench_keys *k) {
+	double start, walk = 0, dump = 0, restore = 0, t;
+	uchar *key = malloc(1024), *image;
+	judyslot *cell, size;
+	uint idx, round;
+	Judy *judy, *copy;
+	int bad = 0;
+
+	judy = judy_open(1024);
+
+	for (idx = 0; idx < k->count; idx++)
+		*(judy_cell(judy, k->keys[idx], k->lens[idx])) = idx + 1;
+
+	size = judy_dump(judy, NULL, 0);
+	image = malloc(size);
+
+	for (round = 0; round < ROUNDS; round++) {
+		start = bench_now();
+		copy = judy_open(1024);
+		for (cell = judy_strt(judy, NULL, 0); cell; cell = judy_nxt(judy)) {
+			judy_key(judy, key, 1024);
+			*(judy_cell(copy, key, strlen((const char *)key))) = *cell;
+		}
+		t = bench_now() - start;
+		if (!round || t < walk)
+			walk = t;
+		judy_close(copy);
+
+		start = bench_now();
+		judy_dump(judy, image, size);
+		t = bench_now() - start;
+		if (!round || t < dump)
+			dump = t;
+
+		start = bench_now();
+		copy = judy_restore(image, size, 1024);
+		t = bench_now() - start;
+		if (!round || t < restore)
+			restore = t;
+
+		for (idx = 0; copy && idx < k->count; idx++)
+			if (!(cell = judy_slot(copy, k->keys[idx], k->lens[idx])) || !*cell)
+				break;
+
+		if (!copy || idx < k->count)
+			bad = 1;
+		if (copy)
+			judy_close(copy);
+	}
+
+	if (bad)
+		fprintf(stderr, "judy_restore lost keys\n");
+
+	printf("image size      %8.1f MB\n", size / 1048576.0);
+	printf("walk + reinsert %8.1f ms\n", walk * 1e3);
+	printf("judy_dump       %8.1f ms  %8.0f MB/s\n", dump * 1e3, size / dump / 1048576.0);
+	printf("judy_restore    %8.1f ms  %8.0f MB/s\n", restore * 1e3, size / restore / 1048576.0);
+	printf("dump + restore  %8.1f ms  (%.1fx)\n", (dump + restore) * 1e3, walk / (dump + restore));
+
+	judy_close(judy);
+	free(image);
+	free(key);
+	return bad;
+}
+
+// Loading keys in sorted order with judy_cell against judy_bulk_load.
+// Both arrays must walk to the same keys and values.
+int bench_bulk(bench_keys *k) {
+	judyslot *values = malloc(k->count * sizeof(judyslot));
+	uchar **keys = malloc(k->count * sizeof(uchar *));
+	uint *lens = malloc(k->count * sizeof(uint));
+	double start, insert = 0, bulk = 0, t;
+	uint idx, round, count = 0, len, other;
+	JudyStats built, loaded;
+	judyslot *cell, *match;
+	Judy *judy, *load;
+	uchar *key;
+	int bad = 0;
+
+	bench_unique(k);
+
+	// sort the keys by walking an array of their indexes
+
+	judy = judy_open(1024);
+
+	for (idx = 0; idx < k->count; idx++)
+		*(judy_cell(judy, k->keys[idx], k->lens[idx])) = idx + 1;
+
+	for (cell = judy_strt(judy, NULL, 0); cell; cell = judy_nxt(judy)) {
+		keys[count] = k->keys[*cell - 1];
+		lens[count] = k->lens[*cell - 1];
+		values[count] = count + 1;
+		count++;
+	}
+
+	judy_close(judy);
+
+	for (round = 0; round < ROUNDS; round++) {
+		start = bench_now();
+		judy = judy_open(1024);
+		for (idx = 0; idx < count; idx++)
+			*(judy_cell(judy, keys[idx], lens[idx])) = values[idx];
+		t = bench_now() - start;
+		if (!round || t < insert)
+			insert = t;
+
+		start = bench_now();
+		load = judy_open(1024);
+		if (judy_bulk_load(load, keys, lens, values, count) != count)
+			bad = 1;
+		t = bench_now() - start;
+		if (!round || t < bulk)
+			bulk = t;
+
+		if (round < ROUNDS - 1)
+			judy_close(judy), judy_close(load);
+	}
+
+	cell = judy_strt(judy, NULL, 0);
+	match = judy_strt(load, NULL, 0);
+
+	for (; cell && match; cell = judy_nxt(judy), match = judy_nxt(load)) {
+		key = judy_keyref(judy, &len);
+		if (*cell != *match || memcmp(key, judy_keyref(load, &other), len) || len != other)
+			bad = 1;
+	}
+
+	if (cell || match)
+		bad = 1;
+
+	if (bad)
+		fprintf(stderr, "judy_bulk_load results differ from judy_cell\n");
+
+	judy_stats(judy, &built);
+	judy_stats(load, &loaded);
+
+	printf("judy_cell sorted %8.1f ms  %8.1f MB\n", insert * 1e3, built.segbytes / 1048576.0);
+	printf("judy_bulk_load   %8.1f ms  %8.1f MB  (%.2fx)\n", bulk * 1e3, loaded.segbytes / 1048576.0, insert / bulk);
+
+	judy_close(judy);
+	judy_close(load);
+	free(values);
+	free(keys);
+	free(lens);
+	return bad;
+}
+
+// Count data TLB read misses of this thread, or return -1 where the
+// counter is unavailable.
+int bench_tlb_open(void) {
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+// Random lookups on an array built with the given segment options.
+void bench_segments_run(bench_keys *k, const char *name, JudyAlloc *alloc, int tlb) {
+	double start, best = 0, t;
+	uint64_t misses = 0, count;
+	judyvalue sum = 0;
+	judyslot *cell;
+	uint idx, round;
+	Judy *judy;
+
+	if (!(judy = judy_openx(1024, alloc))) {
+		printf("%-16s unavailable\n", name);
+		return;
+	}
+
+	for (idx = 0; idx < k->count; idx++)
+		*(judy_cell(judy, k->keys[idx], k->lens[idx])) = idx + 1;
+
+	for (round = 0; round < ROUNDS; round++) {
+#ifdef __linux__
+		if (tlb >= 0) {
+			ioctl(tlb, PERF_EVENT_IOC_RESET, 0);
+			ioctl(tlb, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			if ((cell = judy_slot(judy, k->keys[idx], k->lens[idx])))
+				sum += *cell;
+		t = bench_now() - start;
+#ifdef __linux__
+		if (tlb >= 0) {
+			ioctl(tlb, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(tlb, &count, sizeof(count)) == sizeof(count) && (!round || count < misses))
+				misses = count;
+		}
+#endif
+		if (!round || t < best)
+			best = t;
+	}
+
+	if (tlb >= 0)
+		printf("%-16s %8.1f ns/key %8.3f dTLB misses/key\n", name, best * 1e9 / k->count, (double)misses / k->count);
+	else
+		printf("%-16s %8.1f ns/key\n", name, best * 1e9 / k->count);
+
+	if (!sum)
+		printf("no keys found\n");
+
+	judy_close(judy);
+}
+
+// Lookup latency and TLB misses with the default 64 KB segments against
+// huge page backed ones. Use a key file that builds a large array.
+void bench_segments(bench_keys *k) {
+	int tlb = bench_tlb_open();
+	JudyAlloc alloc;
+
+	if (tlb < 0)
+		printf("dTLB counter unavailable, timing only\n");
+
+	bench_shuffle(k);
+
+	bench_segments_run(k, "64 KB segments", NULL, tlb);
+
+	memset(&alloc, 0, sizeof(alloc));
+	alloc.segsize = 16 * JUDY_hugesize;
+	bench_segments_run(k, "32 MB segments", &alloc, tlb);
+
+	alloc.flags = JUDY_hugepage;
+	bench_segments_run(k, "MADV_HUGEPAGE", &alloc, tlb);
+
+	// plain pages unless huge pages are reserved in /proc/sys/vm/nr_hugepages
+	alloc.flags = JUDY_hugetlb;
+	bench_segments_run(k, "MAP_HUGETLB", &alloc, tlb);
+
+	if (tlb >= 0)
+		close(tlb);
+}
+
+// Segment bytes after deleting most keys at random, then after
+// judy_compact, and the time of judy_compact_step at a fixed budget.
+int bench_compact(bench_keys *k) {
+	double start, full = 0, worst = 0, t;
+	JudyStats built, purged, after;
+	uint idx, steps = 0;
+	judyslot *cell;
+	Judy *judy;
+	int more;
+
+	bench_unique(k);
+
+	for (more = 0; more < 2; more++) {
+		judy = judy_open(1024);
+
+		for (idx = 0; idx < k->count; idx++)
+			*(judy_cell(judy, k->keys[idx], k->lens[idx])) = idx + 1;
+
+		judy_stats(judy, &built);
+		srand(1);
+
+		for (idx = 0; idx < k->count; idx++)
+			if (rand() % 10 < 8 && judy_slot(judy, k->keys[idx], k->lens[idx]))
+				judy_del(judy);
+
+		judy_stats(judy, &purged);
+
+		if (!more) {
+			start = bench_now();
+			judy_compact(judy);
+			full = bench_now() - start;
+		}
+		else {
+			do {
+				start = bench_now();
+				more = judy_compact_step(judy, COMPACT);
+				t = bench_now() - start;
+				if (t > worst)
+					worst = t;
+				steps++;
+			} while (more);
+			more = 1;
+		}
+
+		judy_stats(judy, &after);
+
+		srand(1);
+
+		for (idx = 0; idx < k->count; idx++) {
+			cell = judy_slot(judy, k->keys[idx], k->lens[idx]);
+			if (rand() % 10 < 8 ? cell && *cell : !cell || *cell != idx + 1) {
+				fprintf(stderr, "judy_compact lost keys\n");
+				judy_close(judy);
+				return 1;
+			}
+		}
+
+		judy_close(judy);
+	}
+
+	printf("segments built  %8.1f MB\n", built.segbytes / 1048576.0);
+	printf("after 80%% del   %8.1f MB\n", purged.segbytes / 1048576.0);
+	printf("after compact   %8.1f MB\n", after.segbytes / 1048576.0);
+	printf("judy_compact    %8.1f ms\n", full * 1e3);
+	printf("%u steps of %u nodes, longest %.3f ms\n", steps, COMPACT, worst * 1e3);
+	return 0;
+}
+
+// Integer indexes hashed from the keys, held by judyL_ins against the
+// bottom-up strings of judy-utilities.c: inserts, shuffled lookups, a
+// full walk and node bytes per index.
+
+judyvalue bench_hash(uchar *key, uint len) {
+	judyvalue hash = (judyvalue)14695981039346656037ULL;
+
+	while (len--)
+		hash = (hash ^ *key++) * (judyvalue)1099511628211ULL;
+
+	return hash;
+}
+
+judyslot bench_node_bytes(Judy *judy) {
+	judyslot bytes = 0;
+	JudyStats stats;
+	uint type;
+
+	judy_stats(judy, &stats);
+
+	for (type = 0; type < 8; type++)
+		bytes += stats.bytes[type];
+
+	return bytes;
+}
+
+int bench_integers(bench_keys *k) {
+	judyvalue *indexes = malloc(k->count * sizeof(judyvalue));
+	double start, times[2][3], t;
+	judyvalue index, last, sums[2][2];
+	uchar buff[BOTTOM_UP_SIZE + 1];
+	judyslot bytes[2], *cell;
+	uint idx, other, round, way, count[2];
+	Judy *judy;
+	int bad = 0;
+
+	bench_unique(k);
+
+	for (idx = 0; idx < k->count; idx++)
+		indexes[idx] = bench_hash(k->keys[idx], k->lens[idx]);
+
+	for (round = 0; round < ROUNDS; round++)
+	  for (way = 0; way < 2; way++) {
+		sums[way][0] = sums[way][1] = 0;
+		count[way] = 0;
+		judy = judy_open(1024);
+
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			if (way) {
+				*judyL_ins(judy, indexes[idx]) = idx + 1;
+			}
+			else {
+				judyvalue_native_to_bottom_up(indexes[idx], buff);
+				*judy_cell(judy, buff, BOTTOM_UP_SIZE) = idx + 1;
+			}
+		t = bench_now() - start;
+		if (!round || t < times[way][0])
+			times[way][0] = t;
+
+		// the same shuffled order for both ways and every round
+
+		srand(1);
+
+		for (idx = k->count; idx > 1; idx--) {
+			other = rand() % idx;
+			index = indexes[idx - 1], indexes[idx - 1] = indexes[other], indexes[other] = index;
+		}
+
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			if (way) {
+				if ((cell = judyL_get(judy, indexes[idx])))
+					sums[way][0] += *cell;
+			}
+			else {
+				judyvalue_native_to_bottom_up(indexes[idx], buff);
+				if ((cell = judy_slot(judy, buff, BOTTOM_UP_SIZE)))
+					sums[way][0] += *cell;
+			}
+		t = bench_now() - start;
+		if (!round || t < times[way][1])
+			times[way][1] = t;
+
+		// judyL walks in numeric order, bottom-up in its own byte order
+
+		start = bench_now();
+		if (way) {
+			index = 0;
+			for (cell = judyL_first(judy, &index); cell; cell = judyL_next(judy, &index)) {
+				if (count[way]++ && index <= last)
+					bad = 1;
+				sums[way][1] += index;
+				last = index;
+			}
+		}
+		else {
+			for (cell = judy_strt(judy, NULL, 0); cell; cell = judy_nxt(judy)) {
+				judy_key(judy, buff, sizeof(buff));
+				sums[way][1] += judyvalue_bottom_up_to_native(buff);
+				count[way]++;
+			}
+		}
+		t = bench_now() - start;
+		if (!round || t < times[way][2])
+			times[way][2] = t;
+
+		bytes[way] = bench_node_bytes(judy);
+		judy_close(judy);
+	  }
+
+	if (bad || count[0] != count[1] || sums[0][0] != sums[1][0] || sums[0][1] != sums[1][1])
+		fprintf(stderr, "judyL results differ from the bottom-up strings\n"), bad = 1;
+
+	printf("%u distinct indexes\n", count[1]);
+	printf("                  bottom-up    judyL\n");
+	printf("insert   ns/index  %8.1f  %8.1f\n", times[0][0] * 1e9 / k->count, times[1][0] * 1e9 / k->count);
+	printf("lookup   ns/index  %8.1f  %8.1f\n", times[0][1] * 1e9 / k->count, times[1][1] * 1e9 / k->count);
+	printf("walk     ns/index  %8.1f  %8.1f\n", times[0][2] * 1e9 / k->count, times[1][2] * 1e9 / k->count);
+	printf("nodes bytes/index  %8.1f  %8.1f\n", (double)bytes[0] / count[0], (double)bytes[1] / count[1]);
+
+	free(indexes);
+	return bad;
+}
+
+uint bench_hex(uchar *key, uint len, uchar *buff) {
+	static const char digits[] = "0123456789abcdef";
+	uint pos;
+
+	for (pos = 0; pos < len; pos++) {
+		buff[2 * pos] = digits[key[pos] >> 4];
+		buff[2 * pos + 1] = digits[key[pos] & 0x0F];
+	}
+
+	return 2 * len;
+}
+
+uint bench_hexval(uchar digit) {
+	return digit <= '9' ? digit - '0' : digit - 'a' + 10;
+}
+
+// Packed binary keys, a 32 bit id, a 16 bit length and the key text,
+// held with judy_bcell against hex encoding them for judy_cell.
+
+int bench_binary(bench_keys *k) {
+	bench_keys keys[1];
+	uint *order = malloc(k->count * sizeof(uint));
+	double start, times[2][3], t;
+	judyslot bytes[2], *cell;
+	judyvalue sums[2][2];
+	uchar buff[2048], *key;
+	uint idx, other, round, way, len, pos;
+	Judy *judy;
+	int bad = 0;
+
+	bench_unique(k);
+
+	keys->keys = malloc(k->count * sizeof(uchar *));
+	keys->lens = malloc(k->count * sizeof(uint));
+	keys->count = k->count;
+
+	for (idx = 0; idx < k->count; idx++) {
+		len = k->lens[idx] < 1000 ? k->lens[idx] : 1000;
+		key = malloc(len + 6);
+		key[0] = idx >> 28, key[1] = idx >> 20, key[2] = idx >> 12, key[3] = idx >> 4;
+		key[4] = len >> 8, key[5] = len;
+		memcpy(key + 6, k->keys[idx], len);
+		keys->keys[idx] = key;
+		keys->lens[idx] = len + 6;
+	}
+
+	srand(1);
+
+	for (idx = 0; idx < k->count; idx++)
+		order[idx] = idx;
+
+	for (idx = k->count; idx > 1; idx--) {
+		other = rand() % idx;
+		pos = order[idx - 1], order[idx - 1] = order[other], order[other] = pos;
+	}
+
+	for (round = 0; round < ROUNDS; round++)
+	  for (way = 0; way < 2; way++) {
+		sums[way][0] = sums[way][1] = 0;
+		judy = judy_open(1024);
+
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			if (way)
+				*judy_bcell(judy, keys->keys[idx], keys->lens[idx]) = idx + 1;
+			else {
+				len = bench_hex(keys->keys[idx], keys->lens[idx], buff);
+				*judy_cell(judy, buff, len) = idx + 1;
+			}
+		t = bench_now() - start;
+		if (!round || t < times[way][0])
+			times[way][0] = t;
+
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++) {
+			pos = order[idx];
+			if (way)
+				cell = judy_bslot(judy, keys->keys[pos], keys->lens[pos]);
+			else {
+				len = bench_hex(keys->keys[pos], keys->lens[pos], buff);
+				cell = judy_slot(judy, buff, len);
+			}
+			if (cell)
+				sums[way][0] += *cell;
+		}
+		t = bench_now() - start;
+		if (!round || t < times[way][1])
+			times[way][1] = t;
+
+		// both walk in the order of the binary keys, decoding each one
+
+		start = bench_now();
+		for (cell = judy_strt(judy, NULL, 0); cell; cell = judy_nxt(judy)) {
+			if (way)
+				len = judy_bkey(judy, buff, sizeof(buff));
+			else {
+				judy_key(judy, buff, sizeof(buff));
+				len = strlen((const char *)buff) / 2;
+				for (pos = 0; pos < len; pos++)
+					buff[pos] = bench_hexval(buff[2 * pos]) << 4 | bench_hexval(buff[2 * pos + 1]);
+			}
+			sums[way][1] = sums[way][1] * 31 + buff[0] + buff[len - 1] + len;
+		}
+		t = bench_now() - start;
+		if (!round || t < times[way][2])
+			times[way][2] = t;
+
+		bytes[way] = bench_node_bytes(judy);
+		judy_close(judy);
+	  }
+
+	if (sums[0][0] != sums[1][0] || sums[0][1] != sums[1][1])
+		fprintf(stderr, "binary key results differ from the hex keys\n"), bad = 1;
+
+	printf("                       hex    binary\n");
+	printf("insert   ns/key   %8.1f  %8.1f\n", times[0][0] * 1e9 / k->count, times[1][0] * 1e9 / k->count);
+	printf("lookup   ns/key   %8.1f  %8.1f\n", times[0][1] * 1e9 / k->count, times[1][1] * 1e9 / k->count);
+	printf("walk     ns/key   %8.1f  %8.1f\n", times[0][2] * 1e9 / k->count, times[1][2] * 1e9 / k->count);
+	printf("nodes bytes/key   %8.1f  %8.1f\n", (double)bytes[0] / k->count, (double)bytes[1] / k->count);
+
+	for (idx = 0; idx < k->count; idx++)
+		free(keys->keys[idx]);
+
+	free(keys->keys);
+	free(keys->lens);
+
+	free(order);
+	return bad;
+}
+
+#ifdef JUDY_COUNTS
+// judy_rank, judy_select and judy_count_range against walking the keys,
+// with the memory the count words take. Build with -DJUDY_COUNTS, and
+// compare the insert and delete times with the build without it.
+
+#define RANGE	1000
+
+int bench_counts(bench_keys *k) {
+	uchar **los = malloc(k->count * sizeof(uchar *)), **his = malloc(k->count * sizeof(uchar *));
+	uint *lolens = malloc(k->count * sizeof(uint)), *hilens = malloc(k->count * sizeof(uint));
+	double start, times[7] = {0}, t;
+	judyslot rank, total, bytes, sum[2] = {0, 0};
+	uint idx, round, ranges, step;
+	uchar buff[1024];
+	JudyStats stats;
+	judyslot *cell;
+	Judy *judy;
+	int bad = 0;
+
+	bench_unique(k);
+	bench_shuffle(k);
+
+	if (k->count <= RANGE) {
+		fprintf(stderr, "the counts benchmark needs more than %d keys\n", RANGE);
+		return 1;
+	}
+
+	ranges = k->count / RANGE;
+
+	for (round = 0; round < ROUNDS; round++) {
+		judy = judy_open(1024);
+
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			*judy_cell(judy, k->keys[idx], k->lens[idx]) = idx + 1;
+		t = bench_now() - start;
+		if (!round || t < times[0])
+			times[0] = t;
+
+		// the nodes built by the inserts have no counts until asked
+
+		start = bench_now();
+		total = judy_rank(judy, (uchar *)"\xff", 1);
+		t = bench_now() - start;
+		if (!round || t < times[1])
+			times[1] = t;
+
+		if (total != k->count)
+			bad = 1;
+
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			sum[0] += judy_rank(judy, k->keys[idx], k->lens[idx]);
+		t = bench_now() - start;
+		if (!round || t < times[2])
+			times[2] = t;
+
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			if (judy_select(judy, idx * 7919ULL % k->count))
+				sum[1] += judy_key(judy, buff, sizeof(buff));
+		t = bench_now() - start;
+		if (!round || t < times[3])
+			times[3] = t;
+
+		// ranges of RANGE keys, from select on shuffled positions
+
+		for (idx = 0; idx < ranges; idx++) {
+			rank = (judyslot)idx * 7919 % (k->count - RANGE);
+			judy_select(judy, rank);
+			judy_key(judy, buff, sizeof(buff));
+			los[idx] = (uchar *)strdup((char *)buff);
+			lolens[idx] = strlen((char *)buff);
+			judy_select(judy, rank + RANGE - 1);
+			judy_key(judy, buff, sizeof(buff));
+			his[idx] = (uchar *)strdup((char *)buff);
+			hilens[idx] = strlen((char *)buff);
+		}
+
+		start = bench_now();
+		for (idx = 0; idx < ranges; idx++)
+			if (judy_count_range(judy, los[idx], lolens[idx], his[idx], hilens[idx]) != RANGE)
+				bad = 1;
+		t = bench_now() - start;
+		if (!round || t < times[4])
+			times[4] = t;
+
+		start = bench_now();
+		for (idx = 0; idx < ranges; idx++) {
+			cell = judy_strt(judy, los[idx], lolens[idx]);
+			for (step = 0; cell; step++) {
+				judy_key(judy, buff, sizeof(buff));
+				if (strcmp((char *)buff, (char *)his[idx]) > 0)
+					break;
+				cell = judy_nxt(judy);
+			}
+			if (step != RANGE)
+				bad = 1;
+		}
+		t = bench_now() - start;
+		if (!round || t < times[5])
+			times[5] = t;
+
+		for (idx = 0; idx < ranges; idx++)
+			free(los[idx]), free(his[idx]);
+
+		bytes = bench_node_bytes(judy);
+		judy_stats(judy, &stats);
+
+		start = bench_now();
+		for (idx = 0; idx < k->count; idx++)
+			if (judy_slot(judy, k->keys[idx], k->lens[idx]))
+				judy_del(judy);
+		t = bench_now() - start;
+		if (!round || t < times[6])
+			times[6] = t;
+
+		if (judy_rank(judy, (uchar *)"\xff", 1))
+			bad = 1;
+
+		judy_close(judy);
+	}
+
+	if (bad)
+		fprintf(stderr, "counts disagree with the keys\n");
+
+	printf("insert              %8.1f ns/key\n", times[0] * 1e9 / k->count);
+	printf("first rank, summing %8.1f ns/key\n", times[1] * 1e9 / k->count);
+	printf("judy_rank           %8.1f ns/key\n", times[2] * 1e9 / k->count);
+	printf("judy_select         %8.1f ns/key\n", times[3] * 1e9 / k->count);
+	printf("judy_count_range    %8.1f ns/range of %d\n", times[4] * 1e9 / ranges, RANGE);
+	printf("walk the range      %8.1f ns/range of %d\n", times[5] * 1e9 / ranges, RANGE);
+	printf("delete              %8.1f ns/key\n", times[6] * 1e9 / k->count);
+	printf("nodes %.1f bytes/key, of which counts %.1f (%.1f%% over the nodes without them)\n",
+		(double)bytes / k->count, (double)stats.countbytes / k->count, 100.0 * stats.countbytes / (bytes - stats.countbytes));
+
+	free(los), free(his);
+	free(lolens), free(hilens);
+	return bad;
+}
+#endif
+
+#ifdef JUDY_INSTRUMENT
+// What the inserts and then the lookups of the keys did inside the
+// array: nodes visited by type and depth, promotions, splits and where
+// the node blocks came from. Build with -DJUDY_CYCLES to add the time
+// spent promoting, splitting and allocating segments.
+
+static const char *bench_types[8] = {"radix", "1", "2", "4", "8", "16", "32", "span"};
+
+void bench_counters(const char *name, JudyCounters *c, uint count) {
+	judyslot visits = 0, deepest = 0, promotes = 0;
+	uint type, depth;
+
+	for (type = 0; type < 8; type++)
+		visits += c->visits[type], promotes += c->promotes[type];
+
+	printf("%s: %.2f nodes/key\n", name, (double)visits / count);
+
+	if (!visits)
+		return;
+
+	printf("  visits by type:");
+	for (type = 0; type < 8; type++)
+		printf(" %s %.1f%%", bench_types[type], 100.0 * c->visits[type] / visits);
+	printf("\n");
+
+	for (depth = 0; depth < JUDY_depths; depth++)
+		if (c->depth[depth])
+			deepest = depth;
+
+	printf("  walks reaching depth:");
+	for (depth = 1; depth <= deepest; depth++)
+		printf(" %u%s:%.1f%%", depth, depth < JUDY_depths - 1 ? "" : "+", 100.0 * c->depth[depth] / count);
+	printf("\n");
+
+	if (!promotes && !c->splits && !c->spansplits && !c->reuses && !c->carves)
+		return;
+
+	printf("  promotions %lld from", (long long)promotes);
+	for (type = 1; type < 7; type++)
+		printf(" %s:%lld", bench_types[type], (long long)c->promotes[type]);
+	printf(", splits %lld, span splits %lld\n", (long long)c->splits, (long long)c->spansplits);
+	printf("  node blocks %lld from free lists, %lld carved, %lld segments\n",
+		(long long)c->reuses, (long long)c->carves, (long long)c->segments);
+#ifdef JUDY_CYCLES
+	printf("  cycles per promotion %.0f, split %.0f, span split %.0f, segment %.0f\n",
+		promotes ? (double)c->promotecycles / promotes : 0,
+		c->splits ? (double)c->splitcycles / c->splits : 0,
+		c->spansplits ? (double)c->spancycles / c->spansplits : 0,
+		c->segments ? (double)c->segmentcycles / c->segments : 0);
+#endif
+}
+
+int bench_instrument(bench_keys *k) {
+	JudyCounters counters;
+	uint idx;
+	Judy *judy;
+	int bad = 0;
+
+	bench_unique(k);
+	bench_shuffle(k);
+
+	judy = judy_open(1024);
+
+	for (idx = 0; idx < k->count; idx++)
+		*judy_cell(judy, k->keys[idx], k->lens[idx]) = idx + 1;
+
+	judy_counters(judy, &counters);
+	bench_counters("insert", &counters, k->count);
+
+	bench_shuffle(k);
+
+	for (idx = 0; idx < k->count; idx++)
+		if (!judy_slot(judy, k->keys[idx], k->lens[idx]))
+			bad++;
+
+	judy_counters(judy, &counters);
+	bench_counters("lookup", &counters, k->count);
+
+	if (bad)
+		fprintf(stderr, "%d keys missing\n", bad);
+
+	judy_close(judy);
+	return bad;
+}
+
+// Insert and delete one key over and over beside a node of 1 to CHURN
+// others. Demotion on delete leaves free slots behind, so the node
+// should be promoted at most once however long this goes on.
+
+int bench_churn(void) {
+	JudyCounters counters;
+	judyslot promotes;
+	uchar key[16];
+	uint held, idx, type;
+	Judy *judy;
+	int bad = 0;
+
+	for (held = 1; held <= CHURN; held++) {
+		judy = judy_open(16);
+
+		for (idx = 0; idx < held; idx++)
+			*judy_cell(judy, key, sprintf((char *)key, "k%03u", idx)) = idx + 1;
+
+		judy_counters(judy, &counters);
+
+		for (idx = 0; idx < CYCLES; idx++) {
+			*judy_cell(judy, (uchar *)"k999", 4) = 1;
+
+			if (judy_slot(judy, (uchar *)"k999", 4))
+				judy_del(judy);
+		}
+
+		judy_counters(judy, &counters);
+
+		for (promotes = type = 0; type < 8; type++)
+			promotes += counters.promotes[type];
+
+		printf("%u keys: %lld promotions in %d cycles\n", held, (long long)promotes, CYCLES);
+
+		if (promotes > 1) {
+			fprintf(stderr, "%u keys: node thrashes\n", held);
+			bad++;
+		}
+
+		judy_close(judy);
+	}
+
+	return bad;
+}
+#endif
+
+// Intersection and union of two overlapping arrays: judy_nxt over one
+// probing the other with judy_slot, against judy_setwalk and judy_union.
+// The arrays either share a third of the keys picked at random, or
+// split the key order into overlapping ranges, where whole subtrees
+// belong to one array. The intersections sum the values, the key
+// lengths and the last key bytes, so the keys judy_setwalk hands out
+// are checked too.
+
+int bench_setsum(void *ctx, uchar *key, uint len, judyslot value) {
+	*(judyslot *)ctx += value + len + (len ? key[len - 1] : 0);
+	return 0;
+}
+
+int bench_sets_run(bench_keys *k, const char *name, uchar *side) {
+	uchar buff[1024];
+	double start, times[4], t;
+	judyslot *cell, *other, sum[2];
+	uint idx, round, count[2], len;
+	Judy *a, *b, *out;
+	int bad = 0;
+
+	a = judy_open(1024);
+	b = judy_open(1024);
+
+	for (idx = 0; idx < k->count; idx++) {
+		if (side[idx] & 1)
+			*judy_cell(a, k->keys[idx], k->lens[idx]) = idx + 1;
+		if (side[idx] & 2)
+			*judy_cell(b, k->keys[idx], k->lens[idx]) = idx + 1;
+	}
+
+	for (round = 0; round < ROUNDS; round++) {
+		sum[0] = sum[1] = 0;
+
+		start = bench_now();
+		for (cell = judy_strt(a, NULL, 0); cell; cell = judy_nxt(a)) {
+			judy_key(a, buff, sizeof(buff));
+			len = strlen((char *)buff);
+			if ((other = judy_slot(b, buff, len)) && *other)
+				sum[0] += *cell + len + (len ? buff[len - 1] : 0);
+		}
+		t = bench_now() - start;
+		if (!round || t < times[0])
+			times[0] = t;
+
+		start = bench_now();
+		judy_setwalk(a, b, JUDY_intersect, NULL, bench_setsum, &sum[1]);
+		t = bench_now() - start;
+		if (!round || t < times[1])
+			times[1] = t;
+
+		out = judy_open(1024);
+		start = bench_now();
+		for (cell = judy_strt(a, NULL, 0); cell; cell = judy_nxt(a)) {
+			judy_key(a, buff, sizeof(buff));
+			*judy_cell(out, buff, strlen((char *)buff)) = *cell;
+		}
+		for (cell = judy_strt(b, NULL, 0); cell; cell = judy_nxt(b)) {
+			judy_key(b, buff, sizeof(buff));
+			*judy_cell(out, buff, strlen((char *)buff)) = *cell;
+		}
+		t = bench_now() - start;
+		if (!round || t < times[2])
+			times[2] = t;
+
+		for (count[0] = 0, cell = judy_strt(out, NULL, 0); cell; cell = judy_nxt(out))
+			count[0]++;
+		judy_close(out);
+
+		out = judy_open(1024);
+		start = bench_now();
+		count[1] = judy_union(out, a, b, NULL, NULL);
+		t = bench_now() - start;
+		if (!round || t < times[3])
+			times[3] = t;
+
+		judy_close(out);
+
+		if (sum[0] != sum[1] || count[0] != k->count || count[1] != k->count)
+			bad = 1;
+	}
+
+	if (bad)
+		fprintf(stderr, "%s: set operation results differ\n", name);
+
+	printf("%s\n", name);
+	printf("  intersect: judy_nxt + judy_slot %8.1f ms\n", times[0] * 1e3);
+	printf("  intersect: judy_setwalk         %8.1f ms  (%.2fx)\n", times[1] * 1e3, times[0] / times[1]);
+	printf("  union: judy_nxt + judy_cell     %8.1f ms\n", times[2] * 1e3);
+	printf("  union: judy_union               %8.1f ms  (%.2fx)\n", times[3] * 1e3, times[2] / times[3]);
+
+	judy_close(a);
+	judy_close(b);
+	return bad;
+}
+
+int bench_sets(bench_keys *k) {
+	uchar *side;
+	judyslot *cell;
+	uint idx, rank;
+	Judy *judy;
+	int bad;
+
+	bench_unique(k);
+	bench_shuffle(k);
+	side = malloc(k->count);
+
+	// a holds the first two thirds of the shuffled keys and b the last two
+
+	for (idx = 0; idx < k->count; idx++)
+		side[idx] = (idx < k->count / 3 * 2) | (idx >= k->count / 3) << 1;
+
+	bad = bench_sets_run(k, "random thirds", side);
+
+	// the same split over the keys in order
+
+	judy = judy_open(1024);
+
+	for (idx = 0; idx < k->count; idx++)
+		*judy_cell(judy, k->keys[idx], k->lens[idx]) = idx + 1;
+
+	for (rank = 0, cell = judy_strt(judy, NULL, 0); cell; cell = judy_nxt(judy), rank++)
+		side[*cell - 1] = (rank < k->count / 3 * 2) | (rank >= k->count / 3) << 1;
+
+	judy_close(judy);
+
+	bad |= bench_sets_run(k, "key range thirds", side);
+
+	free(side);
+	return bad;
+}
+
+// Producer threads inserting their share of the keys, either into one
+// judy array behind a single lock or into a sharded judy array.
+
+typedef struct {
+	bench_keys *k;
+	JudyShards *shards;
+	Judy *judy;
+	pthread_mutex_t *lock;
+	pthread_t thread;
+	uint first, last;
+} bench_producer;
+
+void *bench_produce(void *arg) {
+	bench_producer *producer = arg;
+	bench_keys *k = producer->k;
+	uint idx;
+
+	for (idx = producer->first; idx < producer->last; idx++)
+		if (producer->shards)
+			judy_shards_add(producer->shards, k->keys[idx], k->lens[idx], 1);
+		else {
+			pthread_mutex_lock(producer->lock);
+			*(judy_cell(producer->judy, k->keys[idx], k->lens[idx])) += 1;
+			pthread_mutex_unlock(producer->lock);
+		}
+
+	return NULL;
+}
+
+double bench_ingest(bench_keys *k, uint threads, JudyShards *shards, Judy *judy) {
+	bench_producer *producers = calloc(threads, sizeof(bench_producer));
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	double start;
+	uint idx;
+
+	start = bench_now();
+
+	for (idx = 0; idx < threads; idx++) {
+		producers[idx].k = k;
+		producers[idx].shards = shards;
+		producers[idx].judy = judy;
+		producers[idx].lock = &lock;
+		producers[idx].first = (uint64_t)k->count * idx / threads;
+		producers[idx].last = (uint64_t)k->count * (idx + 1) / threads;
+		pthread_create(&producers[idx].thread, NULL, bench_produce, &producers[idx]);
+	}
+
+	for (idx = 0; idx < threads; idx++)
+		pthread_join(producers[idx].thread, NULL);
+
+	free(producers);
+	return bench_now() - start;
+}
+
+// Walk the shards both ways: keys must ascend and every insert must count.
+int bench_shards_walk(JudyShards *shards, bench_keys *k) {
+	uchar prev[1024], key[1024];
+	judyslot *cell;
+	uint64_t total = 0;
+	uint seen = 0;
+
+	prev[0] = 0;
+
+	for (cell = judy_shards_strt(shards, NULL, 0); cell; cell = judy_shards_nxt(shards)) {
+		judy_shards_key(shards, key, sizeof(key));
+		if (seen++ && strcmp((char *)prev, (char *)key) >= 0)
+			return 1;
+		strcpy((char *)prev, (char *)key);
+		total += *cell;
+	}
+
+	for (cell = judy_shards_end(shards); cell; cell = judy_shards_prv(shards))
+		seen--;
+
+	return total != k->count || seen;
+}
+
+// Insert rate by producer count, one lock against shards.
+int bench_shards(bench_keys *k, uint threads) {
+	JudyShards *shards;
+	double locked, sharded;
+	uint count;
+	int errors = 0;
+	Judy *judy;
+
+	bench_shuffle(k);
+
+	for (count = 1; count <= threads; count *= 2) {
+		judy = judy_open(1024);
+		locked = bench_ingest(k, count, NULL, judy);
+		judy_close(judy);
+
+		shards = judy_shards_open(SHARDS, 1024);
+		judy_shards_balance(shards, k->keys, k->lens, k->count);
+		sharded = bench_ingest(k, count, shards, NULL);
+
+		printf("%3u writers  one lock %10.0f keys/s  %u shards %10.0f keys/s\n",
+			count, k->count / locked, SHARDS, k->count / sharded);
+
+		errors |= bench_shards_walk(shards, k);
+		judy_shards_close(shards);
+	}
+
+	if (errors)
+		fprintf(stderr, "sharded walk is out of order or incomplete\n");
+
+	return errors;
+}
+
+#ifdef JUDY_CONCURRENT
+// One writer thread keeps inserting and deleting the odd keys
+// while reader threads look up and iterate through their own cursors.
+// The even keys are never touched and must always be found. Values go
+// in with judy_cell_set and are read with judy_load, as the
+// JUDY_CONCURRENT rules ask, so this runs clean under -fsanitize=thread.
+
+typedef struct {
+	Judy *judy;
+	bench_keys *k;
+	int stop;			// atomic
+	uint64_t writes;
+} bench_shared;
+
+typedef struct {
+	bench_shared *shared;
+	pthread_t thread;
+	uint seed;
+	int iterate;
+	uint64_t reads;
+	uint64_t errors;
+} bench_reader;
+
+void *bench_writer(void *arg) {
+	bench_shared *shared = arg;
+	bench_keys *k = shared->k;
+	uint idx;
+
+	while (!__atomic_load_n(&shared->stop, __ATOMIC_RELAXED)) {
+		for (idx = 1; idx < k->count; idx += 2)
+			judy_cell_set(shared->judy, k->keys[idx], k->lens[idx], idx + 1);
+
+		for (idx = 1; idx < k->count; idx += 2)
+			if (judy_slot(shared->judy, k->keys[idx], k->lens[idx]))
+				judy_del(shared->judy);
+
+		shared->writes += k->count;
+	}
+
+	return NULL;
+}
+
+// Walk the whole array: keys must ascend and every even key must show up.
+void bench_iterate(bench_reader *reader, JudyCursor *cursor) {
+	uchar prev[1024], key[1024];
+	judyslot *cell;
+	uint seen = 0;
+
+	prev[0] = 0;
+
+	for (cell = judy_cstrt(cursor, NULL, 0); cell; cell = judy_cnxt(cursor)) {
+		judy_ckey(cursor, key, sizeof(key));
+		if (seen++ && strcmp((char *)prev, (char *)key) >= 0)
+			reader->errors++;
+		strcpy((char *)prev, (char *)key);
+	}
+
+	if (seen < (reader->shared->k->count + 1) / 2)
+		reader->errors++;
+}
+
+void *bench_read(void *arg) {
+	bench_reader *reader = arg;
+	bench_keys *k = reader->shared->k;
+	JudyCursor *cursor = judy_copen(reader->shared->judy, 1024);
+	judyslot *cell, value;
+	uint idx, op;
+
+	while (!__atomic_load_n(&reader->shared->stop, __ATOMIC_RELAXED)) {
+		judy_enter(cursor);
+
+		for (op = 0; op < 64; op++) {
+			idx = rand_r(&reader->seed) % k->count;
+			cell = judy_cslot(cursor, k->keys[idx], k->lens[idx]);
+			value = cell ? judy_load(cell) : 0;
+
+			if (idx & 1) {
+				if (value && value != idx + 1)
+					reader->errors++;
+			}
+			else if (value != idx + 1)
+				reader->errors++;
+		}
+
+		reader->reads += op;
+
+		if (reader->iterate && !(reader->reads & 0x3FFF))
+			bench_iterate(reader, cursor);
+
+		judy_leave(cursor);
+	}
+
+	judy_cclose(cursor);
+	return NULL;
+}
+
+// Run the writer and count readers for SECONDS.
+void bench_run(bench_keys *k, uint count, int iterate, uint64_t *reads, uint64_t *writes, uint64_t *errors) {
+	bench_reader *readers = calloc(count, sizeof(bench_reader));
+	bench_shared shared;
+	pthread_t writer;
+	double start;
+	uint idx;
+
+	shared.judy = judy_open(1024);
+	shared.k = k;
+	shared.stop = 0;
+	shared.writes = 0;
+
+	for (idx = 0; idx < k->count; idx += 2)
+		*(judy_cell(shared.judy, k->keys[idx], k->lens[idx])) = idx + 1;
+
+	pthread_create(&writer, NULL, bench_writer, &shared);
+
+	for (idx = 0; idx < count; idx++) {
+		readers[idx].shared = &shared;
+		readers[idx].seed = idx + 1;
+		readers[idx].iterate = iterate;
+		pthread_create(&readers[idx].thread, NULL, bench_read, &readers[idx]);
+	}
+
+	start = bench_now();
+	while (bench_now() - start < SECONDS)
+		usleep(10000);
+
+	__atomic_store_n(&shared.stop, 1, __ATOMIC_RELAXED);
+	pthread_join(writer, NULL);
+	*reads = *errors = 0;
+
+	for (idx = 0; idx < count; idx++) {
+		pthread_join(readers[idx].thread, NULL);
+		*reads += readers[idx].reads;
+		*errors += readers[idx].errors;
+	}
+
+	*writes = shared.writes;
+	judy_close(shared.judy);
+	free(readers);
+}
+
+// Correctness under churn, with iteration checks.
+int bench_stress(bench_keys *k, uint threads) {
+	uint64_t reads, writes, errors;
+
+	bench_unique(k);
+	bench_run(k, threads, 1, &reads, &writes, &errors);
+
+	printf("stress: %u readers, %llu lookups, %llu writes, %llu errors\n",
+		threads, (unsigned long long)reads, (unsigned long long)writes, (unsigned long long)errors);
+
+	return errors != 0;
+}
+
+// Lookup throughput as readers are added.
+void bench_readers(bench_keys *k, uint threads) {
+	uint64_t reads, writes, errors;
+	uint count;
+
+	bench_unique(k);
+
+	for (count = 1; count <= threads; count *= 2) {
+		bench_run(k, count, 0, &reads, &writes, &errors);
+		printf("%3u readers %10.0f lookups/s %10.0f writes/s%s\n", count,
+			reads / SECONDS, writes / SECONDS, errors ? "  ERRORS" : "");
+	}
+}
+#endif
+
+int main(int argc, char **argv) {
+	const char *test = argc > 1 ? argv[1] : "slot";
+	const char *path = argc > 2 ? argv[2] : DICTIONARY;
+	uint threads = argc > 3 ? atoi(argv[3]) : THREADS;
+	bench_keys k;
+
+	if (!bench_read_keys(path, &k)) {
+		fprintf(stderr, "usage: %s [slot|export|scan|image|dump|bulk|segments|compact|integers|binary|counts|instrument|churn|sets|shards|stress|readers] [<key file> [<threads>]]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%u keys from %s\n", k.count, path);
+
+	if (!strcmp(test, "slot")) {
+		bench_slot(&k);
+	}
+	else if (!strcmp(test, "export")) {
+		return bench_export(&k);
+	}
+	else if (!strcmp(test, "scan")) {
+		return bench_scan(&k);
+	}
+	else if (!strcmp(test, "image")) {
+		return bench_image(&k);
+	}
+	else if (!strcmp(test, "dump")) {
+		return bench_dump(&k);
+	}
+	else if (!strcmp(test, "bulk")) {
+		return bench_bulk(&k);
+	}
+	else if (!strcmp(test, "segments")) {
+		bench_segments(&k);
+	}
+	else if (!strcmp(test, "compact")) {
+		return bench_compact(&k);
+	}
+	else if (!strcmp(test, "integers")) {
+		return bench_integers(&k);
+	}
+	else if (!strcmp(test, "binary")) {
+		return bench_binary(&k);
+	}
+	else if (!strcmp(test, "sets")) {
+		return bench_sets(&k);
+	}
+#ifdef JUDY_COUNTS
+	else if (!strcmp(test, "counts")) {
+		return bench_counts(&k);
+	}
+#endif
+#ifdef JUDY_INSTRUMENT
+	else if (!strcmp(test, "instrument")) {
+		return bench_instrument(&k);
+	}
+	else if (!strcmp(test, "churn")) {
+		return bench_churn();
+	}
+#endif
+	else if (!strcmp(test, "shards")) {
+		return bench_shards(&k, threads);
+	}
+#ifdef JUDY_CONCURRENT
+	else if (!strcmp(test, "stress")) {
+		return bench_stress(&k, threads);
+	}
+	else if (!strcmp(test, "readers")) {
+		bench_readers(&k, threads);
+	}
+#endif
+	else {
+		fprintf(stderr, "unknown benchmark %s\n", test);
+		return 1;
+	}
+
+	return 0;
+}
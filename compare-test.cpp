@@ -0,0 +1,656 @@
+/*
+ *  compare-test.cpp
+ *  judy-arrays
+ *
+ *  License: same as for judy-arrays.c
+ *
+ *  Timing driver comparing the judy string and integer calls, and
+ *  judy::map from judy-map.hpp over them, with std::map,
+ *  std::unordered_map and a sorted std::vector.
+ *  usage: compare-test [<keys> [<key set> ...]]
+ *
+ *  c++ -std=c++17 -O2 -o compare-test compare-test.cpp
+ *
+ *  The key sets are dense integers, random 64-bit integers, URLs,
+ *  English words and long keys sharing a prefix. All are drawn from a
+ *  fixed seed, so runs see the same keys; the words come from the
+ *  system dictionary when it is there and are made up from syllables
+ *  otherwise. For each key set and container this prints one CSV line
+ *  per operation: insert, lookups that hit and that miss, an ordered
+ *  scan, seeks to the first key at or after a missing one, and delete.
+ *  Each operation runs once timed as a whole for ns/op and once timed
+ *  call by call for the percentiles, which include the clock's cost.
+ *  Bytes per key are the judy segments, or what the std containers
+ *  asked operator new for. The sorted vector is built by one sort, so
+ *  its insert line has no percentiles, and it takes no deletes; the
+ *  unordered map has no scan or seek.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <map>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "judy-map.hpp"
+
+
+#define KEYS		200000
+#define SEED		0x6a75647961727261ULL
+#define DICTIONARY	"/usr/share/dict/words"
+#define ALIGN		16		// operator new header, keeping blocks aligned
+#define PREFIX		"/srv/archive/customers/accounts/region-eu-west-1/statements/2024/"
+
+// Count the bytes the std containers ask for.
+
+static size_t compare_live;
+
+void *operator new(size_t size) {
+	size_t *block = (size_t *)malloc(size + ALIGN);
+
+	if (!block)
+		throw std::bad_alloc();
+
+	*block = size;
+	compare_live += size;
+	return (char *)block + ALIGN;
+}
+
+// out of line, or gcc takes the free() below for one of new'ed memory
+__attribute__((noinline)) void operator delete(void *ptr) noexcept {
+	size_t *block;
+
+	if (!ptr)
+		return;
+
+	block = (size_t *)((char *)ptr - ALIGN);
+	compare_live -= *block;
+	free(block);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	operator delete(ptr);
+}
+
+uint64_t compare_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// splitmix64
+uint64_t compare_rand(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+template <class Key>
+void compare_shuffle(std::vector<Key> &keys, uint64_t *state) {
+	size_t idx;
+
+	for (idx = keys.size(); idx > 1; idx--)
+		std::swap(keys[idx - 1], keys[compare_rand(state) % idx]);
+}
+
+// What a scan or seek adds to its checksum for the key it reached.
+uint64_t compare_weight(const std::string &key) {
+	return key.size();
+}
+
+uint64_t compare_weight(std::string_view key) {
+	return key.size();
+}
+
+uint64_t compare_weight(uint64_t key) {
+	return key;
+}
+
+
+// Key sets. Each fills keys with count distinct keys in random order and
+// misses with as many keys that are not among them.
+
+const char *compare_syllables[] = {
+	"a", "an", "ar", "be", "ca", "con", "de", "di", "e", "en", "er", "ex",
+	"fi", "ga", "ho", "i", "in", "is", "ka", "la", "li", "lo", "ma", "me",
+	"mi", "mo", "na", "ne", "no", "o", "or", "pa", "per", "pro", "ra", "re",
+	"ri", "ro", "sa", "se", "si", "so", "sta", "ta", "te", "ti", "to", "tra",
+	"u", "un", "va", "ve", "vi", "wa", "zo"
+};
+
+std::string compare_word(uint64_t *state) {
+	uint count = 1 + compare_rand(state) % 4, idx;
+	std::string word;
+
+	for (idx = 0; idx < count; idx++)
+		word += compare_syllables[compare_rand(state) % (sizeof(compare_syllables) / sizeof(char *))];
+
+	return word;
+}
+
+void compare_dense(std::vector<uint64_t> &keys, std::vector<uint64_t> &misses, uint count, uint64_t *state) {
+	uint idx;
+
+	for (idx = 0; idx < count; idx++) {
+		keys.push_back(idx);
+		misses.push_back(count + idx);
+	}
+
+	compare_shuffle(keys, state);
+	compare_shuffle(misses, state);
+}
+
+void compare_random(std::vector<uint64_t> &keys, std::vector<uint64_t> &misses, uint count, uint64_t *state) {
+	std::unordered_set<uint64_t> seen;
+	uint64_t key;
+
+	while (keys.size() < count)
+		if (seen.insert(key = compare_rand(state)).second)
+			keys.push_back(key);
+
+	while (misses.size() < count)
+		if (seen.insert(key = compare_rand(state)).second)
+			misses.push_back(key);
+}
+
+// Fill keys and misses from make, which draws one candidate key.
+template <class Make>
+void compare_strings(std::vector<std::string> &keys, std::vector<std::string> &misses, uint count, uint64_t *state, Make make) {
+	std::unordered_set<std::string> seen;
+	std::string key;
+
+	while (keys.size() < count)
+		if (seen.insert(key = make(state)).second)
+			keys.push_back(key);
+
+	while (misses.size() < count)
+		if (seen.insert(key = make(state)).second)
+			misses.push_back(key);
+}
+
+void compare_urls(std::vector<std::string> &keys, std::vector<std::string> &misses, uint count, uint64_t *state) {
+	std::vector<std::string> hosts;
+	uint idx;
+
+	for (idx = 0; idx < 200; idx++)
+		hosts.push_back("https://www." + compare_word(state) + compare_word(state) + (idx % 3 ? ".com/" : ".org/"));
+
+	compare_strings(keys, misses, count, state, [&](uint64_t *state) {
+		// a few hosts hold most of the pages
+		uint64_t pick = compare_rand(state) % hosts.size();
+		std::string url = hosts[pick * pick / hosts.size()];
+		uint depth = 1 + compare_rand(state) % 3;
+
+		while (depth--)
+			url += compare_word(state) + "/";
+
+		return url + "?id=" + std::to_string(compare_rand(state) % 100000);
+	});
+}
+
+void compare_words(std::vector<std::string> &keys, std::vector<std::string> &misses, uint count, uint64_t *state) {
+	std::vector<std::string> words;
+	std::unordered_set<std::string> seen;
+	char line[1024];
+	uint len;
+	FILE *in;
+
+	if ((in = fopen(DICTIONARY, "r"))) {
+		while (fgets(line, sizeof(line), in)) {
+			len = strcspn(line, "\r\n");
+			if (len && seen.insert(std::string(line, len)).second)
+				words.push_back(std::string(line, len));
+		}
+
+		fclose(in);
+	}
+
+	// made up words when the dictionary is missing or short
+
+	if (words.size() < (size_t)count * 2) {
+		compare_strings(keys, misses, count, state, compare_word);
+		return;
+	}
+
+	compare_shuffle(words, state);
+	keys.assign(words.begin(), words.begin() + count);
+	misses.assign(words.begin() + count, words.begin() + 2 * count);
+}
+
+void compare_prefix(std::vector<std::string> &keys, std::vector<std::string> &misses, uint count, uint64_t *state) {
+	compare_strings(keys, misses, count, state, [](uint64_t *state) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "%012llu.pdf", (unsigned long long)(compare_rand(state) % 1000000000000ULL));
+		return std::string(PREFIX) + name;
+	});
+}
+
+
+// Containers, each behind the same calls. find returns the value or 0;
+// seek and scan return the value plus the weight of the key reached.
+
+struct JudyStrings {
+	static const int ordered = 1, deletes = 1;
+	Judy *judy;
+
+	JudyStrings() : judy((Judy *)judy_open(1024)) {}
+	~JudyStrings() { judy_close(judy); }
+
+	void insert(const std::string &key, uint64_t value) {
+		*judy_cell(judy, (uchar *)key.data(), key.size()) = value;
+	}
+
+	void finish() {}
+
+	uint64_t find(const std::string &key) {
+		judyslot *cell = judy_slot(judy, (uchar *)key.data(), key.size());
+
+		return cell ? *cell : 0;
+	}
+
+	uint64_t seek(const std::string &key) {
+		judyslot *cell = judy_strt(judy, (uchar *)key.data(), key.size());
+		uint len;
+
+		if (!cell)
+			return 0;
+
+		judy_keyref(judy, &len);
+		return *cell + len;
+	}
+
+	template <class Step>
+	void scan(Step step) {
+		judyslot *cell;
+		uint len;
+
+		for (cell = judy_strt(judy, NULL, 0); cell; cell = judy_nxt(judy)) {
+			judy_keyref(judy, &len);
+			step(*cell + len);
+		}
+	}
+
+	void erase(const std::string &key) {
+		if (judy_slot(judy, (uchar *)key.data(), key.size()))
+			judy_del(judy);
+	}
+
+	size_t bytes() {
+		JudyStats stats[1];
+
+		judy_stats(judy, stats);
+		return stats->segbytes;
+	}
+};
+
+struct JudyIntegers {
+	static const int ordered = 1, deletes = 1;
+	Judy *judy;
+
+	JudyIntegers() : judy((Judy *)judy_open(JUDY_key_size)) {}
+	~JudyIntegers() { judy_close(judy); }
+
+	void insert(uint64_t key, uint64_t value) {
+		*judyL_ins(judy, key) = value;
+	}
+
+	void finish() {}
+
+	uint64_t find(uint64_t key) {
+		judyslot *cell = judyL_get(judy, key);
+
+		return cell ? *cell : 0;
+	}
+
+	uint64_t seek(uint64_t key) {
+		judyvalue index = key;
+		judyslot *cell = judyL_first(judy, &index);
+
+		return cell ? *cell + index : 0;
+	}
+
+	template <class Step>
+	void scan(Step step) {
+		judyvalue index = 0;
+		judyslot *cell;
+
+		for (cell = judyL_first(judy, &index); cell; cell = judyL_next(judy, &index))
+			step(*cell + index);
+	}
+
+	void erase(uint64_t key) {
+		judyL_del(judy, key);
+	}
+
+	size_t bytes() {
+		JudyStats stats[1];
+
+		judy_stats(judy, stats);
+		return stats->segbytes;
+	}
+};
+
+// judy::map keeps its full width values in judy_data blocks, the price
+// of the cell never being zero.
+
+template <class Key>
+struct JudyWrapped {
+	static const int ordered = 1, deletes = 1;
+	judy::map<Key, uint64_t> map;
+
+	void insert(const Key &key, uint64_t value) { map[key] = value; }
+	void finish() {}
+
+	uint64_t find(const Key &key) {
+		typename judy::map<Key, uint64_t>::iterator it = map.find(key);
+
+		return it == map.end() ? 0 : it.value();
+	}
+
+	uint64_t seek(const Key &key) {
+		typename judy::map<Key, uint64_t>::iterator it = map.lower_bound(key);
+
+		return it == map.end() ? 0 : it.value() + compare_weight(it.key());
+	}
+
+	template <class Step>
+	void scan(Step step) {
+		for (typename judy::map<Key, uint64_t>::iterator it = map.begin(); it != map.end(); ++it)
+			step(it.value() + compare_weight(it.key()));
+	}
+
+	void erase(const Key &key) { map.erase(key); }
+
+	size_t bytes() {
+		JudyStats stats[1];
+
+		judy_stats(map.array(), stats);
+		return stats->segbytes;
+	}
+};
+
+template <class Key>
+struct StdMap {
+	static const int ordered = 1, deletes = 1;
+	std::map<Key, uint64_t> map;
+
+	void insert(const Key &key, uint64_t value) { map[key] = value; }
+	void finish() {}
+
+	uint64_t find(const Key &key) {
+		typename std::map<Key, uint64_t>::iterator it = map.find(key);
+
+		return it == map.end() ? 0 : it->second;
+	}
+
+	uint64_t seek(const Key &key) {
+		typename std::map<Key, uint64_t>::iterator it = map.lower_bound(key);
+
+		return it == map.end() ? 0 : it->second + compare_weight(it->first);
+	}
+
+	template <class Step>
+	void scan(Step step) {
+		for (typename std::map<Key, uint64_t>::iterator it = map.begin(); it != map.end(); ++it)
+			step(it->second + compare_weight(it->first));
+	}
+
+	void erase(const Key &key) { map.erase(key); }
+	size_t bytes() { return 0; }
+};
+
+template <class Key>
+struct StdHash {
+	static const int ordered = 0, deletes = 1;
+	std::unordered_map<Key, uint64_t> map;
+
+	void insert(const Key &key, uint64_t value) { map[key] = value; }
+	void finish() {}
+
+	uint64_t find(const Key &key) {
+		typename std::unordered_map<Key, uint64_t>::iterator it = map.find(key);
+
+		return it == map.end() ? 0 : it->second;
+	}
+
+	uint64_t seek(const Key &) { return 0; }
+
+	template <class Step>
+	void scan(Step) {}
+
+	void erase(const Key &key) { map.erase(key); }
+	size_t bytes() { return 0; }
+};
+
+template <class Key>
+struct SortedVector {
+	static const int ordered = 1, deletes = 0;
+	typedef std::pair<Key, uint64_t> Entry;
+	std::vector<Entry> vec;
+
+	static bool before(const Entry &entry, const Key &key) { return entry.first < key; }
+
+	void insert(const Key &key, uint64_t value) { vec.push_back(Entry(key, value)); }
+	void finish() { std::sort(vec.begin(), vec.end()); }
+
+	uint64_t find(const Key &key) {
+		typename std::vector<Entry>::iterator it = std::lower_bound(vec.begin(), vec.end(), key, before);
+
+		return it == vec.end() || it->first != key ? 0 : it->second;
+	}
+
+	uint64_t seek(const Key &key) {
+		typename std::vector<Entry>::iterator it = std::lower_bound(vec.begin(), vec.end(), key, before);
+
+		return it == vec.end() ? 0 : it->second + compare_weight(it->first);
+	}
+
+	template <class Step>
+	void scan(Step step) {
+		for (typename std::vector<Entry>::iterator it = vec.begin(); it != vec.end(); ++it)
+			step(it->second + compare_weight(it->first));
+	}
+
+	void erase(const Key &) {}
+	size_t bytes() { return 0; }
+};
+
+
+// Timing and reporting.
+
+uint64_t compare_sum;		// checksum so no call is optimized away
+
+void compare_report(const char *set, const char *name, const char *op, size_t count, uint64_t total, std::vector<uint32_t> &lat, double perkey) {
+	static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+	uint idx;
+
+	printf("%s,%s,%s,%zu,%.1f", set, name, op, count, count ? (double)total / count : 0.0);
+	std::sort(lat.begin(), lat.end());
+
+	for (idx = 0; idx < sizeof(quantiles) / sizeof(double); idx++)
+		if (lat.empty())
+			printf(",");
+		else
+			printf(",%u", lat[std::min(lat.size() - 1, (size_t)(quantiles[idx] * lat.size()))]);
+
+	if (lat.empty())
+		printf(",");
+	else
+		printf(",%u", lat.back());
+
+	printf(",%.1f\n", perkey);
+	fflush(stdout);
+	lat.clear();
+}
+
+// Time call over every key once as a whole and once call by call.
+template <class Key, class Call>
+void compare_op(const char *set, const char *name, const char *op, std::vector<Key> &keys, double perkey, Call call) {
+	std::vector<uint32_t> lat;
+	uint64_t start, total, last, now;
+	size_t idx;
+
+	start = compare_now();
+	for (idx = 0; idx < keys.size(); idx++)
+		compare_sum += call(keys[idx]);
+	total = compare_now() - start;
+
+	lat.reserve(keys.size());
+	last = compare_now();
+	for (idx = 0; idx < keys.size(); idx++) {
+		compare_sum += call(keys[idx]);
+		lat.push_back((now = compare_now()) - last);
+		last = now;
+	}
+
+	compare_report(set, name, op, keys.size(), total, lat, perkey);
+}
+
+template <class Map, class Key>
+void compare_run(const char *set, const char *name, std::vector<Key> &keys, std::vector<Key> &misses) {
+	std::vector<uint32_t> lat;
+	uint64_t start, total, last, now;
+	size_t idx, live, count = 0;
+	double perkey;
+	Map *map, *again;
+
+	lat.reserve(keys.size());
+
+	// insert, once timed as a whole and once call by call
+
+	live = compare_live;
+	map = new Map;
+	start = compare_now();
+	for (idx = 0; idx < keys.size(); idx++)
+		map->insert(keys[idx], idx + 1);
+	map->finish();
+	total = compare_now() - start;
+	perkey = (double)(map->bytes() + compare_live - live) / keys.size();
+
+	again = new Map;
+	if (Map::deletes) {
+		last = compare_now();
+		for (idx = 0; idx < keys.size(); idx++) {
+			again->insert(keys[idx], idx + 1);
+			lat.push_back((now = compare_now()) - last);
+			last = now;
+		}
+	}
+
+	compare_report(set, name, "insert", keys.size(), total, lat, perkey);
+
+	compare_op(set, name, "hit", keys, perkey, [&](const Key &key) { return map->find(key); });
+	compare_op(set, name, "miss", misses, perkey, [&](const Key &key) { return map->find(key); });
+
+	if (Map::ordered) {
+		start = compare_now();
+		map->scan([&](uint64_t value) { compare_sum += value; count++; });
+		total = compare_now() - start;
+
+		last = compare_now();
+		map->scan([&](uint64_t value) {
+			compare_sum += value;
+			lat.push_back((now = compare_now()) - last);
+			last = now;
+		});
+
+		if (count != keys.size())
+			fprintf(stderr, "%s %s: scan saw %zu of %zu keys\n", set, name, count, keys.size());
+
+		compare_report(set, name, "scan", count, total, lat, perkey);
+		compare_op(set, name, "seek", misses, perkey, [&](const Key &key) { return map->seek(key); });
+	}
+
+	if (Map::deletes) {
+		start = compare_now();
+		for (idx = 0; idx < keys.size(); idx++)
+			map->erase(keys[idx]);
+		total = compare_now() - start;
+
+		last = compare_now();
+		for (idx = 0; idx < keys.size(); idx++) {
+			again->erase(keys[idx]);
+			lat.push_back((now = compare_now()) - last);
+			last = now;
+		}
+
+		compare_report(set, name, "delete", keys.size(), total, lat, perkey);
+	}
+
+	delete again;
+	delete map;
+}
+
+template <class Key, class JudyMap>
+void compare_set(const char *set, std::vector<Key> &keys, std::vector<Key> &misses) {
+	fprintf(stderr, "%s: %zu keys, %zu misses\n", set, keys.size(), misses.size());
+
+	compare_run<JudyMap>(set, "judy", keys, misses);
+	compare_run<JudyWrapped<Key> >(set, "judy::map", keys, misses);
+	compare_run<StdMap<Key> >(set, "std::map", keys, misses);
+	compare_run<StdHash<Key> >(set, "std::unordered_map", keys, misses);
+	compare_run<SortedVector<Key> >(set, "sorted-vector", keys, misses);
+}
+
+int main(int argc, char **argv) {
+	static const char *sets[] = {"dense", "random", "urls", "words", "prefix"};
+	uint count = argc > 1 ? atoi(argv[1]) : KEYS;
+	uint idx, arg;
+
+	if (!count) {
+		fprintf(stderr, "usage: %s [<keys> [dense|random|urls|words|prefix ...]]\n", argv[0]);
+		return 1;
+	}
+
+	printf("keys,container,op,count,ns_per_op,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,bytes_per_key\n");
+
+	for (idx = 0; idx < sizeof(sets) / sizeof(char *); idx++) {
+		std::vector<uint64_t> ints, intmisses;
+		std::vector<std::string> strs, strmisses;
+		uint64_t state = SEED + idx;
+
+		for (arg = 2; arg < (uint)argc; arg++)
+			if (!strcmp(argv[arg], sets[idx]))
+				break;
+
+		if (argc > 2 && arg == (uint)argc)
+			continue;
+
+		switch (idx) {
+		case 0:
+			compare_dense(ints, intmisses, count, &state);
+			break;
+		case 1:
+			compare_random(ints, intmisses, count, &state);
+			break;
+		case 2:
+			compare_urls(strs, strmisses, count, &state);
+			break;
+		case 3:
+			compare_words(strs, strmisses, count, &state);
+			break;
+		case 4:
+			compare_prefix(strs, strmisses, count, &state);
+			break;
+		}
+
+		if (idx < 2)
+			compare_set<uint64_t, JudyIntegers>(sets[idx], ints, intmisses);
+		else
+			compare_set<std::string, JudyStrings>(sets[idx], strs, strmisses);
+	}
+
+	fprintf(stderr, "checksum %llu\n", (unsigned long long)compare_sum);
+	return 0;
+}
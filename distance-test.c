@@ -12,11 +12,13 @@
 #include <strings.h>
 
 #include "judy-levenshtein.c"
+#include "judy-lines.c"
 
 
 #define DICTIONARY	"/usr/share/dict/words"
 #define TARGET		"goober"
 #define MAX_COST	1
+#define MAX_LINE	16383	// longer lines are cut, as the sorter does
 
 int main(int argc, char **argv) {
 	void *judy;
@@ -56,27 +58,35 @@ int main(int argc, char **argv) {
 	}
 	
 
-	uchar buff[1024];
+	JudyAlloc alloc[1];
+	JudyLines *lines;
+	uchar *line;
 	judyslot max = 0;
 	uint len;
 	
-	// CHANGEME: Can we adapt the judy stack size to the input size if it is known?
-	judy = judy_open(512);
+	// a key can take a stack level per byte, and the cursor stack for
+	// them must fit in the first segment
+	memset(alloc, 0, sizeof(alloc));
+	alloc->segsize = 2 * (MAX_LINE + 1) * sizeof(JudyStack);
+	judy = judy_openx(MAX_LINE + 1, alloc);
+	
+	lines = judy_lines_open(in);
 	
-	while ( fgets((char *)buff, sizeof(buff), in) ) {
-		len = strlen((const char *)buff);
-		if (len > 1) {								// We only want lines containing more than just the '\n'
-			buff[len] = 0;							// Remove '\n'
-			len--;
-			if ( len && buff[len - 1] == 0x0d ) {	// Detect and remove Windows CR
-				buff[len] = 0;
-				len--;
-			}
-			*(judy_cell(judy, buff, len)) += 1;		// count instances of string
+	while ( lines && (line = judy_lines_next(lines, &len)) ) {
+		if (len > MAX_LINE)
+			len = MAX_LINE;
+
+		if (len) {									// We only want lines containing more than just the line end
+			*(judy_cell(judy, line, len)) += 1;		// count instances of string
 			max++;
 		}
 	}
 
+	if (lines) {
+		fprintf(stderr, "%.1f MB/s load\n", judy_lines_rate(lines));
+		judy_lines_close(lines);
+	}
+
 	fprintf(out, "Read %" PRIjudyvalue " words. \n", max);
 
 #if 1
@@ -92,6 +102,7 @@ int main(int argc, char **argv) {
         cell = judy_slot(judy, (uchar *)key_buffer, 1);
     }
     #else
+	uchar buff[1024];
 	judyslot *cell;
 	uint idx;
 
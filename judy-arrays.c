@@ -9,28 +9,97 @@
 //	Map a set of strings to corresponding memory cells (uints).
 //	Each cell must be set to a non-zero value by the caller.
 
-//	STANDALONE is defined to compile into a string sorter.
+//	STANDALONE is defined to compile into a string sorter:
+//		judy-arrays [-t threads] [-m megabytes] [input [output]]
+//	with -t the input is sorted by that many threads (0 for one
+//	per processor), each into its own judy array for a range of
+//	leading bytes, and pthreads are needed to link.  With -m the
+//	array is spilled to a sorted run file in TMPDIR whenever it
+//	reaches that much memory, and the runs are merged at the end;
+//	this streams the input and takes precedence over -t.  Input
+//	comes through judy-lines.c, and a key is cut at 16383 bytes.
 
 //#define STANDALONE
 
 //	functions:
 //	judy_open:	open a new judy array returning a judy object.
+//	judy_openx:	open a new judy array with segment allocator options.
 //	judy_close:	close an open judy array, freeing all memory.
 //	judy_data:	allocate data memory within judy array for external use.
 //	judy_cell:	insert a string into the judy array, return cell pointer.
+//	judy_cell_set:	insert a string and store its value for concurrent readers.
 //	judy_strt:	retrieve the cell pointer greater than or equal to given key
 //	judy_slot:	retrieve the cell pointer, or return NULL for a given key.
 //	judy_key:	retrieve the string value for the most recent judy query.
+//	judy_keyref:	the same from a buffer the cursor keeps, rewriting only
+//		the part of the key that changed since the last call.
 //	judy_end:	retrieve the cell pointer for the last string in the array.
 //	judy_nxt:	retrieve the cell pointer for the next string in the array.
 //	judy_prv:	retrieve the cell pointer for the prev string in the array.
-//	judy_del:	delete the key and cell for the current stack entry.
+//	judy_del:	delete the key and cell for the current stack entry,
+//		shrinking the nodes that it leaves under-filled.
+//	judy_bulk_load:	build an empty judy array from keys in sorted order.
+//	judy_slot_batch:	retrieve the cell pointers for many keys at once.
+//	judy_nxt_batch:	retrieve the keys and cells of many next strings at once.
+//	judy_union, judy_intersect, judy_difference:	build the union,
+//		intersection or difference of two arrays into a new one.
+//	judy_setwalk:	stream the keys of one of those to a callback.
+//	judy_copen:	open a private cursor for reading a judy array.
+//	judy_cclose:	release a cursor.
+//	judy_ccopy:	put a cursor where another one is.
+//	judy_cslot, judy_cstrt, judy_cend, judy_cnxt, judy_cprv, judy_ckey,
+//	judy_ckeyref, judy_cnxt_batch:
+//		the query calls above on a private cursor instead of the
+//		array's own, so several readers can share an array that
+//		is not being changed.
+//	judy_enter, judy_leave:	bracket reads on a cursor in JUDY_CONCURRENT mode.
+//	judy_save:	write the array to an image file.
+//	judy_map:	open an image file read-only in place as a judy array.
+//	judy_dump, judy_dump_fd:	write the array as an image to a buffer or file descriptor.
+//	judy_restore, judy_restore_fd:	rebuild a live judy array from an image.
+//	judy_stats:	report node, free list and segment memory from counters.
+//	judy_shape:	judy_stats plus keys, slot fill and depths from a walk.
+//	judy_compact:	move nodes out of sparse segments and release them.
+//	judy_compact_step:	do a bounded part of a judy_compact pass.
+//	judy_counters, judy_ccounters:	read and restart the JUDY_INSTRUMENT
+//		counters of an array or of a private cursor.
+//	judy_bcell, judy_bslot, judy_bstrt, judy_bkey:	judy_cell, judy_slot,
+//		judy_strt and judy_key for binary keys that may hold zero
+//		bytes; the other calls work unchanged on such arrays.
+//	judy_cbslot, judy_cbstrt, judy_cbkey:	the same on a private cursor.
+//	judy_rank, judy_select, judy_count_range:	position of a key, key
+//		at a position and keys in a range, with JUDY_COUNTS.
+//	judy_children:	list the distinct bytes that follow a prefix.
+//	judy_children_at, judy_child_cell:	go on from a listed child.
+//	judyL_ins, judyL_get, judyL_del:	insert, find or delete an integer index.
+//	judyL_first, judyL_last, judyL_next, judyL_prev:
+//		walk the integer indexes in numeric order.
+
+//	judy-shard.c, judy-utilities.c and judy-lines.c each include
+//	this file, so a program can include them all
+
+//	it also compiles as C++, for judy-map.hpp and compare-test.cpp
+
+#ifndef JUDY_ARRAYS_C
+#define JUDY_ARRAYS_C
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <memory.h>
 #include <limits.h>
 
-#if __STDC_VERSION__ >= 199901L
+#if !defined(_WIN32)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+#if defined(__linux__)
+	#include <sys/syscall.h>
+#endif
+
+#if __STDC_VERSION__ >= 199901L || defined(__cplusplus)
 	#include <inttypes.h>
 #else
 	typedef unsigned char         uint8_t;
@@ -99,13 +168,136 @@ typedef uint32_t uint;
 #error("Non 8-bit character size not supported")
 #endif
 
+//	vector slot search in linear nodes is chosen at compile time:
+//	SSE2 covers 1, 2 and 4 byte keys, SSSE3 adds 3 byte keys and
+//	SSE4.2 adds 5 through 8 byte keys.  8 byte keys go to AVX2
+//	instead on x86 CPUs that have it, found at run time, so the
+//	default x86-64 build covers them too.  NEON covers 1, 2, 4 and
+//	8 byte keys.  Everything else uses a branch-free binary search.
+
+#if defined(__GNUC__) && BYTE_ORDER != BIG_ENDIAN
+	#if defined(__SSE2__)
+		#define JUDY_sse
+		#include <emmintrin.h>
+		#if defined(__SSSE3__)
+			#include <tmmintrin.h>
+		#endif
+		#if defined(__SSE4_2__)
+			#include <nmmintrin.h>
+		#endif
+		#include <immintrin.h>
+	#elif defined(__ARM_NEON) && defined(__aarch64__)
+		#define JUDY_neon
+		#include <arm_neon.h>
+	#endif
+#endif
+
 #define JUDY_mask (~(judyslot)0x07)
 
+//	JUDY_CONCURRENT is defined for one writer thread changing the
+//	array while other threads read it through their own cursors
+//	without taking locks.  The writer builds each replacement node
+//	off to the side and publishes it with one release store, and
+//	readers follow links with acquire loads.  Replaced nodes wait
+//	in a limbo list until every reader that might still be looking
+//	at them has called judy_leave.  Values in the cells go the same
+//	way: judy_cell publishes a new key with a zero cell, so the
+//	writer stores the value with judy_cell_set or judy_store, and
+//	readers read cells with judy_load, never plainly, before
+//	following a value that points at other data.
+
+#ifdef JUDY_CONCURRENT
+	#define judy_load(link)			__atomic_load_n (link, __ATOMIC_ACQUIRE)
+	#define judy_store(link, value)	__atomic_store_n (link, value, __ATOMIC_RELEASE)
+	#define JUDY_limbo	64		// replaced nodes between reclaim scans
+#else
+	#define judy_load(link)			(*(link))
+	#define judy_store(link, value)	(*(link) = (value))
+	#define judy_enter(cursor)
+	#define judy_leave(cursor)
+	#define judy_reclaim(judy)
+	#define judy_commit(judy, cell)	(cell)
+#endif
+
+//	JUDY_COUNTS is defined to keep the number of keys below
+//	every node in a word just in front of it, for judy_rank,
+//	judy_select and judy_count_range.  judy_cell and judy_del
+//	adjust the words on the key's path.  Nodes built by other
+//	changes start at JUDY_nocount and are summed from their
+//	children the first time a query needs them.  judy_cell
+//	counts each key whose cell it finds zero, so give new cells
+//	a value.  The judyL calls do not keep the counts.
+
+#ifdef JUDY_COUNTS
+	#define JUDY_head		sizeof(judyslot)
+	#define JUDY_nocount	(~(judyslot)0)
+	#define judy_below(addr)	(((judyslot *)(addr))[-1])
+	#define JUDY_magic		"judyimgc"
+#else
+	#define JUDY_head		0
+	#define JUDY_magic		"judyimg1"
+#endif
+
+//	JUDY_INSTRUMENT is defined to count, for each array, the
+//	nodes the walks of judy_cell and judy_slot visit by type and
+//	how deep they go, linear nodes promoted by the type they grew
+//	from, full nodes split into radix nodes, span nodes split,
+//	node blocks taken from the free lists against those carved
+//	from segments, and segments allocated.  judy_counters reads
+//	them.  A private cursor counts its own walks, which
+//	judy_ccounters reads.  JUDY_CYCLES adds the time spent in
+//	promotions, splits and segment allocation: time stamp
+//	counter cycles on x86, nanoseconds elsewhere.  Without the
+//	flags nothing is counted and the calls are unchanged.
+
+#if defined(JUDY_CYCLES) && !defined(JUDY_INSTRUMENT)
+	#define JUDY_INSTRUMENT
+#endif
+
+#define JUDY_depths	32
+
+#ifdef JUDY_INSTRUMENT
+	#define judy_count(judy, field)	((judy)->counters->field++)
+	#define judy_visit(cursor, next)	((cursor)->counters->visits[(next) & 0x07]++, \
+		(cursor)->counters->depth[(cursor)->level < JUDY_depths ? (cursor)->level : JUDY_depths - 1]++)
+#else
+	#define judy_count(judy, field)
+	#define judy_visit(cursor, next)
+#endif
+
+#ifdef JUDY_CYCLES
+#if defined(_MSC_VER)
+	#include <intrin.h>
+	#define judy_clock()	__rdtsc ()
+#elif defined(__x86_64__) || defined(__i386__)
+	#include <x86intrin.h>
+	#define judy_clock()	__rdtsc ()
+#else
+	#include <time.h>
+
+	uint64_t judy_clock (void)
+	{
+	struct timespec ts[1];
+
+		clock_gettime (CLOCK_MONOTONIC, ts);
+		return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+	}
+#endif
+	#define judy_timer(start)	uint64_t start = judy_clock ()
+	#define judy_timed(judy, field, start)	((judy)->counters->field += judy_clock () - (start))
+#else
+	#define judy_timer(start)
+	#define judy_timed(judy, field, start)
+#endif
+
 #ifdef STANDALONE
 #include <stdio.h>
 #include <assert.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
-uint MaxMem = 0;
+judyslot MaxMem = 0;
 
 #if !defined(_WIN32)
 void judy_abort (char *msg) __attribute__ ((noreturn)); // Tell static analyser that this function will not return
@@ -138,6 +330,25 @@ void vfree (void *what, uint size)
 #endif
 
 #define JUDY_seg	65536
+#define JUDY_hugesize	(2 * 1024 * 1024)
+
+//	segment allocator options for judy_openx.  Segments are
+//	valloc'ed unless a flag or the alloc callback says otherwise;
+//	flagged segments are mmap'ed and munmap'ed.  On platforms
+//	without them the flags are ignored.
+
+#define JUDY_hugetlb	0x01	// MAP_HUGETLB, plain pages when none are reserved
+#define JUDY_hugepage	0x02	// madvise MADV_HUGEPAGE on huge page aligned segments
+#define JUDY_numa		0x04	// bind segments to NUMA node numa with mbind
+
+typedef struct {
+	uint segsize;		// segment size, zero for JUDY_seg
+	uint flags;			// JUDY_hugetlb, JUDY_hugepage, JUDY_numa
+	uint numa;			// NUMA node for JUDY_numa
+	void *(*alloc) (void *ctx, judyslot size);	// user segment allocator, or NULL
+	void (*free) (void *ctx, void *seg, judyslot size);
+	void *ctx;			// passed to alloc and free
+} JudyAlloc;
 
 enum JUDY_types {
 	JUDY_radix		= 0,	// inner and outer radix fan-out
@@ -171,6 +382,8 @@ judyvalue JudyMask[9] = {
 typedef struct {
 	void *seg;			// next used allocator
 	uint next;			// next available offset
+	uint pinned;		// holds the judy object or judy_data blocks
+	judyslot size;		// bytes in segment
 } JudySeg;
 
 typedef struct {
@@ -179,60 +392,440 @@ typedef struct {
 	int slot;			// slot within object
 } JudyStack;
 
+#ifdef JUDY_INSTRUMENT
+typedef struct {
+	judyslot visits[8];		// nodes walked through, by type
+	judyslot depth[JUDY_depths];	// nodes walked through at each depth, deeper in the last
+	judyslot promotes[8];	// linear nodes promoted, by the type they grew from
+	judyslot splits;		// full nodes split into radix nodes
+	judyslot spansplits;	// span nodes split into JUDY_1 chains
+	judyslot reuses;		// node blocks taken from the free lists
+	judyslot carves;		// node blocks carved from segments
+	judyslot segments;		// segments allocated
+	uint64_t promotecycles;	// JUDY_CYCLES: time in promotions
+	uint64_t splitcycles;	// in node splits
+	uint64_t spancycles;	// in span splits
+	uint64_t segmentcycles;	// in segment allocation
+} JudyCounters;
+#endif
+
+//	a cursor holds the path of one reader's most recent
+//	query, so threads can share an unchanging array by
+//	each searching and iterating with a cursor of its own.
+
+typedef struct JudyCursor {
+	judyslot *root;		// root of judy array
+	judyslot base;		// address links are offsets from, or zero
+#ifdef JUDY_CONCURRENT
+	uint64_t *clock;	// epoch clock of judy array
+	uint64_t epoch;		// epoch entered, or zero
+	struct JudyCursor *link;	// next registered reader
+	uint closed;		// released, for the writer to free
+#endif
+	uchar *bkey;		// binary key in escaped form
+	uint bkeymax;		// allocated bytes for it
+	uchar *key;			// judy_ckeyref key buffer
+	uint keymax;		// allocated bytes for it
+	uint keylevel;		// levels of keypath still written in it
+	JudyStack *keypath;	// the path it was written from
+#ifdef JUDY_CONCURRENT
+	uint64_t keyclock;	// epoch clock when it was written
+#endif
+	uchar *batch;		// judy_cnxt_batch keys
+	uint batchmax;		// allocated bytes for them
+#ifdef JUDY_INSTRUMENT
+	JudyCounters *counters;	// the array's, or the private cursor's own
+#endif
+	uint level;			// current height of stack
+	uint max;			// max height of stack
+	JudyStack stack[1];	// current path
+} JudyCursor;
+
+#ifdef JUDY_CONCURRENT
+typedef struct {
+	void *block;		// replaced judy block
+	uint64_t epoch;		// epoch clock when replaced
+	int type;			// node type of block, or JUDY_segment
+} JudyLimbo;
+
+#define JUDY_segment	8	// limbo entry for a segment emptied by judy_compact
+#endif
+
 typedef struct {
 	judyslot root[1];	// root of judy array
 	void **reuse[8];	// reuse judy blocks
 	JudySeg *seg;		// current judy allocator
-	uint level;			// current height of stack
-	uint max;			// max height of stack
-	JudyStack stack[1];	// current cursor
+	judyslot nodes[8];	// live judy blocks of each type
+	judyslot reused[8];	// blocks of each type on the reuse lists
+	judyslot databytes;	// bytes handed out by judy_data
+	JudyAlloc alloc[1];	// segment allocator options
+	JudySeg **victims;	// segments judy_compact is emptying, by address
+	uint victimcnt;		// number of victims
+	uint compacting;	// judy_compact walk under way
+	uchar *from;		// key the judy_compact walk resumes at
+	uint fromlen;		// length of that key
+	uint frommax;		// allocated bytes for it
+#ifdef JUDY_CONCURRENT
+	uint64_t clock;		// epoch clock
+	JudyCursor *readers;	// registered reader cursors
+	JudyLimbo *limbo;	// replaced blocks awaiting readers
+	uint limbocnt;		// number of limbo entries
+	uint limbomax;		// allocated limbo entries
+	uint limbomark;		// limbo count for next reclaim scan
+	judyslot *publish;	// link to receive the node being built
+	judyslot shadow;	// that node until it is complete
+#endif
+#ifdef JUDY_COUNTS
+	uint counted;		// counts have been summed: keep them up
+#endif
+#ifdef JUDY_INSTRUMENT
+	JudyCounters counters[1];	// JUDY_INSTRUMENT counters
+#endif
+	JudyCursor *cursor;	// built-in cursor, follows the judy object
 } Judy;
 
 #define JUDY_max	JUDY_32
 
-//	open judy object
+//	judy_save writes an image file that judy_map opens in place.
+//	Nodes are laid out depth first, children before parents, and
+//	each link holds the offset of its node in the image with the
+//	node type in the low bits.  Cursors on a mapped image add the
+//	image address in their base field to every link they follow.
 
-void *judy_open (uint max)
+typedef struct {
+	uchar magic[8];		// JUDY_magic
+	uint keysize;		// JUDY_key_size of the writer
+	uint order;			// 0x01020304 in the writer's byte order
+	judyslot size;		// bytes in image, header included
+	judyslot root;		// link to the root node
+} JudyImage;
+
+//	node address for a link, and for an outer radix
+//	entry that may be empty
+
+#define judy_addr(cursor, link)	((cursor)->base + ((link) & JUDY_mask))
+
+judyslot judy_table (JudyCursor *cursor, judyslot link)
+{
+	if( link &= JUDY_mask )
+		return cursor->base + link;
+
+	return 0;
+}
+
+//	map a segment of size bytes for the flags in alloc
+
+#if !defined(_WIN32)
+void *judy_mapseg (JudyAlloc *alloc, judyslot size)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+unsigned long mask[4];
+#endif
+uchar *seg = (uchar *)MAP_FAILED, *start;
+judyslot pad = 0;
+
+#if defined(MAP_HUGETLB)
+	if( alloc->flags & JUDY_hugetlb && !(size % JUDY_hugesize) )
+		seg = (uchar *)mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+	if( seg == MAP_FAILED ) {
+		//	over-allocate so the segment can start on a huge page
+
+		if( alloc->flags & JUDY_hugepage && size >= JUDY_hugesize )
+			pad = JUDY_hugesize;
+
+		if( (seg = (uchar *)mmap (NULL, size + pad, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED )
+			return NULL;
+
+		if( pad ) {
+			start = (uchar *)(((judyslot)seg + pad - 1) & ~(judyslot)(JUDY_hugesize - 1));
+			if( start > seg )
+				munmap (seg, start - seg);
+			munmap (start + size, seg + pad - start);
+			seg = start;
+		}
+
+#if defined(MADV_HUGEPAGE)
+		if( alloc->flags & JUDY_hugepage )
+			madvise (seg, size, MADV_HUGEPAGE);
+#endif
+	}
+
+#if defined(__linux__) && defined(SYS_mbind)
+	//	MPOL_BIND is a hint here: memory off the node still works
+
+	if( alloc->flags & JUDY_numa && alloc->numa < 8 * sizeof(mask) ) {
+		memset (mask, 0, sizeof(mask));
+		mask[alloc->numa / (8 * sizeof(long))] |= 1UL << alloc->numa % (8 * sizeof(long));
+		syscall (SYS_mbind, seg, size, 2, mask, 8 * sizeof(mask) + 1, 0);
+	}
+#endif
+	return seg;
+}
+#endif
+
+//	allocate a segment of size bytes the way alloc says
+
+JudySeg *judy_segalloc (JudyAlloc *alloc, judyslot size)
 {
 JudySeg *seg;
-Judy *judy;
-uint amt;
 
-	if( (seg = valloc(JUDY_seg)) ) {
-		seg->next = JUDY_seg;
-	} else {
+	if( alloc->alloc )
+		seg = (JudySeg *)alloc->alloc (alloc->ctx, size);
+#if !defined(_WIN32)
+	else if( alloc->flags )
+		seg = (JudySeg *)judy_mapseg (alloc, size);
+#endif
+	else
+		seg = (JudySeg *)valloc (size);
+
+	if( !seg )
+		return NULL;
+
 #ifdef STANDALONE
-		judy_abort ("No virtual memory");
+#if !defined(_WIN32)
+	__atomic_add_fetch (&MaxMem, size, __ATOMIC_RELAXED);
 #else
-		return NULL;
+	MaxMem += size;
 #endif
-	}
+#endif
+	seg->next = size;
+	seg->size = size;
+	seg->pinned = 0;
+	seg->seg = NULL;
+	return seg;
+}
 
+//	release a segment the way alloc allocated it
 
-	amt = sizeof(Judy) + max * sizeof(JudyStack);
-#ifdef STANDALONE
-	MaxMem += JUDY_seg;
+void judy_segfree (JudyAlloc *alloc, JudySeg *seg)
+{
+	if( alloc->alloc ) {
+		if( alloc->free )
+			alloc->free (alloc->ctx, seg, seg->size);
+	}
+#if !defined(_WIN32)
+	else if( alloc->flags )
+		munmap (seg, seg->size);
 #endif
+	else
+		vfree (seg, seg->size);
+}
+
+//	open judy object with segment allocator options, or the
+//	defaults when alloc is NULL.  The options are copied.
+
+void *judy_openx (uint max, JudyAlloc *alloc)
+{
+JudyAlloc opts[1];
+JudySeg *seg;
+Judy *judy;
+uint amt;
+
+	memset (opts, 0, sizeof(opts));
+
+	if( alloc )
+		*opts = *alloc;
+
+	if( !opts->segsize )
+		opts->segsize = JUDY_seg;
+
+	if( opts->segsize & 0x07 )
+		opts->segsize |= 0x07, opts->segsize++;
+
+	amt = sizeof(Judy) + sizeof(JudyCursor) + max * sizeof(JudyStack);
 
 	if( amt & 0x07 )
 		amt |= 0x07, amt++;
 
+	if( opts->segsize < amt + sizeof(JudySeg) )
+		return NULL;
+
+	if( !(seg = judy_segalloc (opts, opts->segsize)) ) {
+#ifdef STANDALONE
+		judy_abort ("No virtual memory");
+#else
+		return NULL;
+#endif
+	}
+
 	seg->next -= amt;
+	seg->pinned = 1;
 	judy = (Judy *)((uchar *)seg + seg->next);
 	memset(judy, 0, amt);
  	judy->seg = seg;
-	judy->max = max;
+	*judy->alloc = *opts;
+	judy->cursor = (JudyCursor *)(judy + 1);
+	judy->cursor->root = judy->root;
+	judy->cursor->max = max;
+#ifdef JUDY_INSTRUMENT
+	judy->cursor->counters = judy->counters;
+#endif
+#ifdef JUDY_CONCURRENT
+	judy->clock = 1;
+	judy->cursor->clock = &judy->clock;
+#endif
 	return judy;
 }
 
+//	open judy object
+
+void *judy_open (uint max)
+{
+	return judy_openx (max, NULL);
+}
+
+//	free a private cursor and its key buffers
+
+void judy_cfree (JudyCursor *cursor)
+{
+	free (cursor->bkey);
+	free (cursor->key);
+	free (cursor->keypath);
+	free (cursor->batch);
+#ifdef JUDY_INSTRUMENT
+	free (cursor->counters);
+#endif
+	free (cursor);
+}
+
 void judy_close (Judy *judy)
 {
 JudySeg *seg, *nxt = judy->seg;
+JudyAlloc alloc[1];
+#ifdef JUDY_CONCURRENT
+JudyCursor *cursor;
+uint idx;
+#endif
+
+#if !defined(_WIN32)
+	//	mapped image from judy_map
+
+	if( judy->cursor->base )
+		munmap ((void *)judy->cursor->base, ((JudyImage *)judy->cursor->base)->size);
+#endif
+#ifdef JUDY_CONCURRENT
+
+	//	registered cursors go with the array
+
+	while( (cursor = judy->readers) )
+		judy->readers = cursor->link, judy_cfree (cursor);
+
+	//	segments emptied by judy_compact are no longer linked
+
+	for( idx = 0; idx < judy->limbocnt; idx++ )
+		if( judy->limbo[idx].type == JUDY_segment )
+			judy_segfree (judy->alloc, (JudySeg *)judy->limbo[idx].block);
+
+	free (judy->limbo);
+#endif
+	free (judy->victims);
+	free (judy->from);
+	free (judy->cursor->bkey);
+	free (judy->cursor->key);
+	free (judy->cursor->keypath);
+	free (judy->cursor->batch);
+
+	//	the judy object lives in one of the segments
+
+	*alloc = *judy->alloc;
 
 	while( (seg = nxt) )
-		nxt = seg->seg, vfree (seg, JUDY_seg);
+		nxt = (JudySeg *)seg->seg, judy_segfree (alloc, seg);
+}
+
+//	open a cursor on a judy array, with room for
+//	max levels of path like judy_open
+
+JudyCursor *judy_copen (Judy *judy, uint max)
+{
+JudyCursor *cursor;
+
+	if( !(cursor = (JudyCursor *)malloc (sizeof(JudyCursor) + max * sizeof(JudyStack))) )
+		return NULL;
+
+	cursor->root = judy->root;
+	cursor->base = judy->cursor->base;
+	cursor->bkey = NULL;
+	cursor->bkeymax = 0;
+	cursor->key = NULL;
+	cursor->keymax = 0;
+	cursor->keylevel = 0;
+	cursor->keypath = NULL;
+	cursor->batch = NULL;
+	cursor->batchmax = 0;
+	cursor->level = 0;
+	cursor->max = max;
+#ifdef JUDY_INSTRUMENT
+	if( !(cursor->counters = (JudyCounters *)calloc (1, sizeof(JudyCounters))) ) {
+		free (cursor);
+		return NULL;
+	}
+#endif
+#ifdef JUDY_CONCURRENT
+	cursor->clock = &judy->clock;
+	cursor->epoch = 0;
+	cursor->keyclock = 0;
+	cursor->closed = 0;
+
+	//	register with the writer's reclaim scan
+
+	cursor->link = __atomic_load_n (&judy->readers, __ATOMIC_RELAXED);
+
+	while( !__atomic_compare_exchange_n (&judy->readers, &cursor->link, cursor, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+#endif
+	return cursor;
+}
+
+//	judy_ccopy: put cursor on the path of from, the array's own
+//	cursor or another private one, so walks go on from there
+
+void judy_ccopy (JudyCursor *cursor, JudyCursor *from)
+{
+uint level = from->level;
+
+	if( level > cursor->max )
+		level = cursor->max;
+
+	memcpy (cursor->stack, from->stack, (level + 1) * sizeof(JudyStack));
+	cursor->level = level;
+	cursor->keylevel = 0;
 }
 
+//	in JUDY_CONCURRENT mode the writer unlinks
+//	and frees the cursor on its next reclaim scan
+
+void judy_cclose (JudyCursor *cursor)
+{
+#ifdef JUDY_CONCURRENT
+	__atomic_store_n (&cursor->epoch, 0, __ATOMIC_RELEASE);
+	__atomic_store_n (&cursor->closed, 1, __ATOMIC_RELEASE);
+#else
+	judy_cfree (cursor);
+#endif
+}
+
+#ifdef JUDY_CONCURRENT
+//	judy_enter: start a read section on a cursor.  Nodes seen
+//	inside it stay valid until judy_leave, and the cursor
+//	path is reset since its nodes may have been replaced.
+
+void judy_enter (JudyCursor *cursor)
+{
+	__atomic_store_n (&cursor->epoch, __atomic_load_n (cursor->clock, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	cursor->level = 0;
+}
+
+//	judy_leave: end a read section
+
+void judy_leave (JudyCursor *cursor)
+{
+	__atomic_store_n (&cursor->epoch, 0, __ATOMIC_RELEASE);
+}
+#endif
+
 //	allocate judy node
 
 void *judy_alloc (Judy *judy, int type)
@@ -246,15 +839,27 @@ uint amt;
 	if( amt & 0x07 )
 		amt |= 0x07, amt += 1;
 
+	amt += JUDY_head;
+	judy->nodes[type]++;
+
 	if( (block = judy->reuse[type]) ) {
-		judy->reuse[type] = *block;
-		memset (block, 0, amt);
+		judy->reuse[type] = (void **)*block;
+		judy->reused[type]--;
+		memset ((uchar *)block - JUDY_head, 0, amt);
+#ifdef JUDY_COUNTS
+		judy_below (block) = JUDY_nocount;
+#endif
+		judy_count (judy, reuses);
 		return (void *)block;
 	}
 
 	if( !judy->seg || judy->seg->next < amt + sizeof(*seg) ) {
-		if( (seg = valloc (JUDY_seg)) ) {
-			seg->next = JUDY_seg, seg->seg = judy->seg, judy->seg = seg;
+		judy_timer (began);
+
+		if( (seg = judy_segalloc (judy->alloc, judy->alloc->segsize)) ) {
+			seg->seg = judy->seg, judy->seg = seg;
+			judy_count (judy, segments);
+			judy_timed (judy, segmentcycles, began);
 		} else {
 #ifdef STANDALONE
 			judy_abort("Out of virtual memory");
@@ -262,16 +867,17 @@ uint amt;
 			return NULL;
 #endif
 		}
-
-#ifdef STANDALONE
-		MaxMem += JUDY_seg;
-#endif
 	}
 
 	judy->seg->next -= amt;
+	judy_count (judy, carves);
 
 	block = (void **)((uchar *)judy->seg + judy->seg->next);
 	memset (block, 0, amt);
+	block = (void **)((uchar *)block + JUDY_head);
+#ifdef JUDY_COUNTS
+	judy_below (block) = JUDY_nocount;
+#endif
 	return (void *)block;
 }
 
@@ -284,8 +890,9 @@ void *block;
 		amt |= 0x07, amt += 1;
 
 	if( !judy->seg || judy->seg->next < amt + sizeof(*seg) ) {
-		if( (seg = valloc (JUDY_seg)) ) {
-			seg->next = JUDY_seg, seg->seg = judy->seg, judy->seg = seg;
+		if( (seg = judy_segalloc (judy->alloc, judy->alloc->segsize)) ) {
+			seg->seg = judy->seg, judy->seg = seg;
+			judy_count (judy, segments);
 		} else {
 #ifdef STANDALONE
 			judy_abort("Out of virtual memory");
@@ -293,99 +900,614 @@ void *block;
 			return NULL;
 #endif
 		}
-	
-#ifdef STANDALONE
-		MaxMem += JUDY_seg;
-#endif
 	}
 
 	judy->seg->next -= amt;
+	judy->seg->pinned = 1;
+	judy->databytes += amt;
 
 	block = (void *)((uchar *)judy->seg + judy->seg->next);
 	memset (block, 0, amt);
 	return block;
 }
 
-void judy_free (Judy *judy, void *block, int type)
+//	find the judy_compact victim segment holding addr,
+//	returning its index or -1
+
+int judy_victim (Judy *judy, void *addr)
 {
-	*((void **)(block)) = judy->reuse[type];
-	judy->reuse[type] = (void **)block;
-	return;
+int low = 0, high = judy->victimcnt - 1, mid;
+JudySeg *seg;
+
+	while( low <= high ) {
+		mid = (low + high) / 2;
+		seg = judy->victims[mid];
+
+		if( (uchar *)addr < (uchar *)seg )
+			high = mid - 1;
+		else if( (uchar *)addr >= (uchar *)seg + seg->size )
+			low = mid + 1;
+		else
+			return mid;
+	}
+
+	return -1;
 }
-		
-//	assemble key from current path
 
-uint judy_key (Judy *judy, uchar *buff, uint max)
+#ifdef JUDY_CONCURRENT
+//	park a block or segment in limbo until the readers
+//	that might still be in it leave
+
+void judy_park (Judy *judy, void *block, int type)
 {
-int slot, cnt, /*size, */off, type;
-uint len = 0, idx = 0;
-uchar *base;
-int keysize;
+JudyLimbo *limbo;
+uint max;
 
-	max--;		// leave room for zero terminator
+	if( judy->limbocnt == judy->limbomax ) {
+		max = judy->limbomax ? judy->limbomax * 2 : JUDY_limbo;
 
-	while( len < max && ++idx <= judy->level ) {
-		slot = judy->stack[idx].slot;
-		type = judy->stack[idx].next & 0x07;
-		//size = JudySize[type];
-		switch( type ) {
-		case JUDY_1:
-		case JUDY_2:
-		case JUDY_4:
-		case JUDY_8:
-		case JUDY_16:
-		case JUDY_32:
-			keysize = JUDY_key_size - (judy->stack[idx].off & JUDY_key_mask);
-			base = (uchar *)(judy->stack[idx].next & JUDY_mask);
-			//cnt = size / (sizeof(judyslot) + keysize);
-			off = keysize;
-#if BYTE_ORDER != BIG_ENDIAN
-			while( off-- && len < max )
-				buff[len++] = base[slot * keysize + off];
-#else
-			for( off = 0; off < keysize && len < max; off++ )
-				buff[len++] = base[slot * keysize + off];
-#endif
-			continue;
-		case JUDY_radix:
-			if( !slot )
-				break;
-			buff[len++] = slot;
-			continue;
-		case JUDY_span:
-			base = (uchar *)(judy->stack[idx].next & JUDY_mask);
-			cnt = JUDY_span_bytes;
+		if( !(limbo = (JudyLimbo *)realloc (judy->limbo, max * sizeof(JudyLimbo))) )
+			return;		// leak the block rather than reuse it early
 
-			for( slot = 0; slot < cnt && base[slot]; slot++ )
-			  if( len < max )
-				buff[len++] = base[slot];
-			continue;
-		}
+		judy->limbo = limbo;
+		judy->limbomax = max;
 	}
-	buff[len] = '\0';
-	return len;
-}
 
-//	find slot & setup cursor
+	judy->limbo[judy->limbocnt].block = block;
+	judy->limbo[judy->limbocnt].epoch = judy->clock;
+	judy->limbo[judy->limbocnt++].type = type;
+}
+#endif
 
-judyslot *judy_slot (Judy *judy, uchar *buff, uint max)
+void judy_free (Judy *judy, void *block, int type)
+{
+	judy->nodes[type]--;
+
+#ifdef JUDY_CONCURRENT
+	//	readers may still be in the block:
+	//	park it in limbo until they leave
+
+	judy_park (judy, block, type);
+	return;
+#endif
+	//	blocks in segments being emptied are not reused
+
+	if( judy->victimcnt && judy_victim (judy, block) >= 0 )
+		return;
+
+	*((void **)(block)) = judy->reuse[type];
+	judy->reuse[type] = (void **)block;
+	judy->reused[type]++;
+	return;
+}
+
+#ifdef JUDY_CONCURRENT
+//	judy_reclaim: at the start of each writer call, move limbo
+//	blocks to the reuse lists once no reader is inside an epoch
+//	at or before the one they were replaced in.  Closed cursors
+//	are unlinked and freed along the way.
+
+void judy_reclaim (Judy *judy)
+{
+JudyCursor *cursor, **prev;
+uint64_t oldest, epoch;
+uint idx, vic;
+void *block;
+int type;
+
+	if( !judy->limbocnt || judy->limbocnt < judy->limbomark )
+		return;
+
+	oldest = __atomic_add_fetch (&judy->clock, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	prev = &judy->readers;
+
+	while( (cursor = __atomic_load_n (prev, __ATOMIC_ACQUIRE)) ) {
+		if( __atomic_load_n (&cursor->closed, __ATOMIC_ACQUIRE) ) {
+			//	new readers are pushed on the head
+			if( prev == &judy->readers ) {
+				if( !__atomic_compare_exchange_n (prev, &cursor, cursor->link, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) )
+					continue;
+			} else
+				*prev = cursor->link;
+
+			judy_cfree (cursor);
+			continue;
+		}
+
+		if( (epoch = __atomic_load_n (&cursor->epoch, __ATOMIC_SEQ_CST)) && epoch < oldest )
+			oldest = epoch;
+
+		prev = &cursor->link;
+	}
+
+	for( idx = 0; idx < judy->limbocnt && judy->limbo[idx].epoch < oldest; idx++ ) {
+		block = judy->limbo[idx].block;
+		type = judy->limbo[idx].type;
+
+		//	release an emptied segment, and drop its blocks
+
+		if( type == JUDY_segment ) {
+			for( vic = 0; judy->victims[vic] != block; vic++ );
+			memmove (judy->victims + vic, judy->victims + vic + 1, (--judy->victimcnt - vic) * sizeof(JudySeg *));
+			judy_segfree (judy->alloc, (JudySeg *)block);
+			continue;
+		}
+
+		if( judy->victimcnt && judy_victim (judy, block) >= 0 )
+			continue;
+
+		*((void **)block) = judy->reuse[type];
+		judy->reuse[type] = (void **)block;
+		judy->reused[type]++;
+	}
+
+	judy->limbocnt -= idx;
+	memmove (judy->limbo, judy->limbo + idx, judy->limbocnt * sizeof(JudyLimbo));
+	judy->limbomark = judy->limbocnt + JUDY_limbo;
+}
+
+//	judy_shadow: redirect the writes meant for a link
+//	that readers can see into the judy object, so the
+//	new node can be finished before judy_commit
+//	publishes it
+
+judyslot *judy_shadow (Judy *judy, judyslot *next)
+{
+	judy->publish = next;
+	judy->shadow = *next;
+	return &judy->shadow;
+}
+
+judyslot *judy_commit (Judy *judy, judyslot *cell)
+{
+	if( !judy->publish )
+		return cell;
+
+	judy_store (judy->publish, judy->shadow);
+
+	if( cell == &judy->shadow )
+		cell = judy->publish;
+
+	judy->publish = NULL;
+	return cell;
+}
+#endif
+
+//	judy_parent: find the link to the node at a cursor level
+
+judyslot *judy_parent (JudyCursor *cursor, uint level)
+{
+JudyStack *up = cursor->stack + level - 1;
+judyslot *table;
+
+	if( level < 2 )
+		return cursor->root;
+
+	switch( up->next & 0x07 ) {
+	case JUDY_radix:
+		table = (judyslot *)(up->next & JUDY_mask);
+		table = (judyslot *)(table[up->slot >> 4] & JUDY_mask);
+		return &table[up->slot & 0x0F];
+	case JUDY_span:
+		return (judyslot *)((up->next & JUDY_mask) + JudySize[JUDY_span]) - 1;
+	default:
+		return (judyslot *)((up->next & JUDY_mask) + JudySize[up->next & 0x07]) - up->slot - 1;
+	}
+}
+		
+//	retrieve key from linear node slot
+
+judyvalue judy_keyat (uchar *base, int slot, int keysize)
+{
+judyvalue test = *(judyvalue *)(base + slot * keysize);
+
+#if BYTE_ORDER == BIG_ENDIAN
+	return test >> 8 * (JUDY_key_size - keysize);
+#else
+	return test & JudyMask[keysize];
+#endif
+}
+
+//	store key into linear node slot
+
+void judy_setkey (uchar *base, int slot, int keysize, judyvalue value)
+{
+#if BYTE_ORDER != BIG_ENDIAN
+	memcpy(base + slot * keysize, &value, keysize);
+#else
+int i = keysize;
+
+	while( i-- )
+		base[slot * keysize + i] = value, value >>= 8;
+#endif
+}
+
+#ifdef JUDY_sse
+//	compare sign-biased key lanes of the given width
+
+__m128i judy_sse_gt (__m128i keys, __m128i probe, int width)
+{
+	switch( width ) {
+	case 1:
+		return _mm_cmpgt_epi8 (keys, probe);
+	case 2:
+		return _mm_cmpgt_epi16 (keys, probe);
+	case 4:
+		return _mm_cmpgt_epi32 (keys, probe);
+	}
+#ifdef __SSE4_2__
+	return _mm_cmpgt_epi64 (keys, probe);
+#else
+	return keys;	// never reached, see judy_search
+#endif
+}
+
+//	judy_avx2_above: count the 8 byte keys greater than value,
+//	32 bytes a step from *off, leaving *off where it stopped.
+//	Only called when the CPU has AVX2.  A JUDY_32 node of them
+//	is 256 bytes of keys, 8 steps here against 16 for SSE4.2;
+//	without a 64 bit compare, SSE2 needs so many instructions
+//	to build one that the binary search beats it.
+
+__attribute__((target("avx2")))
+int judy_avx2_above (uchar *base, int bytes, judyvalue value, int *off)
+{
+__m256i bias = _mm256_set1_epi64x ((long long)((uint64_t)1 << 63));
+__m256i probe = _mm256_xor_si256 (_mm256_set1_epi64x ((long long)value), bias);
+__m256i keys, sum = _mm256_setzero_si256 ();
+__m128i half;
+
+	//	each greater key subtracts -1 from its lane
+
+	for( ; *off + 32 <= bytes; *off += 32 ) {
+		keys = _mm256_xor_si256 (_mm256_loadu_si256 ((__m256i *)(base + *off)), bias);
+		sum = _mm256_sub_epi64 (sum, _mm256_cmpgt_epi64 (keys, probe));
+	}
+
+	half = _mm_add_epi64 (_mm256_castsi256_si128 (sum), _mm256_extracti128_si256 (sum, 1));
+	return _mm_cvtsi128_si32 (half) + _mm_cvtsi128_si32 (_mm_srli_si128 (half, 8));
+}
+#endif
+
+//	find the highest slot in a linear node whose key is <= value,
+//	or -1 if there is none.  Keys ascend from the unused zero slots
+//	at the front, so this is the count of keys <= value less one.
+
+int judy_search (uchar *base, int cnt, int keysize, judyvalue value)
+{
+int slot = 0, above = 0, half;
+#ifdef JUDY_sse
+int bytes = cnt * keysize, off = 0, width, step, gt;
+__m128i bias, probe, keys, sum;
+#ifdef __SSSE3__
+static const char spread[8][16] = {
+	{ 0 }, { 0 }, { 0 },
+	{ 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1 },
+	{ 0 },
+	{ 0, 1, 2, 3, 4, -1, -1, -1, 5, 6, 7, 8, 9, -1, -1, -1 },
+	{ 0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1 },
+	{ 0, 1, 2, 3, 4, 5, 6, -1, 7, 8, 9, 10, 11, 12, 13, -1 },
+};
+__m128i shuffle = _mm_setzero_si128 ();
+#endif
+#endif
+#ifdef JUDY_neon
+int bytes = cnt * keysize, off = 0;
+#endif
+
+#ifdef JUDY_sse
+	if( keysize == 8 && bytes >= 32 && __builtin_cpu_supports ("avx2") ) {
+		above = judy_avx2_above (base, bytes, value, &off);
+		slot = off / keysize;
+	}
+
+	//	spread 3, 5, 6 and 7 byte keys into 4 and 8 byte lanes
+
+	switch( keysize ) {
+	case 1:
+	case 2:
+	case 4:
+		width = keysize;
+		break;
+#ifdef __SSSE3__
+	case 3:
+		width = 4;
+		break;
+#endif
+#ifdef __SSE4_2__
+	case 5:
+	case 6:
+	case 7:
+	case 8:
+		width = 8;
+		break;
+#endif
+	default:
+		width = 0;
+	}
+
+	if( width && bytes - off >= 16 ) {
+		step = width == keysize ? 16 : (16 / width) * keysize;
+
+		switch( width ) {
+		case 1:
+			bias = _mm_set1_epi8 ((char)0x80);
+			probe = _mm_set1_epi8 ((char)value);
+			break;
+		case 2:
+			bias = _mm_set1_epi16 ((short)0x8000);
+			probe = _mm_set1_epi16 ((short)value);
+			break;
+		case 4:
+			bias = _mm_set1_epi32 ((int)0x80000000);
+			probe = _mm_set1_epi32 ((int)value);
+			break;
+		default:
+			bias = _mm_set1_epi64x ((long long)((uint64_t)1 << 63));
+			probe = _mm_set1_epi64x ((long long)value);
+			break;
+		}
+
+		probe = _mm_xor_si128 (probe, bias);
+		sum = _mm_setzero_si128 ();
+#ifdef __SSSE3__
+		if( width != keysize )
+			shuffle = _mm_loadu_si128 ((__m128i *)spread[keysize]);
+#endif
+
+		//	each greater key adds one to every byte of its lane
+
+		for( ; off + step <= bytes; off += step ) {
+			keys = _mm_loadu_si128 ((__m128i *)(base + off));
+#ifdef __SSSE3__
+			if( width != keysize )
+				keys = _mm_shuffle_epi8 (keys, shuffle);
+#endif
+			keys = _mm_xor_si128 (keys, bias);
+			sum = _mm_sub_epi8 (sum, judy_sse_gt (keys, probe, width));
+		}
+
+		sum = _mm_sad_epu8 (sum, _mm_setzero_si128 ());
+		gt = _mm_cvtsi128_si32 (sum) + _mm_cvtsi128_si32 (_mm_srli_si128 (sum, 8));
+
+		//	overlap the final vector with the keys already counted
+
+		if( width == keysize && off < bytes ) {
+			keys = _mm_loadu_si128 ((__m128i *)(base + bytes - 16));
+			keys = _mm_xor_si128 (keys, bias);
+			half = _mm_movemask_epi8 (judy_sse_gt (keys, probe, width));
+			gt += __builtin_popcount (half >> (16 - (bytes - off)));
+			off = bytes;
+		}
+
+		above += gt / width;
+		slot = off / keysize;
+	}
+#endif
+#ifdef JUDY_neon
+	switch( keysize ) {
+	case 1:
+		for( ; off + 16 <= bytes; off += 16 )
+			above += vaddvq_u8 (vshrq_n_u8 (vcgtq_u8 (vld1q_u8 (base + off), vdupq_n_u8 (value)), 7));
+		break;
+	case 2:
+		for( ; off + 16 <= bytes; off += 16 )
+			above += vaddvq_u16 (vshrq_n_u16 (vcgtq_u16 (vld1q_u16 ((uint16_t *)(base + off)), vdupq_n_u16 (value)), 15));
+		break;
+	case 4:
+		for( ; off + 16 <= bytes; off += 16 )
+			above += vaddvq_u32 (vshrq_n_u32 (vcgtq_u32 (vld1q_u32 ((uint32_t *)(base + off)), vdupq_n_u32 (value)), 31));
+		break;
+	case 8:
+		for( ; off + 16 <= bytes; off += 16 )
+			above += vaddvq_u64 (vshrq_n_u64 (vcgtq_u64 (vld1q_u64 ((uint64_t *)(base + off)), vdupq_n_u64 (value)), 63));
+		break;
+	}
+
+	slot = off / keysize;
+#endif
+
+	//	count any keys left over from the vector pass
+
+	if( slot ) {
+		for( ; slot < cnt; slot++ )
+			above += judy_keyat (base, slot, keysize) > value;
+
+		return cnt - above - 1;
+	}
+
+	//	otherwise binary search the keys without branching
+
+	while( cnt > 1 ) {
+		half = cnt >> 1;
+		if( judy_keyat (base, slot + half, keysize) <= value )
+			slot += half;
+		cnt -= half;
+	}
+
+	return slot - (judy_keyat (base, slot, keysize) > value);
+}
+
+//	assemble key from current path
+
+uint judy_ckey (JudyCursor *cursor, uchar *buff, uint max)
+{
+int slot, cnt, /*size, */off, type;
+uint len = 0, idx = 0;
+uchar *base;
+int keysize;
+
+	max--;		// leave room for zero terminator
+
+	while( len < max && ++idx <= cursor->level ) {
+		slot = cursor->stack[idx].slot;
+		type = cursor->stack[idx].next & 0x07;
+		//size = JudySize[type];
+		switch( type ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+			keysize = JUDY_key_size - (cursor->stack[idx].off & JUDY_key_mask);
+			base = (uchar *)judy_addr (cursor, cursor->stack[idx].next);
+			//cnt = size / (sizeof(judyslot) + keysize);
+			off = keysize;
+#if BYTE_ORDER != BIG_ENDIAN
+			while( off-- && len < max )
+				buff[len++] = base[slot * keysize + off];
+#else
+			for( off = 0; off < keysize && len < max; off++ )
+				buff[len++] = base[slot * keysize + off];
+#endif
+			continue;
+		case JUDY_radix:
+			if( !slot )
+				break;
+			buff[len++] = slot;
+			continue;
+		case JUDY_span:
+			base = (uchar *)judy_addr (cursor, cursor->stack[idx].next);
+			cnt = JUDY_span_bytes;
+
+			for( slot = 0; slot < cnt && base[slot]; slot++ )
+			  if( len < max )
+				buff[len++] = base[slot];
+			continue;
+		}
+	}
+	buff[len] = '\0';
+	return len;
+}
+
+//	judy_key: judy_ckey on the array's own cursor
+
+uint judy_key (Judy *judy, uchar *buff, uint max)
+{
+	return judy_ckey (judy->cursor, buff, max);
+}
+
+//	judy_ckeyref: the key of the current entry, from a buffer
+//	the cursor keeps.  The levels of the path below the first one
+//	that differs from the last call still hold their bytes, so a
+//	walk with judy_cnxt or judy_cprv rewrites only the tail that
+//	changed.  Returns the key, zero terminated, with its length in
+//	*len, or NULL when out of memory.  It stays valid until the
+//	next judy_ckeyref call on the cursor.
+
+uchar *judy_ckeyref (JudyCursor *cursor, uint *len)
+{
+uint level = cursor->level, idx, off = 0, amt;
+int slot, cnt, keysize;
+uchar *base, *key;
+
+	if( !cursor->keypath )
+		if( !(cursor->keypath = (JudyStack *)malloc ((cursor->max + 1) * sizeof(JudyStack))) )
+			return NULL;
+
+#ifdef JUDY_CONCURRENT
+	//	a reclaim since may have reused a node of keypath
+
+	if( cursor->keyclock != __atomic_load_n (cursor->clock, __ATOMIC_ACQUIRE) )
+		cursor->keyclock = __atomic_load_n (cursor->clock, __ATOMIC_ACQUIRE), cursor->keylevel = 0;
+#endif
+
+	for( idx = 1; idx < level && idx <= cursor->keylevel; idx++ )
+		if( cursor->keypath[idx].next != cursor->stack[idx].next || cursor->keypath[idx].slot != cursor->stack[idx].slot )
+			break;
+
+	for( ; idx <= level; idx++ ) {
+		amt = cursor->stack[idx].off + JUDY_span_bytes + 1;
+
+		if( amt > cursor->keymax ) {
+			if( !(key = (uchar *)realloc (cursor->key, amt * 2)) )
+				return NULL;
+			cursor->key = key;
+			cursor->keymax = amt * 2;
+		}
+
+		cursor->keypath[idx] = cursor->stack[idx];
+		slot = cursor->stack[idx].slot;
+		off = cursor->stack[idx].off;
+		key = cursor->key + off;
+
+		switch( cursor->stack[idx].next & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+			keysize = JUDY_key_size - (off & JUDY_key_mask);
+			base = (uchar *)judy_addr (cursor, cursor->stack[idx].next) + slot * keysize;
+#if BYTE_ORDER != BIG_ENDIAN
+			for( cnt = 0; cnt < keysize; cnt++ )
+				key[cnt] = base[keysize - cnt - 1];
+#else
+			memcpy (key, base, keysize);
+#endif
+			off += keysize;
+			continue;
+		case JUDY_radix:
+			if( slot )
+				key[0] = slot, off++;
+			continue;
+		case JUDY_span:
+			base = (uchar *)judy_addr (cursor, cursor->stack[idx].next);
+
+			for( cnt = 0; cnt < JUDY_span_bytes && base[cnt]; cnt++ )
+				key[cnt] = base[cnt];
+
+			off += cnt;
+			continue;
+		}
+	}
+
+	cursor->keylevel = level;
+
+	if( !cursor->key && !(cursor->key = (uchar *)malloc (cursor->keymax = JUDY_span_bytes + 1)) )
+		return NULL;
+
+	//	a leaf chunk of a linear node ends in zeros
+
+	while( off && !cursor->key[off - 1] )
+		off--;
+
+	cursor->key[off] = 0;
+	*len = off;
+	return cursor->key;
+}
+
+//	judy_keyref: judy_ckeyref on the array's own cursor
+
+uchar *judy_keyref (Judy *judy, uint *len)
+{
+	return judy_ckeyref (judy->cursor, len);
+}
+
+//	find slot & setup cursor
+
+judyslot *judy_cslot (JudyCursor *cursor, uchar *buff, uint max)
 {
 int slot, size, keysize, tst, cnt;
-judyslot next = *judy->root;
-judyvalue value, test = 0;
+judyslot next = judy_load (cursor->root);
+judyvalue value;
 judyslot *table;
 judyslot *node;
 uint off = 0;
 uchar *base;
 
-	judy->level = 0;
+	cursor->level = 0;
 
 	while( next ) {
-		if( judy->level < judy->max )
-			judy->level++;
+		if( cursor->level < cursor->max )
+			cursor->level++;
 
-		judy->stack[judy->level].off = off;
-		judy->stack[judy->level].next = next;
+		cursor->stack[cursor->level].off = off;
+		cursor->stack[cursor->level].next = next;
+		judy_visit (cursor, next);
 		size = JudySize[next & 0x07];
 
 		switch( next & 0x07 ) {
@@ -396,11 +1518,10 @@ uchar *base;
 		case JUDY_8:
 		case JUDY_16:
 		case JUDY_32:
-			base = (uchar *)(next & JUDY_mask);
-			node = (judyslot *)((next & JUDY_mask) + size);
+			base = (uchar *)judy_addr (cursor, next);
+			node = (judyslot *)(judy_addr (cursor, next) + size);
 			keysize = JUDY_key_size - (off & JUDY_key_mask);
 			cnt = size / (sizeof(judyslot) + keysize);
-			slot = cnt;
 			value = 0;
 
 			do {
@@ -411,34 +1532,25 @@ uchar *base;
 
 			//  find slot > key
 
-			while( slot-- ) {
-				test = *(judyvalue *)(base + slot * keysize);
-#if BYTE_ORDER == BIG_ENDIAN
-				test >>= 8 * (JUDY_key_size - keysize); 
-#else
-				test &= JudyMask[keysize];
-#endif
-				if( test <= value )
-					break;
-			}
+			slot = judy_search (base, cnt, keysize, value);
 
-			judy->stack[judy->level].slot = slot;
+			cursor->stack[cursor->level].slot = slot;
 
-			if( test == value ) {
+			if( slot >= 0 && judy_keyat (base, slot, keysize) == value ) {
 
 				// is this a leaf?
 
 				if( !(value & 0xFF) )
 					return &node[-slot-1];
 
-				next = node[-slot-1];
+				next = judy_load (&node[-slot-1]);
 				continue;
 			}
 
 			return NULL;
 
 		case JUDY_radix:
-			table = (judyslot  *)(next & JUDY_mask); // outer radix
+			table = (judyslot  *)judy_addr (cursor, next); // outer radix
 
 			if( off < max )
 				slot = buff[off];
@@ -447,32 +1559,32 @@ uchar *base;
 
 			//	put radix slot on judy stack
 
-			judy->stack[judy->level].slot = slot;
+			cursor->stack[cursor->level].slot = slot;
 
-			if( (next = table[slot >> 4]) )
-				table = (judyslot  *)(next & JUDY_mask); // inner radix
+			if( (next = judy_load (&table[slot >> 4])) )
+				table = (judyslot  *)judy_addr (cursor, next); // inner radix
 			else
 				return NULL;
 
 			if( !slot )	// leaf?
 				return &table[slot & 0x0F];
 
-			next = table[slot & 0x0F];
+			next = judy_load (&table[slot & 0x0F]);
 			off += 1;
 			break;
 
 		case JUDY_span:
-			node = (judyslot *)((next & JUDY_mask) + JudySize[JUDY_span]);
-			base = (uchar *)(next & JUDY_mask);
+			node = (judyslot *)(judy_addr (cursor, next) + JudySize[JUDY_span]);
+			base = (uchar *)judy_addr (cursor, next);
 			cnt = tst = JUDY_span_bytes;
 			if( tst > (int)(max - off) )
 				tst = max - off;
-			value = strncmp((const char *)base, (const char *)(buff + off), tst);
+			value = memcmp (base, buff + off, tst);
 			if( !value && tst < cnt && !base[tst] ) // leaf?
 				return &node[-1];
 
 			if( !value && tst == cnt ) {
-				next = node[-1];
+				next = judy_load (&node[-1]);
 				off += cnt;
 				continue;
 			}
@@ -483,6 +1595,13 @@ uchar *base;
 	return NULL;
 }
 
+//	judy_slot: judy_cslot on the array's own cursor
+
+judyslot *judy_slot (Judy *judy, uchar *buff, uint max)
+{
+	return judy_cslot (judy->cursor, buff, max);
+}
+
 //	promote full nodes to next larger size
 
 judyslot *judy_promote (Judy *judy, judyslot *next, int idx, judyvalue value, int keysize)
@@ -496,6 +1615,7 @@ judyslot *newnode, *node;
 judyslot *result;
 uchar *newbase;
 uint type;
+judy_timer (began);
 
 	type = (*next & 0x07) + 1;
 	node = (judyslot *)((*next & JUDY_mask) + JudySize[type-1]);
@@ -504,7 +1624,7 @@ uint type;
 
 	// promote node to next larger size
 
-	newbase = judy_alloc (judy, type);
+	newbase = (uchar *)judy_alloc (judy, type);
 	newnode = (judyslot *)(newbase + JudySize[type]);
 	*next = (judyslot)newbase | type;
 
@@ -534,9 +1654,11 @@ uint type;
 	for( ; slot < oldcnt; slot++ )
 		newnode[-(slot + newcnt - oldcnt + 1)] = node[-(slot + 1)];	// copy ptr
 
-	judy->stack[judy->level].next = *next;
-	judy->stack[judy->level].slot = idx + newcnt - oldcnt - 1;
+	judy->cursor->stack[judy->cursor->level].next = *next;
+	judy->cursor->stack[judy->cursor->level].slot = idx + newcnt - oldcnt - 1;
 	judy_free (judy, (void **)base, type - 1);
+	judy_count (judy, promotes[type - 1]);
+	judy_timed (judy, promotecycles, began);
 	return result;
 }
 
@@ -544,7 +1666,7 @@ uint type;
 //	make node with slot - start entries
 //	moving key over one offset
 
-void judy_radix (Judy *judy, judyslot *radix, uchar *old, int start, int slot, int keysize, uchar key)
+void judy_radix (Judy *judy, judyslot *radix, uchar *old, int start, int slot, int keysize, uchar key, uint fixed)
 {
 int size, idx, cnt = slot - start, newcnt;
 judyslot *node, *oldnode;
@@ -555,7 +1677,7 @@ uchar *base;
 	//	if necessary, setup inner radix node
 
 	if( !(table = (judyslot *)(radix[key >> 4] & JUDY_mask)) ) {
-		table = judy_alloc (judy, JUDY_radix);
+		table = (judyslot *)judy_alloc (judy, JUDY_radix);
 		radix[key >> 4] = (judyslot)table | JUDY_radix;
 	}
 
@@ -563,7 +1685,7 @@ uchar *base;
 
 	// is this slot a leaf?
 
-	if( !key || !keysize ) {
+	if( (!key && !fixed) || !keysize ) {
 		table[key & 0x0F] = oldnode[-start-1];
 		return;
 	}
@@ -578,7 +1700,7 @@ uchar *base;
 
 	//	store new node pointer in inner table
 
-	base = judy_alloc (judy, type);
+	base = (uchar *)judy_alloc (judy, type);
 	node = (judyslot *)(base + size);
 	table[key & 0x0F] = (judyslot)base | type;
 
@@ -595,22 +1717,23 @@ uchar *base;
 	}
 }
 			
-//	decompose full node to radix nodes
+//	decompose full node to radix nodes.  fixed is set for
+//	judyL integer keys, where a zero byte does not end the key
 
-void judy_splitnode (Judy *judy, judyslot *next, uint size, uint keysize)
+void judy_splitnode (Judy *judy, judyslot *next, uint size, uint keysize, uint fixed)
 {
 int cnt, slot, start = 0;
 uint key = 0x0100, nxt;
 judyslot *newradix;
 uchar *base;
+judy_timer (began);
 
 	base = (uchar  *)(*next & JUDY_mask);
 	cnt = size / (sizeof(judyslot) + keysize);
 
 	//	allocate outer judy_radix node
 
-	newradix = judy_alloc (judy, JUDY_radix);
-	*next = (judyslot)newradix | JUDY_radix;
+	newradix = (judyslot *)judy_alloc (judy, JUDY_radix);
 
 	for( slot = 0; slot < cnt; slot++ ) {
 #if BYTE_ORDER != BIG_ENDIAN
@@ -626,18 +1749,24 @@ uchar *base;
 
 		//	decompose portion of old node into radix nodes
 
-		judy_radix (judy, newradix, base, start, slot, keysize - 1, key);
+		judy_radix (judy, newradix, base, start, slot, keysize - 1, key, fixed);
 		start = slot;
 		key = nxt;
 	}
 
-	judy_radix (judy, newradix, base, start, slot, keysize - 1, key);
+	judy_radix (judy, newradix, base, start, slot, keysize - 1, key, fixed);
+
+	//	publish the finished radix node
+
+	judy_store (next, (judyslot)newradix | JUDY_radix);
 	judy_free (judy, (void **)base, JUDY_max);
+	judy_count (judy, splits);
+	judy_timed (judy, splitcycles, began);
 }
 
 //	return first leaf
 
-judyslot *judy_first (Judy *judy, judyslot next, uint off)
+judyslot *judy_first (JudyCursor *cursor, judyslot next, uint off)
 {
 judyslot *table, *inner;
 uint keysize, size;
@@ -646,11 +1775,11 @@ int slot, cnt;
 uchar *base;
 
 	while( next ) {
-		if( judy->level < judy->max )
-			judy->level++;
+		if( cursor->level < cursor->max )
+			cursor->level++;
 
-		judy->stack[judy->level].off = off;
-		judy->stack[judy->level].next = next;
+		cursor->stack[cursor->level].off = off;
+		cursor->stack[cursor->level].next = next;
 		size = JudySize[next & 0x07];
 
 		switch( next & 0x07 ) {
@@ -661,15 +1790,18 @@ uchar *base;
 		case JUDY_16:
 		case JUDY_32:
 			keysize = JUDY_key_size - (off & JUDY_key_mask);
-			node = (judyslot *)((next & JUDY_mask) + size);
-			base = (uchar *)(next & JUDY_mask);
+			node = (judyslot *)(judy_addr (cursor, next) + size);
+			base = (uchar *)judy_addr (cursor, next);
 			cnt = size / (sizeof(judyslot) + keysize);
 
 			for( slot = 0; slot < cnt; slot++ )
-				if( node[-slot-1] )
+				if( judy_load (&node[-slot-1]) )
 					break;
 
-			judy->stack[judy->level].slot = slot;
+			cursor->stack[cursor->level].slot = slot;
+
+			if( slot == cnt )	// no cells set yet
+				return NULL;
 #if BYTE_ORDER != BIG_ENDIAN
 			if( !base[slot * keysize] )
 				return &node[-slot-1];
@@ -677,15 +1809,15 @@ uchar *base;
 			if( !base[slot * keysize + keysize - 1] )
 				return &node[-slot-1];
 #endif
-			next = node[-slot - 1];
+			next = judy_load (&node[-slot - 1]);
 			off = (off | JUDY_key_mask) + 1;
 			continue;
 		case JUDY_radix:
-			table = (judyslot *)(next & JUDY_mask);
+			table = (judyslot *)judy_addr (cursor, next);
 			for( slot = 0; slot < 256; slot++ )
-			  if( (inner = (judyslot *)(table[slot >> 4] & JUDY_mask)) ) {
-				if( (next = inner[slot & 0x0F]) ) {
-				  judy->stack[judy->level].slot = slot;
+			  if( (inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) ) {
+				if( (next = judy_load (&inner[slot & 0x0F])) ) {
+				  cursor->stack[cursor->level].slot = slot;
 				  if( !slot )
 					return &inner[slot & 0x0F];
 				  else
@@ -693,15 +1825,20 @@ uchar *base;
 				}
 			  } else
 				slot |= 0x0F;
+
+			if( slot > 0xFF ) {	// no cells set yet
+				cursor->stack[cursor->level].slot = 0xFF;
+				return NULL;
+			}
 			off++;
 			continue;
 		case JUDY_span:
-			node = (judyslot *)((next & JUDY_mask) + JudySize[JUDY_span]);
-			base = (uchar *)(next & JUDY_mask);
+			node = (judyslot *)(judy_addr (cursor, next) + JudySize[JUDY_span]);
+			base = (uchar *)judy_addr (cursor, next);
 			cnt = JUDY_span_bytes;
 			if( !base[cnt - 1] )	// leaf node?
 				return &node[-1];
-			next = node[-1];
+			next = judy_load (&node[-1]);
 			off += cnt;
 			continue;
 		}
@@ -711,7 +1848,7 @@ uchar *base;
 
 //	return last leaf cell pointer
 
-judyslot *judy_last (Judy *judy, judyslot next, uint off)
+judyslot *judy_last (JudyCursor *cursor, judyslot next, uint off)
 {
 judyslot *table, *inner;
 uint keysize, size;
@@ -720,11 +1857,11 @@ int slot, cnt;
 uchar *base;
 
 	while( next ) {
-		if( judy->level < judy->max )
-			judy->level++;
+		if( cursor->level < cursor->max )
+			cursor->level++;
 
-		judy->stack[judy->level].off = off;
-		judy->stack[judy->level].next = next;
+		cursor->stack[cursor->level].off = off;
+		cursor->stack[cursor->level].next = next;
 		size = JudySize[next & 0x07];
 		switch( next & 0x07 ) {
 		case JUDY_1:
@@ -735,9 +1872,9 @@ uchar *base;
 		case JUDY_32:
 			keysize = JUDY_key_size - (off & JUDY_key_mask);
 			slot = size / (sizeof(judyslot) + keysize);
-			base = (uchar *)(next & JUDY_mask);
-			node = (judyslot *)((next & JUDY_mask) + size);
-			judy->stack[judy->level].slot = --slot;
+			base = (uchar *)judy_addr (cursor, next);
+			node = (judyslot *)(judy_addr (cursor, next) + size);
+			cursor->stack[cursor->level].slot = --slot;
 
 #if BYTE_ORDER != BIG_ENDIAN
 			if( !base[slot * keysize] )
@@ -746,15 +1883,15 @@ uchar *base;
 #endif
 				return &node[-slot-1];
 
-			next = node[-slot-1];
+			next = judy_load (&node[-slot-1]);
 			off += keysize;
 			continue;
 		case JUDY_radix:
-			table = (judyslot *)(next & JUDY_mask);
+			table = (judyslot *)judy_addr (cursor, next);
 			for( slot = 256; slot--; ) {
-			  judy->stack[judy->level].slot = slot;
-			  if( (inner = (judyslot *)(table[slot >> 4] & JUDY_mask)) ) {
-				if( (next = inner[slot & 0x0F]) )
+			  cursor->stack[cursor->level].slot = slot;
+			  if( (inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) ) {
+				if( (next = judy_load (&inner[slot & 0x0F])) )
 				  if( !slot )
 					return &inner[0];
 				  else
@@ -762,15 +1899,18 @@ uchar *base;
 			  } else
 				slot &= 0xF0;
 			}
+
+			if( slot < 0 )	// no cells set yet
+				return NULL;
 			off++;
 			continue;
 		case JUDY_span:
-			node = (judyslot *)((next & JUDY_mask) + JudySize[JUDY_span]);
-			base = (uchar *)(next & JUDY_mask);
+			node = (judyslot *)(judy_addr (cursor, next) + JudySize[JUDY_span]);
+			base = (uchar *)judy_addr (cursor, next);
 			cnt = JUDY_span_bytes;
 			if( !base[cnt - 1] )	// leaf node?
 				return &node[-1];
-			next = node[-1];
+			next = judy_load (&node[-1]);
 			off += cnt;
 			continue;
 		}
@@ -778,19 +1918,26 @@ uchar *base;
 	return NULL;
 }
 
-//	judy_end: return last entry
+//	judy_cend: return last entry
+
+judyslot *judy_cend (JudyCursor *cursor)
+{
+	cursor->level = 0;
+	return judy_last (cursor, judy_load (cursor->root), 0);
+}
+
+//	judy_end: judy_cend on the array's own cursor
 
 judyslot *judy_end (Judy *judy)
 {
-	judy->level = 0;
-	return judy_last (judy, *judy->root, 0);
+	return judy_cend (judy->cursor);
 }
 
-//	judy_nxt: return next entry
+//	judy_cnxt: return next entry
 
-judyslot *judy_nxt (Judy *judy)
+judyslot *judy_cnxt (JudyCursor *cursor)
 {
-judyslot *table, *inner;
+judyslot *table, *inner, *cell;
 int slot, size, cnt;
 judyslot *node;
 judyslot next;
@@ -798,13 +1945,13 @@ uint keysize;
 uchar *base;
 uint off;
 
-	if( !judy->level )
-		return judy_first (judy, *judy->root, 0);
+	if( !cursor->level )
+		return judy_first (cursor, judy_load (cursor->root), 0);
 
-	while( judy->level ) {
-		next = judy->stack[judy->level].next;
-		slot = judy->stack[judy->level].slot;
-		off = judy->stack[judy->level].off;
+	while( cursor->level ) {
+		next = cursor->stack[cursor->level].next;
+		slot = cursor->stack[cursor->level].slot;
+		off = cursor->stack[cursor->level].off;
 		keysize = JUDY_key_size - (off & JUDY_key_mask);
 		size = JudySize[next & 0x07];
 
@@ -816,8 +1963,8 @@ uint off;
 		case JUDY_16:
 		case JUDY_32:
 			cnt = size / (sizeof(judyslot) + keysize);
-			node = (judyslot *)((next & JUDY_mask) + size);
-			base = (uchar *)(next & JUDY_mask);
+			node = (judyslot *)(judy_addr (cursor, next) + size);
+			base = (uchar *)judy_addr (cursor, next);
 			if( ++slot < cnt )
 #if BYTE_ORDER != BIG_ENDIAN
 				if( !base[slot * keysize] )
@@ -825,55 +1972,69 @@ uint off;
 				if( !base[slot * keysize + keysize - 1] )
 #endif
 				{
-					judy->stack[judy->level].slot = slot;
+					cursor->stack[cursor->level].slot = slot;
 					return &node[-slot - 1];
 				} else {
-					judy->stack[judy->level].slot = slot;
-					return judy_first (judy, node[-slot-1], (off | JUDY_key_mask) + 1);
+					cursor->stack[cursor->level].slot = slot;
+					if( (cell = judy_first (cursor, judy_load (&node[-slot-1]), (off | JUDY_key_mask) + 1)) )
+						return cell;
+					continue;
 				}
-			judy->level--;
+			cursor->level--;
 			continue;
 
 		case JUDY_radix:
-			table = (judyslot *)(next & JUDY_mask);
+			table = (judyslot *)judy_addr (cursor, next);
 
 			while( ++slot < 256 )
-			  if( (inner = (judyslot *)(table[slot >> 4] & JUDY_mask)) ) {
-				if( inner[slot & 0x0F] ) {
-				  judy->stack[judy->level].slot = slot;
-				  return judy_first(judy, inner[slot & 0x0F], off + 1);
+			  if( (inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) ) {
+				if( (next = judy_load (&inner[slot & 0x0F])) ) {
+				  cursor->stack[cursor->level].slot = slot;
+				  if( (cell = judy_first (cursor, next, off + 1)) )
+					return cell;
+				  break;
 				}
 			  } else
 				slot |= 0x0F;
 
-			judy->level--;
+			if( slot < 256 )	// nothing set below, resume there
+				continue;
+
+			cursor->level--;
 			continue;
 		case JUDY_span:
-			judy->level--;
+			cursor->level--;
 			continue;
 		}
 	}
 	return NULL;
 }
 
-//	judy_prv: return ptr to previous entry
+//	judy_nxt: judy_cnxt on the array's own cursor
 
-judyslot *judy_prv (Judy *judy)
+judyslot *judy_nxt (Judy *judy)
+{
+	return judy_cnxt (judy->cursor);
+}
+
+//	judy_cprv: return ptr to previous entry
+
+judyslot *judy_cprv (JudyCursor *cursor)
 {
 int slot, size, keysize;
-judyslot *table, *inner;
+judyslot *table, *inner, *cell;
 judyslot *node;
 judyslot next;
 uchar *base;
 uint off;
 
-	if( !judy->level )
-		return judy_last (judy, *judy->root, 0);
+	if( !cursor->level )
+		return judy_last (cursor, judy_load (cursor->root), 0);
 	
-	while( judy->level ) {
-		next = judy->stack[judy->level].next;
-		slot = judy->stack[judy->level].slot;
-		off = judy->stack[judy->level].off;
+	while( cursor->level ) {
+		next = cursor->stack[cursor->level].next;
+		slot = cursor->stack[cursor->level].slot;
+		off = cursor->stack[cursor->level].off;
 		size = JudySize[next & 0x07];
 
 		switch( next & 0x07 ) {
@@ -883,64 +2044,386 @@ uint off;
 		case JUDY_8:
 		case JUDY_16:
 		case JUDY_32:
-			node = (judyslot *)((next & JUDY_mask) + size);
-			if( !slot || !node[-slot] ) {
-				judy->level--;
+			node = (judyslot *)(judy_addr (cursor, next) + size);
+			if( !slot || !judy_load (&node[-slot]) ) {
+				cursor->level--;
 				continue;
 			}
 
-			base = (uchar *)(next & JUDY_mask);
-			judy->stack[judy->level].slot--;
+			base = (uchar *)judy_addr (cursor, next);
+			cursor->stack[cursor->level].slot--;
 			keysize = JUDY_key_size - (off & JUDY_key_mask);
 
 #if BYTE_ORDER != BIG_ENDIAN
-			if( base[(slot - 1) * keysize] )
+			if( !base[(slot - 1) * keysize] )
 #else
-			if( base[(slot - 1) * keysize + keysize - 1] )
+			if( !base[(slot - 1) * keysize + keysize - 1] )
 #endif
-				return judy_last (judy, node[-slot], (off | JUDY_key_mask) + 1);
+				return &node[-slot];
 
-			return &node[-slot];
+			if( (cell = judy_last (cursor, judy_load (&node[-slot]), (off | JUDY_key_mask) + 1)) )
+				return cell;
+			continue;
 
 		case JUDY_radix:
-			table = (judyslot *)(next & JUDY_mask);
+			table = (judyslot *)judy_addr (cursor, next);
 
 			while( slot-- ) {
-			  judy->stack[judy->level].slot--;
-			  if( (inner = (judyslot *)(table[slot >> 4] & JUDY_mask)) )
-				if( inner[slot & 0x0F] )
-				  if( slot )
-				    return judy_last(judy, inner[slot & 0x0F], off + 1);
-				  else
+			  cursor->stack[cursor->level].slot--;
+			  if( (inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) )
+				if( (next = judy_load (&inner[slot & 0x0F])) ) {
+				  if( !slot )
 					return &inner[0];
+				  if( (cell = judy_last (cursor, next, off + 1)) )
+					return cell;
+				  break;
+				}
 			}
 
-			judy->level--;
+			if( slot > 0 )	// nothing set below, resume there
+				continue;
+
+			cursor->level--;
 			continue;
 
 		case JUDY_span:
-			judy->level--;
+			cursor->level--;
 			continue;
 		}
 	}
 	return NULL;
 }
 
-//	judy_del: delete string from judy array
-//		returning previous entry.
+//	judy_prv: judy_cprv on the array's own cursor
 
-judyslot *judy_del (Judy *judy)
+judyslot *judy_prv (Judy *judy)
+{
+	return judy_cprv (judy->cursor);
+}
+
+//	number of keys in a linear node: they fill it from the top
+
+int judy_used (uchar *base, int type, int keysize)
+{
+int size = JudySize[type];
+judyslot *node = (judyslot *)(base + size);
+int cnt = size / (sizeof(judyslot) + keysize);
+int slot;
+
+	for( slot = 0; slot < cnt && !node[-slot-1]; slot++ );
+	return cnt - slot;
+}
+
+//	smallest linear node type for cnt keys, or JUDY_radix if
+//	they need more than three quarters of a JUDY_max node.
+//	Leaving a quarter of the node free, rounded up so JUDY_1
+//	and JUDY_2 keep a free slot too, means insert/delete churn
+//	at the boundary does not promote and demote the same node
+//	back and forth.
+
+int judy_fit (int cnt, int keysize)
+{
+int type, max;
+
+	for( type = JUDY_1; type <= JUDY_max; type++ ) {
+		max = JudySize[type] / (sizeof(judyslot) + keysize);
+		if( cnt <= max - (max + 3) / 4 )
+			return type;
+	}
+
+	return JUDY_radix;
+}
+
+//	demote linear node: copy its cnt keys into a smaller node
+
+uchar *judy_demote (Judy *judy, uchar *base, int type, int newtype, int keysize, int cnt)
+{
+judyslot *node = (judyslot *)(base + JudySize[type]);
+int oldcnt = JudySize[type] / (sizeof(judyslot) + keysize);
+int newcnt = JudySize[newtype] / (sizeof(judyslot) + keysize);
+judyslot *newnode;
+uchar *newbase;
+int slot;
+
+	newbase = (uchar *)judy_alloc (judy, newtype);
+	newnode = (judyslot *)(newbase + JudySize[newtype]);
+
+	memcpy (newbase + (newcnt - cnt) * keysize, base + (oldcnt - cnt) * keysize, cnt * keysize);
+
+	for( slot = 0; slot < cnt; slot++ )
+		newnode[-(newcnt - slot)] = node[-(oldcnt - slot)];
+
+	return newbase;
+}
+
+//	collapse the JUDY_radix node at the cursor back into a
+//	linear node when its keys fit, the reverse of judy_splitnode.
+//	*below counts the keys ahead of the deleted one in the child
+//	on the cursor path and returns those ahead of it in the new
+//	node.  Children that are not linear nodes are left alone.
+
+int judy_collapse (Judy *judy, int *below, uint fixed)
+{
+JudyStack *stack = judy->cursor->stack + judy->cursor->level;
+int keysize = JUDY_key_size - (stack->off & JUDY_key_mask);
+int limit = JudySize[JUDY_max] / (sizeof(judyslot) + keysize);
+int slot, idx, src, cnt, newcnt, type, total = 0, less = 0;
+judyslot *table, *inner, *node, *newnode;
+uchar *base, *newbase;
+judyvalue value;
+judyslot next;
+
+	table = (judyslot *)(stack->next & JUDY_mask);
+
+	limit -= (limit + 3) / 4;
+
+	//	estimate from the child links first, so a busy radix
+	//	node is turned down without visiting its children.  A
+	//	linear node of a type above JUDY_1 holds more keys than
+	//	judy_fit allows in the next smaller type.
+
+	for( slot = 0; slot < 256; slot++ ) {
+		if( !(inner = (judyslot *)(table[slot >> 4] & JUDY_mask)) ) {
+			slot |= 0x0F;
+			continue;
+		}
+
+		if( !(next = inner[slot & 0x0F]) )
+			continue;
+
+		cnt = 1;
+
+		if( (slot || fixed) && keysize > 1 )
+		  switch( next & 0x07 ) {
+		  case JUDY_radix:
+		  case JUDY_span:
+			return 0;
+		  case JUDY_1:
+			break;
+		  default:
+			cnt = JudySize[(next & 0x07) - 1] / (sizeof(judyslot) + keysize - 1);
+			cnt -= (cnt + 3) / 4 - 1;
+		  }
+
+		if( (total += cnt) > limit )
+			return 0;
+	}
+
+	//	then count their keys
+
+	for( total = slot = 0; slot < 256; slot++ ) {
+		if( !(inner = (judyslot *)(table[slot >> 4] & JUDY_mask)) ) {
+			slot |= 0x0F;
+			continue;
+		}
+
+		if( !(next = inner[slot & 0x0F]) )
+			continue;
+
+		if( (!slot && !fixed) || keysize == 1 )
+			cnt = 1;
+		else
+			cnt = judy_used ((uchar *)(next & JUDY_mask), next & 0x07, keysize - 1);
+
+		if( slot < (int)stack->slot )
+			less += cnt;
+
+		if( (total += cnt) > limit )
+			return 0;
+	}
+
+	type = judy_fit (total, keysize);
+	newcnt = JudySize[type] / (sizeof(judyslot) + keysize);
+	newbase = (uchar *)judy_alloc (judy, type);
+	newnode = (judyslot *)(newbase + JudySize[type]);
+	idx = newcnt - total;
+
+	//	fill the new node in key order, prefixing each child
+	//	key with its radix byte
+
+	for( slot = 0; slot < 256; slot++ ) {
+		if( !(inner = (judyslot *)(table[slot >> 4] & JUDY_mask)) ) {
+			slot |= 0x0F;
+			continue;
+		}
+
+		if( !(next = inner[slot & 0x0F]) )
+			continue;
+
+		value = (judyvalue)slot << 8 * (keysize - 1);
+
+		if( (!slot && !fixed) || keysize == 1 ) {
+			judy_setkey (newbase, idx, keysize, value);
+			newnode[-++idx] = next;
+			continue;
+		}
+
+		base = (uchar *)(next & JUDY_mask);
+		node = (judyslot *)(base + JudySize[next & 0x07]);
+		cnt = JudySize[next & 0x07] / (sizeof(judyslot) + keysize - 1);
+
+		for( src = cnt - judy_used (base, next & 0x07, keysize - 1); src < cnt; src++ ) {
+			judy_setkey (newbase, idx, keysize, value | judy_keyat (base, src, keysize - 1));
+			newnode[-++idx] = node[-src-1];
+		}
+
+		judy_free (judy, base, next & 0x07);
+	}
+
+	judy_store (judy_parent (judy->cursor, judy->cursor->level), (judyslot)newbase | type);
+
+	for( slot = 0; slot < 16; slot++ )
+		if( table[slot] )
+			judy_free (judy, (void *)(table[slot] & JUDY_mask), JUDY_radix);
+
+	judy_free (judy, table, JUDY_radix);
+
+	*below += less;
+	stack->next = (judyslot)newbase | type;
+	stack->slot = newcnt - total + *below;
+	return 1;
+}
+
+//	fold a chain of lone JUDY_1 nodes starting on a key word
+//	boundary back into JUDY_span nodes, the reverse of
+//	judy_splitspan.  Returns zero if nothing was folded.
+
+int judy_mergespan (Judy *judy, judyslot *next)
+{
+judyslot chain[JUDY_span_bytes / JUDY_key_size];
+uint cnt, idx, merged = 0;
+uchar *base, *newbase;
+judyslot link;
+int leaf = 0;
+#if BYTE_ORDER != BIG_ENDIAN
+int i;
+#endif
+
+	while( 1 ) {
+		link = *next;
+
+		for( cnt = 0; cnt < JUDY_span_bytes / JUDY_key_size && (link & 0x07) == JUDY_1; ) {
+			base = (uchar *)(link & JUDY_mask);
+			chain[cnt++] = link;
+			link = ((judyslot *)(base + JudySize[JUDY_1]))[-1];
+#if BYTE_ORDER != BIG_ENDIAN
+			if( (leaf = !base[0]) )
+#else
+			if( (leaf = !base[JUDY_key_size - 1]) )
+#endif
+				break;
+		}
+
+		//	a span must end the key or be full, and save space
+
+		if( !leaf && cnt < JUDY_span_bytes / JUDY_key_size )
+			return merged;
+
+		if( cnt * (uint)JudySize[JUDY_1] < (uint)JudySize[JUDY_span] )
+			return merged;
+
+		newbase = (uchar *)judy_alloc (judy, JUDY_span);
+
+		for( idx = 0; idx < cnt; idx++ ) {
+			base = (uchar *)(chain[idx] & JUDY_mask);
+#if BYTE_ORDER != BIG_ENDIAN
+			i = JUDY_key_size;
+			while( i-- )
+				newbase[idx * JUDY_key_size + JUDY_key_size - 1 - i] = base[i];
+#else
+			memcpy (newbase + idx * JUDY_key_size, base, JUDY_key_size);
+#endif
+		}
+
+		((judyslot *)(newbase + JudySize[JUDY_span]))[-1] = link;
+		judy_store (next, (judyslot)newbase | JUDY_span);
+
+		for( idx = 0; idx < cnt; idx++ )
+			judy_free (judy, (void *)(chain[idx] & JUDY_mask), JUDY_1);
+
+		merged++;
+
+		if( leaf )
+			return merged;
+
+		next = (judyslot *)(newbase + JudySize[JUDY_span]) - 1;
+	}
+}
+
+//	judy_shrink: after a delete demoted the node at the cursor
+//	or emptied a child of it, fold it into radix parents that
+//	now hold few keys and its JUDY_1 chain into spans.  below
+//	counts the node's keys ahead of the deleted one.  Returns
+//	the previous entry, as judy_del does, or NULL for judyL
+//	integer keys, which have no spans.
+
+judyslot *judy_shrink (Judy *judy, int below, uint fixed)
+{
+JudyCursor *cursor = judy->cursor;
+JudyStack *stack = cursor->stack + cursor->level;
+uint level, off;
+
+	if( (stack->next & 0x07) != JUDY_radix || judy_collapse (judy, &below, fixed) )
+	  while( cursor->level > 1 && (stack[-1].next & 0x07) == JUDY_radix ) {
+		cursor->level--;
+
+		if( !judy_collapse (judy, &below, fixed) ) {
+			cursor->level++;
+			break;
+		}
+
+		stack--;
+	  }
+
+	if( fixed )
+		return NULL;
+
+	if( (stack->next & 0x07) != JUDY_1 || stack->off & JUDY_key_mask )
+		return judy_prv (judy);
+
+	//	find the head of the chain of lone JUDY_1 nodes
+
+	for( level = cursor->level; level > 1; level-- )
+		if( (cursor->stack[level - 1].next & 0x07) != JUDY_1 || cursor->stack[level - 1].off & JUDY_key_mask )
+			break;
+
+	if( !judy_mergespan (judy, judy_parent (cursor, level)) )
+		return judy_prv (judy);
+
+	//	the chain holds one key per node, so the previous entry
+	//	is either the last one under it or the one before it
+
+	off = cursor->stack[level].off;
+	cursor->level = level - 1;
+
+	if( below )
+		return judy_last (cursor, judy_load (judy_parent (cursor, level)), off);
+
+	if( !cursor->level )
+		return NULL;
+
+	return judy_prv (judy);
+}
+
+//	judy_remove: delete the key at the cursor, returning the
+//	previous entry for string keys.  fixed is set for judyL
+//	integer keys.
+
+judyslot *judy_remove (Judy *judy, uint fixed)
 {
 int slot, off, size, type, high;
 judyslot *table, *inner;
 judyslot next, *node;
-int keysize, cnt;
-uchar *base;
+int keysize, cnt, used, below, fit;
+uchar *base, *newbase;
 
-	while( judy->level ) {
-		next = judy->stack[judy->level].next;
-		slot = judy->stack[judy->level].slot;
-		off = judy->stack[judy->level].off;
+	judy_reclaim (judy);
+	judy->cursor->keylevel = 0;
+
+	while( judy->cursor->level ) {
+		next = judy->cursor->stack[judy->cursor->level].next;
+		slot = judy->cursor->stack[judy->cursor->level].slot;
+		off = judy->cursor->stack[judy->cursor->level].off;
 		size = JudySize[next & 0x07];
 
 		switch( type = next & 0x07 ) {
@@ -954,9 +2437,19 @@ uchar *base;
 			cnt = size / (sizeof(judyslot) + keysize);
 			node = (judyslot *)((next & JUDY_mask) + size);
 			base = (uchar *)(next & JUDY_mask);
+#ifdef JUDY_CONCURRENT
+			//	readers may be in this node: delete from a copy
+
+			base = (uchar *)judy_alloc (judy, type);
+			memcpy (base - JUDY_head, (uchar *)(next & JUDY_mask) - JUDY_head, size + JUDY_head);
+			judy_free (judy, (uchar *)(next & JUDY_mask), type);
+			node = (judyslot *)(base + size);
+#endif
 
 			//	move deleted slot to first slot
 
+			below = slot;
+
 			while( slot ) {
 				node[-slot-1] = node[-slot];
 				memcpy (base + slot * keysize, base + (slot - 1) * keysize, keysize);
@@ -969,64 +2462,178 @@ uchar *base;
 			memset (base, 0, keysize);
 
 			if( node[-cnt] ) {	// does node have any slots left?
-				judy->stack[judy->level].slot++;
-				return judy_prv (judy);
+				used = judy_used (base, type, keysize);
+				below -= cnt - used - 1;
+
+				//	demote an under-filled node
+
+				if( (fit = judy_fit (used, keysize)) && fit < type ) {
+					newbase = judy_demote (judy, base, type, fit, keysize, used);
+					judy_free (judy, base, type);
+					cnt = JudySize[fit] / (sizeof(judyslot) + keysize);
+					base = newbase, type = fit;
+				}
+
+				if( ((judyslot)base | type) != next ) {
+					judy->cursor->stack[judy->cursor->level].next = (judyslot)base | type;
+					judy_store (judy_parent (judy->cursor, judy->cursor->level), (judyslot)base | type);
+				}
+
+				judy->cursor->stack[judy->cursor->level].slot = cnt - used + below;
+
+				if( type != (int)(next & 0x07) )
+					return judy_shrink (judy, below, fixed);
+
+				return fixed ? NULL : judy_prv (judy);
 			}
 
 			judy_free (judy, base, type);
-			judy->level--;
+			judy->cursor->level--;
 			continue;
 
 		case JUDY_radix:
 			table = (judyslot  *)(next & JUDY_mask);
 			inner = (judyslot *)(table[slot >> 4] & JUDY_mask);
-			inner[slot & 0x0F] = 0;
 			high = slot & 0xF0;
+#ifdef JUDY_CONCURRENT
+			//	readers must not find the radix node empty:
+			//	leave its last entry in place and unlink it whole
+
+			for( cnt = 16; cnt--; )
+				if( cnt != (slot >> 4) && table[cnt] )
+					break;
+
+			if( cnt < 0 )
+			  for( cnt = 16; cnt--; )
+				if( cnt != (slot & 0x0F) && inner[cnt] )
+					break;
+
+			if( cnt < 0 ) {
+				judy_free (judy, inner, JUDY_radix);
+				judy_free (judy, table, JUDY_radix);
+				judy->cursor->level--;
+				continue;
+			}
+#endif
+			judy_store (&inner[slot & 0x0F], 0);
 
 			for( cnt = 16; cnt--; )
 				if( inner[cnt] )
-					return judy_prv (judy);
+					return judy_shrink (judy, 0, fixed);
 
 			judy_free (judy, inner, JUDY_radix);
-			table[slot >> 4] = 0;
+			judy_store (&table[slot >> 4], 0);
 
 			for( cnt = 16; cnt--; )
 				if( table[cnt] )
-					return judy_prv (judy);
+					return judy_shrink (judy, 0, fixed);
 
 			judy_free (judy, table, JUDY_radix);
-			judy->level--;
+			judy->cursor->level--;
 			continue;
 
 		case JUDY_span:
 			base = (uchar *)(next & JUDY_mask);
 			judy_free (judy, base, type);
-			judy->level--;
+			judy->cursor->level--;
 			continue;
 		}
 	}
 
 	//	tree is now empty
 
-	*judy->root = 0;
+	judy_store (judy->root, 0);
 	return NULL;
 }
 
+#ifdef JUDY_COUNTS
+//	judy_countpath: add delta to the counts of the nodes
+//	on the cursor path, and of the inner radix tables
+
+void judy_countpath (JudyCursor *cursor, judyslot delta)
+{
+judyslot *table, *inner;
+JudyStack *stack;
+uint idx;
+
+	for( idx = 1; idx <= cursor->level; idx++ ) {
+		stack = cursor->stack + idx;
+		table = (judyslot *)judy_addr (cursor, stack->next);
+
+		if( judy_below (table) != JUDY_nocount )
+			judy_below (table) += delta;
+
+		if( (stack->next & 0x07) != JUDY_radix )
+			continue;
+
+		if( (inner = (judyslot *)judy_table (cursor, table[stack->slot >> 4])) )
+		  if( judy_below (inner) != JUDY_nocount )
+			judy_below (inner) += delta;
+	}
+}
+#endif
+
+//	judy_del: delete string from judy array
+//		returning previous entry.
+
+judyslot *judy_del (Judy *judy)
+{
+#ifdef JUDY_COUNTS
+	//	judy_slot finds an empty radix leaf cell for a key
+	//	that was never stored: there is nothing to uncount
+
+	if( judy->counted && judy->cursor->level )
+	  if( judy_load (judy_parent (judy->cursor, judy->cursor->level + 1)) )
+		judy_countpath (judy->cursor, -1);
+#endif
+	return judy_remove (judy, 0);
+}
+
 //	return cell for first key greater than or equal to given key
 
-judyslot *judy_strt (Judy *judy, uchar *buff, uint max)
+judyslot *judy_cstrt (JudyCursor *cursor, uchar *buff, uint max)
 {
-judyslot *cell;
+judyslot *cell, next;
+uchar *base;
+uint off;
+int tst;
 
-	judy->level = 0;
+	cursor->level = 0;
 	
 	if( !max )
-		return judy_first (judy, *judy->root, 0);
+		return judy_first (cursor, judy_load (cursor->root), 0);
+
+	//	an empty leaf cell in a radix node is not a key
 
-	if( (cell = judy_slot (judy, buff, max)) )
+	if( (cell = judy_cslot (cursor, buff, max)) && judy_load (cell) )
 		return cell;
 
-	return judy_nxt (judy);
+	//	a span the key stopped in that sorts after the key
+	//	holds the answer; judy_cnxt would skip past it
+
+	next = cursor->level ? cursor->stack[cursor->level].next : 0;
+
+	if( !cell && (next & 0x07) == JUDY_span ) {
+		off = cursor->stack[cursor->level].off;
+		base = (uchar *)judy_addr (cursor, next);
+		tst = JUDY_span_bytes;
+		if( tst > (int)(max - off) )
+			tst = max - off;
+		if( memcmp (base, buff + off, tst) >= 0 ) {
+			cursor->level--;
+			if( (cell = judy_first (cursor, next, off)) )
+				return cell;
+		}
+	}
+
+	return judy_cnxt (cursor);
+}
+
+//	judy_strt: judy_cstrt on the array's own cursor
+
+judyslot *judy_strt (Judy *judy, uchar *buff, uint max)
+{
+	return judy_cstrt (judy->cursor, buff, max);
 }
 
 //	split open span node
@@ -1035,15 +2642,19 @@ void judy_splitspan (Judy *judy, judyslot *next, uchar *base)
 {
 judyslot *node = (judyslot *)(base + JudySize[JUDY_span]);
 uint cnt = JUDY_span_bytes;
+judyslot head, *link = &head;
 uchar *newbase;
 uint off = 0;
 #if BYTE_ORDER != BIG_ENDIAN
 int i;
 #endif
+judy_timer (began);
+
+	//	build the JUDY_1 chain, then publish it
 
 	do {
-		newbase = judy_alloc (judy, JUDY_1);
-		*next = (judyslot)newbase | JUDY_1;
+		newbase = (uchar *)judy_alloc (judy, JUDY_1);
+		*link = (judyslot)newbase | JUDY_1;
 
 #if BYTE_ORDER != BIG_ENDIAN
 		i = JUDY_key_size;
@@ -1053,37 +2664,46 @@ int i;
 		memcpy (newbase, base + off, JUDY_key_size);
 		newbase += JUDY_key_size;
 #endif
-		next = (judyslot *)newbase;
+		link = (judyslot *)newbase;
 
 		off += JUDY_key_size;
 		cnt -= JUDY_key_size;
 	} while( cnt && base[off - 1] );
 
-	*next = node[-1];
+	*link = node[-1];
+	judy_store (next, head);
 	judy_free (judy, base, JUDY_span);
+	judy_count (judy, spansplits);
+	judy_timed (judy, spancycles, began);
 }
 
-//	judy_cell: add string to judy array
+//	judy_insert: add string to judy array
 
-judyslot *judy_cell (Judy *judy, uchar *buff, uint max)
+judyslot *judy_insert (Judy *judy, uchar *buff, uint max)
 {
 int size, idx, slot, cnt, tst;
 judyslot *next = judy->root;
-judyvalue test, value;
+judyvalue value;
+#if BYTE_ORDER == BIG_ENDIAN
+judyvalue test;
+#endif
 uint off = 0, start;
 judyslot *table;
 judyslot *node;
 uint keysize;
 uchar *base;
 
-	judy->level = 0;
+	judy_reclaim (judy);
+	judy->cursor->keylevel = 0;
+	judy->cursor->level = 0;
 
 	while( *next ) {
-		if( judy->level < judy->max )
-			judy->level++;
+		if( judy->cursor->level < judy->cursor->max )
+			judy->cursor->level++;
 
-		judy->stack[judy->level].off = off;
-		judy->stack[judy->level].next = *next;
+		judy->cursor->stack[judy->cursor->level].off = off;
+		judy->cursor->stack[judy->cursor->level].next = *next;
+		judy_visit (judy->cursor, *next);
 		size = JudySize[*next & 0x07];
 
 		switch( *next & 0x07 ) {
@@ -1098,7 +2718,6 @@ uchar *base;
 			base = (uchar *)(*next & JUDY_mask);
 			node = (judyslot *)((*next & JUDY_mask) + size);
 			start = off;
-			slot = cnt;
 			value = 0;
 
 			do {
@@ -1109,20 +2728,11 @@ uchar *base;
 
 			//  find slot > key
 
-			while( slot-- ) {
-				test = *(judyvalue *)(base + slot * keysize);
-#if BYTE_ORDER == BIG_ENDIAN
-				test >>= 8 * (JUDY_key_size - keysize); 
-#else
-				test &= JudyMask[keysize];
-#endif
-				if( test <= value )
-					break;
-			}
+			slot = judy_search (base, cnt, keysize, value);
 
-			judy->stack[judy->level].slot = slot - 1;
+			judy->cursor->stack[judy->cursor->level].slot = slot;
 
-			if( test == value ) {		// new key is equal to slot key
+			if( slot >= 0 && judy_keyat (base, slot, keysize) == value ) {		// new key is equal to slot key
 				next = &node[-slot-1];
 
 				// is this a leaf?
@@ -1137,6 +2747,17 @@ uchar *base;
 			//	open up cell after slot
 
 			if( !node[-1] ) { // if the entry before node is empty/zero
+#ifdef JUDY_CONCURRENT
+			  //	readers may be in this node: insert into a copy
+
+			  next = judy_shadow (judy, next);
+			  base = (uchar *)judy_alloc (judy, *next & 0x07);
+			  memcpy (base - JUDY_head, (uchar *)(*next & JUDY_mask) - JUDY_head, size + JUDY_head);
+			  judy_free (judy, (uchar *)(*next & JUDY_mask), *next & 0x07);
+			  *next = (judyslot)base | (*next & 0x07);
+			  node = (judyslot *)(base + size);
+			  judy->cursor->stack[judy->cursor->level].next = *next;
+#endif
 		 	  memmove(base, base + keysize, slot * keysize);	// move keys less than new key down one slot
 #if BYTE_ORDER != BIG_ENDIAN
 			  memcpy(base + slot * keysize, &value, keysize);	// copy new key into slot
@@ -1154,16 +2775,19 @@ uchar *base;
 			  next = &node[-slot-1];
 
 			  if( !(value & 0xFF) )
-			  	return next;
+			  	return judy_commit (judy, next);
 
 			  continue;
 			}
 
 			if( size < JudySize[JUDY_max] ) {
+#ifdef JUDY_CONCURRENT
+			  next = judy_shadow (judy, next);
+#endif
 			  next = judy_promote (judy, next, slot+1, value, keysize);
 
 			  if( !(value & 0xFF) )
-				return next;
+				return judy_commit (judy, next);
 
 			  continue;
 			}
@@ -1171,8 +2795,8 @@ uchar *base;
 			//	split full maximal node into JUDY_radix nodes
 			//  loop to reprocess new insert
 
-			judy_splitnode (judy, next, size, keysize);
-			judy->level--;
+			judy_splitnode (judy, next, size, keysize, 0);
+			judy->cursor->level--;
 			off = start;
 			continue;
 		
@@ -1187,10 +2811,10 @@ uchar *base;
 			// allocate inner radix if empty
 
 			if( !table[slot >> 4] )
-				table[slot >> 4] = (judyslot)judy_alloc (judy, JUDY_radix) | JUDY_radix;
+				judy_store (&table[slot >> 4], (judyslot)judy_alloc (judy, JUDY_radix) | JUDY_radix);
 
 			table = (judyslot *)(table[slot >> 4] & JUDY_mask);
-			judy->stack[judy->level].slot = slot;
+			judy->cursor->stack[judy->cursor->level].slot = slot;
 			next = &table[slot & 0x0F];
 
 			if( !slot ) // leaf?
@@ -1206,7 +2830,7 @@ uchar *base;
 			if( tst > (int)(max - off) )
 				tst = max - off;
 
-			value = strncmp((const char *)base, (const char *)(buff + off), tst);
+			value = memcmp (base, buff + off, tst);
 
 			if( !value && tst < cnt && !base[tst] ) // leaf?
 				return &node[-1];
@@ -1221,15 +2845,22 @@ uchar *base;
 			//	then loop to reprocess insert
 
 			judy_splitspan (judy, next, base);
-			judy->level--;
+			judy->cursor->level--;
 			continue;
 		}
 	}
 
+#ifdef JUDY_CONCURRENT
+	//	build the rest of the key out of sight of readers
+
+	if( !judy->publish && off <= max )
+		next = judy_shadow (judy, next);
+#endif
+
 	// place JUDY_1 node under JUDY_radix node(s)
 
 	if( off & JUDY_key_mask && off <= max ) {
-		base = judy_alloc (judy, JUDY_1);
+		base = (uchar *)judy_alloc (judy, JUDY_1);
 		keysize = JUDY_key_size - (off & JUDY_key_mask);
 		node = (judyslot  *)(base + JudySize[JUDY_1]);
 		*next = (judyslot)base | JUDY_1;
@@ -1250,12 +2881,12 @@ uchar *base;
 
 		memcpy (base, buff + off, tst);
 #endif
-		if( judy->level < judy->max )
-			judy->level++;
+		if( judy->cursor->level < judy->cursor->max )
+			judy->cursor->level++;
 
-		judy->stack[judy->level].next = *next;
-		judy->stack[judy->level].slot = 0;
-		judy->stack[judy->level].off = off;
+		judy->cursor->stack[judy->cursor->level].next = *next;
+		judy->cursor->stack[judy->cursor->level].slot = 0;
+		judy->cursor->stack[judy->cursor->level].off = off;
 		next = &node[-1];
 		off |= JUDY_key_mask;
 		off++;
@@ -1264,7 +2895,7 @@ uchar *base;
 	//	produce span nodes to consume rest of key
 
 	while( off <= max ) {
-		base = judy_alloc (judy, JUDY_span);
+		base = (uchar *)judy_alloc (judy, JUDY_span);
 		*next = (judyslot)base | JUDY_span;
 		node = (judyslot  *)(base + JudySize[JUDY_span]);
 		cnt = tst = JUDY_span_bytes;
@@ -1272,31 +2903,4142 @@ uchar *base;
 			tst = max - off;
 		memcpy (base, buff + off, tst);
 
-		if( judy->level < judy->max )
-			judy->level++;
+		if( judy->cursor->level < judy->cursor->max )
+			judy->cursor->level++;
 
-		judy->stack[judy->level].next = *next;
-		judy->stack[judy->level].slot = 0;
-		judy->stack[judy->level].off = off;
+		judy->cursor->stack[judy->cursor->level].next = *next;
+		judy->cursor->stack[judy->cursor->level].slot = 0;
+		judy->cursor->stack[judy->cursor->level].off = off;
 
 		next = &node[-1];
 		off += tst;
 		if( !base[cnt-1] )	// done on leaf
 			break;
 	}
-	return next;
+	return judy_commit (judy, next);
 }
 
-#ifdef STANDALONE
-int main (int argc, char **argv)
+//	judy_cell: judy_insert, counting a new key on its path
+//	with JUDY_COUNTS once judy_rank or judy_select have summed
+//	the counts; until then the new nodes are simply uncounted
+
+judyslot *judy_cell (Judy *judy, uchar *buff, uint max)
 {
-uchar buff[1024];
-judyslot max = 0;
-judyslot *cell;
-FILE *in, *out;
-void *judy;
-uint len;
-uint idx;
+judyslot *cell = judy_insert (judy, buff, max);
+
+#ifdef JUDY_COUNTS
+	//	a new key is the one with an empty cell, and
+	//	judy_insert leaves the cursor on its path
+
+	if( judy->counted && cell && !judy_load (cell) )
+		judy_countpath (judy->cursor, 1);
+#endif
+	return cell;
+}
+
+//	judy_cell_set: judy_cell, then store value in the cell with a
+//	release store, for JUDY_CONCURRENT readers using judy_load
+
+judyslot *judy_cell_set (Judy *judy, uchar *buff, uint max, judyslot value)
+{
+judyslot *cell = judy_cell (judy, buff, max);
+
+	if( cell )
+		judy_store (cell, value);
+
+	return cell;
+}
+
+//	binary keys: a zero byte would end a key early, so
+//	judy_escape writes 0x00 as 0x01 0x01 and 0x01 as
+//	0x01 0x02, leaving other bytes alone.  Escaped keys
+//	sort as the original bytes do, so judy_nxt, judy_prv,
+//	judy_end and judy_del walk them in order.
+
+//	judy_keybuff: grow the cursor's binary key buffer
+
+uchar *judy_keybuff (JudyCursor *cursor, uint amt)
+{
+uchar *key;
+
+	if( cursor->bkeymax < amt ) {
+		if( !(key = (uchar *)realloc (cursor->bkey, amt)) )
+			return NULL;
+		cursor->bkey = key;
+		cursor->bkeymax = amt;
+	}
+
+	return cursor->bkey;
+}
+
+//	judy_escape: encode max bytes of buff into the
+//	cursor's key buffer, returning its length in *len
+
+uchar *judy_escape (JudyCursor *cursor, uchar *buff, uint max, uint *len)
+{
+uint idx, amt = 0;
+uchar *key;
+
+	if( !(key = judy_keybuff (cursor, 2 * max + 1)) )
+		return NULL;
+
+	for( idx = 0; idx < max; idx++ )
+	  if( buff[idx] > 0x01 )
+		key[amt++] = buff[idx];
+	  else
+		key[amt++] = 0x01, key[amt++] = buff[idx] + 1;
+
+	*len = amt;
+	return key;
+}
+
+//	judy_cbkey: judy_ckey for a binary key, decoding the
+//	escapes.  Returns the length, which may count zeros.
+
+uint judy_cbkey (JudyCursor *cursor, uchar *buff, uint max)
+{
+uint idx = 0, len = 0;
+uchar *key;
+
+	if( !max )
+		return 0;
+
+	if( !(key = judy_keybuff (cursor, 2 * max)) ) {
+		buff[0] = 0;
+		return 0;
+	}
+
+	judy_ckey (cursor, key, 2 * max);
+	max--;		// leave room for zero terminator
+
+	while( len < max && key[idx] )
+	  if( key[idx] > 0x01 )
+		buff[len++] = key[idx++];
+	  else if( key[idx + 1] )
+		buff[len++] = key[idx + 1] - 1, idx += 2;
+	  else
+		break;
+
+	buff[len] = 0;
+	return len;
+}
+
+//	judy_cbslot, judy_cbstrt: judy_cslot and judy_cstrt
+//	for a binary key
+
+judyslot *judy_cbslot (JudyCursor *cursor, uchar *buff, uint max)
+{
+uchar *key;
+uint len;
+
+	if( !(key = judy_escape (cursor, buff, max, &len)) )
+		return NULL;
+
+	return judy_cslot (cursor, key, len);
+}
+
+judyslot *judy_cbstrt (JudyCursor *cursor, uchar *buff, uint max)
+{
+uchar *key;
+uint len;
+
+	if( !(key = judy_escape (cursor, buff, max, &len)) )
+		return NULL;
+
+	return judy_cstrt (cursor, key, len);
+}
+
+//	judy_bcell, judy_bslot, judy_bstrt, judy_bkey:
+//	the binary key calls on the array's own cursor
+
+judyslot *judy_bcell (Judy *judy, uchar *buff, uint max)
+{
+uchar *key;
+uint len;
+
+	if( !(key = judy_escape (judy->cursor, buff, max, &len)) )
+		return NULL;
+
+	return judy_cell (judy, key, len);
+}
+
+judyslot *judy_bslot (Judy *judy, uchar *buff, uint max)
+{
+	return judy_cbslot (judy->cursor, buff, max);
+}
+
+judyslot *judy_bstrt (Judy *judy, uchar *buff, uint max)
+{
+	return judy_cbstrt (judy->cursor, buff, max);
+}
+
+uint judy_bkey (Judy *judy, uchar *buff, uint max)
+{
+	return judy_cbkey (judy->cursor, buff, max);
+}
+
+//	judy_children: the distinct bytes that follow a prefix,
+//	read from the nodes reached by one descent.  A JudyChild
+//	marks a place in the array between two key bytes, so a
+//	trie walk can go on from a child without descending from
+//	the root again.  Places hold node addresses and are only
+//	good until the array is next changed.
+
+typedef struct {
+	judyslot next;		// node holding the next key byte, or zero
+	judyvalue value;	// linear node key bytes matched so far
+	uint off;			// key offset of that node
+	uint depth;			// key bytes matched
+} JudyChild;
+
+//	judy_childstep: move a place on past one key byte,
+//	returning zero if no key continues with it
+
+int judy_childstep (Judy *judy, JudyChild *at, uchar ch)
+{
+JudyCursor *cursor = judy->cursor;
+int slot, cnt, size, keysize, idx, shift;
+judyslot *table, *node;
+judyvalue key, want;
+uchar *base;
+
+	if( !at->next || !ch )
+		return 0;
+
+	base = (uchar *)judy_addr (cursor, at->next);
+	size = JudySize[at->next & 0x07];
+	idx = at->depth - at->off;
+
+	switch( at->next & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+		keysize = JUDY_key_size - (at->off & JUDY_key_mask);
+		node = (judyslot *)(base + size);
+		cnt = size / (sizeof(judyslot) + keysize);
+		shift = 8 * (keysize - idx - 1);
+		want = at->value | (judyvalue)ch << shift;
+
+		//	keys ascend by slot, empty slots holding zero
+
+		for( slot = 0; slot < cnt; slot++ ) {
+			key = judy_keyat (base, slot, keysize);
+			if( key >> shift == want >> shift )
+				break;
+			if( key >> shift > want >> shift )
+				return 0;
+		}
+
+		if( slot == cnt )
+			return 0;
+
+		at->depth++;
+
+		if( idx + 1 < keysize ) {
+			at->value = want;
+			return 1;
+		}
+
+		at->next = judy_load (&node[-slot-1]);
+		at->off += keysize;
+		at->value = 0;
+		return 1;
+
+	case JUDY_radix:
+		table = (judyslot *)base;
+
+		if( !(table = (judyslot *)judy_table (cursor, judy_load (&table[ch >> 4]))) )
+			return 0;
+
+		if( !(at->next = judy_load (&table[ch & 0x0F])) )
+			return 0;
+
+		at->off++;
+		at->depth++;
+		return 1;
+
+	case JUDY_span:
+		if( base[idx] != ch )
+			return 0;
+
+		if( ++at->depth - at->off < JUDY_span_bytes )
+			return 1;
+
+		node = (judyslot *)(base + size);
+		at->next = judy_load (&node[-1]);
+		at->off += JUDY_span_bytes;
+		return 1;
+	}
+
+	return 0;
+}
+
+//	judy_children_at: descend from a place past the max
+//	bytes of buff, then store the distinct bytes that follow
+//	in ascending order in bytes[256] and, unless children is
+//	NULL, the place after each one.  Returns their count;
+//	the zero byte that ends a key is not counted.
+
+uint judy_children_at (Judy *judy, JudyChild *from, uchar *buff, uint max, uchar *bytes, JudyChild *children)
+{
+JudyCursor *cursor = judy->cursor;
+int slot, cnt, size, keysize, idx, shift;
+judyslot *table, *inner, *node;
+JudyChild at[1];
+uint count = 0;
+judyslot next;
+judyvalue key;
+uchar *base;
+uchar ch;
+
+	*at = *from;
+
+	for( idx = 0; idx < (int)max; idx++ )
+		if( !judy_childstep (judy, at, buff[idx]) )
+			return 0;
+
+	if( !at->next )
+		return 0;
+
+	base = (uchar *)judy_addr (cursor, at->next);
+	size = JudySize[at->next & 0x07];
+	idx = at->depth - at->off;
+
+	switch( at->next & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+		keysize = JUDY_key_size - (at->off & JUDY_key_mask);
+		node = (judyslot *)(base + size);
+		cnt = size / (sizeof(judyslot) + keysize);
+		shift = 8 * (keysize - idx - 1);
+
+		for( slot = 0; slot < cnt; slot++ ) {
+			key = judy_keyat (base, slot, keysize);
+			if( idx && key >> shift >> 8 != at->value >> shift >> 8 )
+				continue;
+			if( !(ch = key >> shift) || (count && bytes[count - 1] == ch) )
+				continue;
+
+			if( children ) {
+				children[count] = *at;
+				children[count].depth++;
+				if( idx + 1 < keysize )
+					children[count].value |= (judyvalue)ch << shift;
+				else {
+					children[count].next = judy_load (&node[-slot-1]);
+					children[count].off += keysize;
+					children[count].value = 0;
+				}
+			}
+
+			bytes[count++] = ch;
+		}
+
+		return count;
+
+	case JUDY_radix:
+		table = (judyslot *)base;
+
+		for( slot = 1; slot < 256; slot++ )
+		  if( (inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) ) {
+			if( !(next = judy_load (&inner[slot & 0x0F])) )
+				continue;
+
+			if( children ) {
+				children[count] = *at;
+				children[count].next = next;
+				children[count].off++;
+				children[count].depth++;
+			}
+
+			bytes[count++] = slot;
+		  } else
+			slot |= 0x0F;
+
+		return count;
+
+	case JUDY_span:
+		if( !(bytes[0] = base[idx]) )
+			return 0;
+
+		if( children ) {
+			children[0] = *at;
+			judy_childstep (judy, children, base[idx]);
+		}
+
+		return 1;
+	}
+
+	return 0;
+}
+
+//	judy_children: judy_children_at from the root
+
+uint judy_children (Judy *judy, uchar *buff, uint max, uchar *bytes, JudyChild *children)
+{
+JudyChild root[1];
+
+	memset (root, 0, sizeof(root));
+	root->next = judy_load (judy->root);
+
+	return judy_children_at (judy, root, buff, max, bytes, children);
+}
+
+//	judy_child_cell: the cell of the key that ends at a
+//	place, or NULL if no key ends there
+
+judyslot *judy_child_cell (Judy *judy, JudyChild *at)
+{
+JudyCursor *cursor = judy->cursor;
+int slot, cnt, size, keysize;
+judyslot *table, *node;
+uchar *base;
+
+	if( !at->next )
+		return NULL;
+
+	base = (uchar *)judy_addr (cursor, at->next);
+	size = JudySize[at->next & 0x07];
+
+	switch( at->next & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+		//	the leaf holds the matched bytes and zeros
+
+		keysize = JUDY_key_size - (at->off & JUDY_key_mask);
+		node = (judyslot *)(base + size);
+		cnt = size / (sizeof(judyslot) + keysize);
+		slot = judy_search (base, cnt, keysize, at->value);
+
+		if( slot >= 0 && judy_keyat (base, slot, keysize) == at->value && judy_load (&node[-slot-1]) )
+			return &node[-slot-1];
+
+		return NULL;
+
+	case JUDY_radix:
+		table = (judyslot *)base;
+
+		if( (table = (judyslot *)judy_table (cursor, judy_load (&table[0]))) && judy_load (&table[0]) )
+			return &table[0];
+
+		return NULL;
+
+	case JUDY_span:
+		node = (judyslot *)(base + size);
+
+		if( !base[at->depth - at->off] )
+			return &node[-1];
+
+		return NULL;
+	}
+
+	return NULL;
+}
+
+#ifdef JUDY_COUNTS
+//	judy_total: the keys below a node, summing the
+//	children of nodes without a count and saving the
+//	result, except in a mapped image, which is only read
+
+judyslot judy_inner (JudyCursor *cursor, judyslot *inner, int high, uint off);
+
+judyslot judy_total (JudyCursor *cursor, judyslot next, uint off)
+{
+judyslot *table, *inner, *node, total = 0;
+int slot, cnt, size, keysize;
+uchar *base;
+
+	if( !next )
+		return 0;
+
+	base = (uchar *)judy_addr (cursor, next);
+
+	if( judy_below (base) != JUDY_nocount )
+		return judy_below (base);
+
+	size = JudySize[next & 0x07];
+
+	switch( next & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		node = (judyslot *)(base + size);
+		cnt = size / (sizeof(judyslot) + keysize);
+
+		for( slot = 0; slot < cnt; slot++ )
+		  if( !node[-slot-1] )
+			continue;
+		  else if( judy_keyat (base, slot, keysize) & 0xFF )
+			total += judy_total (cursor, node[-slot-1], (off | JUDY_key_mask) + 1);
+		  else
+			total++;
+		break;
+
+	case JUDY_radix:
+		table = (judyslot *)base;
+
+		for( slot = 0; slot < 16; slot++ )
+		  if( (inner = (judyslot *)judy_table (cursor, table[slot])) )
+			total += judy_inner (cursor, inner, slot, off);
+		break;
+
+	case JUDY_span:
+		node = (judyslot *)(base + size);
+
+		if( base[JUDY_span_bytes - 1] )
+			total = judy_total (cursor, node[-1], off + JUDY_span_bytes);
+		else
+			total = node[-1] != 0;
+		break;
+	}
+
+	if( !cursor->base )
+		judy_below (base) = total;
+
+	return total;
+}
+
+//	judy_inner: judy_total for the inner radix table
+//	holding slots high * 16 through high * 16 + 15
+
+judyslot judy_inner (JudyCursor *cursor, judyslot *inner, int high, uint off)
+{
+judyslot total = 0;
+int slot;
+
+	if( judy_below (inner) != JUDY_nocount )
+		return judy_below (inner);
+
+	for( slot = 0; slot < 16; slot++ )
+	  if( high || slot )
+		total += judy_total (cursor, inner[slot], off + 1);
+	  else
+		total += inner[0] != 0;		// leaf cell
+
+	if( !cursor->base )
+		judy_below (inner) = total;
+
+	return total;
+}
+
+//	judy_rank: the number of keys before the given key,
+//	which need not be in the array
+
+judyslot judy_rank (Judy *judy, uchar *buff, uint max)
+{
+JudyCursor *cursor = judy->cursor;
+judyslot next = *judy->root, rank = 0;
+judyslot *table, *inner, *node;
+int slot, cnt, size, keysize, tst;
+judyvalue value, key = 0;
+uint off = 0, ch;
+uchar *base;
+
+	judy->counted = 1;
+
+	while( next ) {
+		base = (uchar *)judy_addr (cursor, next);
+		size = JudySize[next & 0x07];
+
+		switch( next & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+			keysize = JUDY_key_size - (off & JUDY_key_mask);
+			node = (judyslot *)(base + size);
+			cnt = size / (sizeof(judyslot) + keysize);
+			value = 0;
+
+			do {
+				value <<= 8;
+				if( off < max )
+					value |= buff[off];
+			} while( ++off & JUDY_key_mask );
+
+			//	count the slots below the key's
+
+			for( slot = 0; slot < cnt; slot++ ) {
+				if( !node[-slot-1] )
+					continue;
+				if( (key = judy_keyat (base, slot, keysize)) >= value )
+					break;
+				rank += key & 0xFF ? judy_total (cursor, node[-slot-1], off) : 1;
+			}
+
+			if( slot == cnt || key != value || !(value & 0xFF) )
+				return rank;
+
+			next = node[-slot-1];
+			continue;
+
+		case JUDY_radix:
+			table = (judyslot *)base;
+			ch = off < max ? buff[off] : 0;
+
+			for( slot = 0; slot < (int)(ch >> 4); slot++ )
+			  if( (inner = (judyslot *)judy_table (cursor, table[slot])) )
+				rank += judy_inner (cursor, inner, slot, off);
+
+			if( !(inner = (judyslot *)judy_table (cursor, table[ch >> 4])) )
+				return rank;
+
+			for( slot = ch & 0xF0; slot < (int)ch; slot++ )
+			  if( slot )
+				rank += judy_total (cursor, inner[slot & 0x0F], off + 1);
+			  else
+				rank += inner[0] != 0;
+
+			if( !ch )
+				return rank;
+
+			next = inner[ch & 0x0F];
+			off++;
+			continue;
+
+		case JUDY_span:
+			node = (judyslot *)(base + size);
+			tst = JUDY_span_bytes;
+			if( tst > (int)(max - off) )
+				tst = max - off;
+
+			//	the whole span is below the key, or none of it
+
+			if( (cnt = memcmp (base, buff + off, tst)) < 0 )
+				return rank + judy_total (cursor, next, off);
+
+			if( cnt || tst < JUDY_span_bytes || !base[JUDY_span_bytes - 1] )
+				return rank;
+
+			next = node[-1];
+			off += JUDY_span_bytes;
+			continue;
+		}
+	}
+
+	return rank;
+}
+
+//	judy_select: return the cell for the key with the given
+//	rank, counting from zero, and leave the cursor on it for
+//	judy_key and judy_nxt; NULL if there are not that many
+
+judyslot *judy_select (Judy *judy, judyslot rank)
+{
+JudyCursor *cursor = judy->cursor;
+judyslot next = judy_load (judy->root);
+judyslot *table, *inner, *node;
+int slot, cnt, size, keysize;
+judyslot total = 0;
+uint off = 0;
+uchar *base;
+
+	judy->counted = 1;
+	cursor->level = 0;
+
+	while( next ) {
+		if( cursor->level < cursor->max )
+			cursor->level++;
+
+		cursor->stack[cursor->level].off = off;
+		cursor->stack[cursor->level].next = next;
+		base = (uchar *)judy_addr (cursor, next);
+		size = JudySize[next & 0x07];
+
+		switch( next & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+			keysize = JUDY_key_size - (off & JUDY_key_mask);
+			node = (judyslot *)(base + size);
+			cnt = size / (sizeof(judyslot) + keysize);
+			off = (off | JUDY_key_mask) + 1;
+
+			for( slot = 0; slot < cnt; slot++ ) {
+				if( !node[-slot-1] )
+					continue;
+				if( judy_keyat (base, slot, keysize) & 0xFF )
+					total = judy_total (cursor, node[-slot-1], off);
+				else if( rank )		// leaf
+					total = 1;
+				else
+					break;
+				if( rank < total )
+					break;
+				rank -= total;
+			}
+
+			if( slot == cnt )
+				return NULL;
+
+			cursor->stack[cursor->level].slot = slot;
+
+			if( !(judy_keyat (base, slot, keysize) & 0xFF) )
+				return &node[-slot-1];
+
+			next = node[-slot-1];
+			continue;
+
+		case JUDY_radix:
+			table = (judyslot *)base;
+
+			for( slot = 0; slot < 16; slot++ )
+			  if( (inner = (judyslot *)judy_table (cursor, table[slot])) ) {
+				if( rank < (total = judy_inner (cursor, inner, slot, off)) )
+					break;
+				rank -= total;
+			  }
+
+			if( slot == 16 )
+				return NULL;
+
+			inner = (judyslot *)judy_table (cursor, table[slot]);
+
+			for( slot <<= 4, cnt = slot + 16; slot < cnt; slot++ ) {
+				total = slot ? judy_total (cursor, inner[slot & 0x0F], off + 1) : inner[0] != 0;
+				if( rank < total )
+					break;
+				rank -= total;
+			}
+
+			if( slot == cnt )
+				return NULL;
+
+			cursor->stack[cursor->level].slot = slot;
+
+			if( !slot )
+				return &inner[0];
+
+			next = inner[slot & 0x0F];
+			off++;
+			continue;
+
+		case JUDY_span:
+			node = (judyslot *)(base + size);
+			cursor->stack[cursor->level].slot = 0;
+
+			if( !base[JUDY_span_bytes - 1] )
+				return rank ? NULL : &node[-1];
+
+			next = node[-1];
+			off += JUDY_span_bytes;
+			continue;
+		}
+	}
+
+	return NULL;
+}
+
+//	judy_count_range: the number of keys from lo through hi
+
+judyslot judy_count_range (Judy *judy, uchar *lo, uint lomax, uchar *hi, uint himax)
+{
+judyslot below = judy_rank (judy, lo, lomax);
+judyslot upto = judy_rank (judy, hi, himax);
+judyslot *cell;
+
+	if( (cell = judy_slot (judy, hi, himax)) && judy_load (cell) )
+		upto++;
+
+	return upto > below ? upto - below : 0;
+}
+#endif
+
+//	judyL: arrays keyed by judyvalue integers.  An index is
+//	stored as its JUDY_key_size bytes, most significant first,
+//	in the string nodes: every linear slot is a leaf, a radix
+//	node at the last byte holds leaves, and neither a zero
+//	terminator nor a span is needed.  Indexes iterate in numeric
+//	order.  Open the array with at least JUDY_key_size stack
+//	levels, and use only the judyL calls, judy_stats and
+//	judy_close on it.
+
+#define judyL_byte(index, off)	((uint)((index) >> 8 * (JUDY_key_size - 1 - (off))) & 0xFF)
+
+//	judyL_cslot: find the cell for an index & setup cursor
+
+judyslot *judyL_cslot (JudyCursor *cursor, judyvalue index)
+{
+judyslot next = judy_load (cursor->root);
+int slot, size, keysize;
+judyslot *table, *node;
+judyvalue value;
+uint off = 0;
+uchar *base;
+
+	cursor->level = 0;
+
+	while( next ) {
+		if( cursor->level < cursor->max )
+			cursor->level++;
+
+		cursor->stack[cursor->level].off = off;
+		cursor->stack[cursor->level].next = next;
+		judy_visit (cursor, next);
+		size = JudySize[next & 0x07];
+
+		switch( next & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+			base = (uchar *)judy_addr (cursor, next);
+			node = (judyslot *)(base + size);
+			keysize = JUDY_key_size - off;
+			value = index & JudyMask[keysize];
+
+			slot = judy_search (base, size / (sizeof(judyslot) + keysize), keysize, value);
+			cursor->stack[cursor->level].slot = slot;
+
+			if( slot >= 0 && judy_keyat (base, slot, keysize) == value )
+				return &node[-slot-1];
+
+			return NULL;
+
+		case JUDY_radix:
+			table = (judyslot *)judy_addr (cursor, next);
+			slot = judyL_byte (index, off);
+			cursor->stack[cursor->level].slot = slot;
+
+			if( !(table = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) )
+				return NULL;
+
+			if( off == JUDY_key_size - 1 )	// leaf?
+				return &table[slot & 0x0F];
+
+			next = judy_load (&table[slot & 0x0F]);
+			off++;
+			continue;
+
+		default:
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+//	judyL_ckey: return the index at the cursor
+
+judyvalue judyL_ckey (JudyCursor *cursor)
+{
+judyvalue index = 0;
+JudyStack *stack;
+uint idx, keysize;
+
+	for( idx = 1; idx <= cursor->level; idx++ ) {
+		stack = cursor->stack + idx;
+
+		if( (stack->next & 0x07) == JUDY_radix ) {
+			index = index << 8 | stack->slot;
+			continue;
+		}
+
+		keysize = JUDY_key_size - stack->off;
+
+		if( stack->off )
+			index <<= 8 * keysize;
+
+		index |= judy_keyat ((uchar *)judy_addr (cursor, stack->next), stack->slot, keysize);
+	}
+
+	return index;
+}
+
+//	judyL_low: return first leaf under a node
+
+judyslot *judyL_low (JudyCursor *cursor, judyslot next, uint off)
+{
+judyslot *table, *inner, *node;
+int slot, size, cnt;
+
+	while( next ) {
+		if( cursor->level < cursor->max )
+			cursor->level++;
+
+		cursor->stack[cursor->level].off = off;
+		cursor->stack[cursor->level].next = next;
+		size = JudySize[next & 0x07];
+
+		switch( next & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+			node = (judyslot *)(judy_addr (cursor, next) + size);
+			cnt = size / (sizeof(judyslot) + JUDY_key_size - off);
+
+			for( slot = 0; slot < cnt; slot++ )
+				if( judy_load (&node[-slot-1]) )
+					break;
+
+			cursor->stack[cursor->level].slot = slot;
+			return slot < cnt ? &node[-slot-1] : NULL;
+
+		case JUDY_radix:
+			table = (judyslot *)judy_addr (cursor, next);
+
+			for( slot = 0; slot < 256; slot++ ) {
+				cursor->stack[cursor->level].slot = slot;
+
+				if( !(inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) )
+					slot |= 0x0F;
+				else if( (next = judy_load (&inner[slot & 0x0F])) )
+					break;
+			}
+
+			if( slot == 256 )	// no cells set yet
+				return NULL;
+
+			if( off == JUDY_key_size - 1 )
+				return &inner[slot & 0x0F];
+
+			off++;
+			continue;
+
+		default:
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+//	judyL_high: return last leaf under a node
+
+judyslot *judyL_high (JudyCursor *cursor, judyslot next, uint off)
+{
+judyslot *table, *inner, *node;
+int slot, size;
+
+	while( next ) {
+		if( cursor->level < cursor->max )
+			cursor->level++;
+
+		cursor->stack[cursor->level].off = off;
+		cursor->stack[cursor->level].next = next;
+		size = JudySize[next & 0x07];
+
+		switch( next & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+			node = (judyslot *)(judy_addr (cursor, next) + size);
+			slot = size / (sizeof(judyslot) + JUDY_key_size - off);
+
+			while( slot-- )
+				if( judy_load (&node[-slot-1]) )
+					break;
+
+			cursor->stack[cursor->level].slot = slot;
+			return slot >= 0 ? &node[-slot-1] : NULL;
+
+		case JUDY_radix:
+			table = (judyslot *)judy_addr (cursor, next);
+
+			for( slot = 256; slot--; ) {
+				cursor->stack[cursor->level].slot = slot;
+
+				if( !(inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) )
+					slot &= 0xF0;
+				else if( (next = judy_load (&inner[slot & 0x0F])) )
+					break;
+			}
+
+			if( slot < 0 )	// no cells set yet
+				return NULL;
+
+			if( off == JUDY_key_size - 1 )
+				return &inner[slot & 0x0F];
+
+			off++;
+			continue;
+
+		default:
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+//	judyL_cnxt: return next entry
+
+judyslot *judyL_cnxt (JudyCursor *cursor)
+{
+judyslot *table, *inner, *node, *cell;
+judyslot next;
+int slot, cnt;
+uint off;
+
+	if( !cursor->level )
+		return judyL_low (cursor, judy_load (cursor->root), 0);
+
+	while( cursor->level ) {
+		next = cursor->stack[cursor->level].next;
+		slot = cursor->stack[cursor->level].slot;
+		off = cursor->stack[cursor->level].off;
+
+		if( (next & 0x07) != JUDY_radix ) {
+			node = (judyslot *)(judy_addr (cursor, next) + JudySize[next & 0x07]);
+			cnt = JudySize[next & 0x07] / (sizeof(judyslot) + JUDY_key_size - off);
+
+			while( ++slot < cnt )
+				if( judy_load (&node[-slot-1]) ) {
+					cursor->stack[cursor->level].slot = slot;
+					return &node[-slot-1];
+				}
+
+			cursor->level--;
+			continue;
+		}
+
+		table = (judyslot *)judy_addr (cursor, next);
+
+		while( ++slot < 256 )
+		  if( (inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) ) {
+			if( (next = judy_load (&inner[slot & 0x0F])) ) {
+			  cursor->stack[cursor->level].slot = slot;
+			  if( off == JUDY_key_size - 1 )
+				return &inner[slot & 0x0F];
+			  if( (cell = judyL_low (cursor, next, off + 1)) )
+				return cell;
+			  break;
+			}
+		  } else
+			slot |= 0x0F;
+
+		if( slot < 256 )	// nothing set below, resume there
+			continue;
+
+		cursor->level--;
+	}
+
+	return NULL;
+}
+
+//	judyL_cprv: return previous entry
+
+judyslot *judyL_cprv (JudyCursor *cursor)
+{
+judyslot *table, *inner, *node, *cell;
+judyslot next;
+int slot;
+uint off;
+
+	if( !cursor->level )
+		return judyL_high (cursor, judy_load (cursor->root), 0);
+
+	while( cursor->level ) {
+		next = cursor->stack[cursor->level].next;
+		slot = cursor->stack[cursor->level].slot;
+		off = cursor->stack[cursor->level].off;
+
+		if( (next & 0x07) != JUDY_radix ) {
+			node = (judyslot *)(judy_addr (cursor, next) + JudySize[next & 0x07]);
+
+			while( --slot >= 0 )
+				if( judy_load (&node[-slot-1]) ) {
+					cursor->stack[cursor->level].slot = slot;
+					return &node[-slot-1];
+				}
+
+			cursor->level--;
+			continue;
+		}
+
+		table = (judyslot *)judy_addr (cursor, next);
+
+		while( --slot >= 0 )
+		  if( (inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) ) {
+			if( (next = judy_load (&inner[slot & 0x0F])) ) {
+			  cursor->stack[cursor->level].slot = slot;
+			  if( off == JUDY_key_size - 1 )
+				return &inner[slot & 0x0F];
+			  if( (cell = judyL_high (cursor, next, off + 1)) )
+				return cell;
+			  break;
+			}
+		  } else
+			slot &= 0xF0;
+
+		if( slot >= 0 )	// nothing set below, resume there
+			continue;
+
+		cursor->level--;
+	}
+
+	return NULL;
+}
+
+//	judyL_get: return the cell for an index, or NULL if
+//	it is not set
+
+judyslot *judyL_get (Judy *judy, judyvalue index)
+{
+judyslot *cell = judyL_cslot (judy->cursor, index);
+
+	if( cell && judy_load (cell) )
+		return cell;
+
+	return NULL;
+}
+
+//	judyL_first: return the cell for the first index at or
+//	after *index, storing that index in *index
+
+judyslot *judyL_first (Judy *judy, judyvalue *index)
+{
+judyslot *cell = judyL_cslot (judy->cursor, *index);
+
+	if( !cell || !judy_load (cell) )
+		cell = judyL_cnxt (judy->cursor);
+
+	if( cell )
+		*index = judyL_ckey (judy->cursor);
+
+	return cell;
+}
+
+//	judyL_last: return the cell for the last index at or
+//	before *index, storing that index in *index
+
+judyslot *judyL_last (Judy *judy, judyvalue *index)
+{
+JudyCursor *cursor = judy->cursor;
+judyslot *cell = judyL_cslot (cursor, *index);
+
+	if( !cell || !judy_load (cell) ) {
+		//	a miss in a linear node leaves the cursor on
+		//	the key below, which judyL_cprv would skip
+
+		if( !cell && cursor->level && (cursor->stack[cursor->level].next & 0x07) != JUDY_radix )
+			cursor->stack[cursor->level].slot++;
+
+		cell = judyL_cprv (cursor);
+	}
+
+	if( cell )
+		*index = judyL_ckey (cursor);
+
+	return cell;
+}
+
+//	judyL_next: continue the walk from the most recent judyL
+//	query, storing the index found in *index
+
+judyslot *judyL_next (Judy *judy, judyvalue *index)
+{
+judyslot *cell = judyL_cnxt (judy->cursor);
+
+	if( cell )
+		*index = judyL_ckey (judy->cursor);
+
+	return cell;
+}
+
+//	judyL_prev: judyL_next in the other direction
+
+judyslot *judyL_prev (Judy *judy, judyvalue *index)
+{
+judyslot *cell = judyL_cprv (judy->cursor);
+
+	if( cell )
+		*index = judyL_ckey (judy->cursor);
+
+	return cell;
+}
+
+//	judyL_ins: insert an index, returning its cell
+
+judyslot *judyL_ins (Judy *judy, judyvalue index)
+{
+judyslot *next = judy->root;
+int slot, size, cnt, idx;
+judyslot *table, *node;
+judyvalue value;
+uint keysize;
+uint off = 0;
+uchar *base;
+
+	judy_reclaim (judy);
+	judy->cursor->keylevel = 0;
+	judy->cursor->level = 0;
+
+	while( *next ) {
+		if( judy->cursor->level < judy->cursor->max )
+			judy->cursor->level++;
+
+		judy->cursor->stack[judy->cursor->level].off = off;
+		judy->cursor->stack[judy->cursor->level].next = *next;
+		judy_visit (judy->cursor, *next);
+		size = JudySize[*next & 0x07];
+
+		switch( *next & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+			keysize = JUDY_key_size - off;
+			cnt = size / (sizeof(judyslot) + keysize);
+			base = (uchar *)(*next & JUDY_mask);
+			node = (judyslot *)(base + size);
+			value = index & JudyMask[keysize];
+
+			slot = judy_search (base, cnt, keysize, value);
+			judy->cursor->stack[judy->cursor->level].slot = slot;
+
+			if( slot >= 0 && judy_keyat (base, slot, keysize) == value )
+				return &node[-slot-1];
+
+			//	if this node is not full
+			//	open up cell after slot
+
+			if( !node[-1] ) {
+#ifdef JUDY_CONCURRENT
+			  //	readers may be in this node: insert into a copy
+
+			  next = judy_shadow (judy, next);
+			  base = (uchar *)judy_alloc (judy, *next & 0x07);
+			  memcpy (base - JUDY_head, (uchar *)(*next & JUDY_mask) - JUDY_head, size + JUDY_head);
+			  judy_free (judy, (uchar *)(*next & JUDY_mask), *next & 0x07);
+			  *next = (judyslot)base | (*next & 0x07);
+			  node = (judyslot *)(base + size);
+			  judy->cursor->stack[judy->cursor->level].next = *next;
+#endif
+			  memmove(base, base + keysize, slot * keysize);	// move keys less than new key down one slot
+			  judy_setkey (base, slot, keysize, value);
+
+			  for( idx = 0; idx < slot; idx++ )
+				node[-idx-1] = node[-idx-2];	// copy tree ptrs/cells down one slot
+
+			  node[-slot-1] = 0;			// set new cell
+			  return judy_commit (judy, &node[-slot-1]);
+			}
+
+			if( size < JudySize[JUDY_max] ) {
+#ifdef JUDY_CONCURRENT
+			  next = judy_shadow (judy, next);
+#endif
+			  return judy_commit (judy, judy_promote (judy, next, slot+1, value, keysize));
+			}
+
+			//	split full maximal node into JUDY_radix nodes
+			//  loop to reprocess new insert
+
+			judy_splitnode (judy, next, size, keysize, 1);
+			judy->cursor->level--;
+			continue;
+
+		case JUDY_radix:
+			table = (judyslot *)(*next & JUDY_mask); // outer radix
+			slot = judyL_byte (index, off);
+
+			// allocate inner radix if empty
+
+			if( !table[slot >> 4] )
+				judy_store (&table[slot >> 4], (judyslot)judy_alloc (judy, JUDY_radix) | JUDY_radix);
+
+			table = (judyslot *)(table[slot >> 4] & JUDY_mask);
+			judy->cursor->stack[judy->cursor->level].slot = slot;
+			next = &table[slot & 0x0F];
+
+			if( off++ == JUDY_key_size - 1 )	// leaf?
+				return next;
+			continue;
+		}
+	}
+
+	//	place the rest of the index in a JUDY_1 node
+
+#ifdef JUDY_CONCURRENT
+	next = judy_shadow (judy, next);
+#endif
+	keysize = JUDY_key_size - off;
+	base = (uchar *)judy_alloc (judy, JUDY_1);
+	node = (judyslot *)(base + JudySize[JUDY_1]);
+	judy_setkey (base, 0, keysize, index & JudyMask[keysize]);
+	*next = (judyslot)base | JUDY_1;
+
+	if( judy->cursor->level < judy->cursor->max )
+		judy->cursor->level++;
+
+	judy->cursor->stack[judy->cursor->level].next = *next;
+	judy->cursor->stack[judy->cursor->level].slot = 0;
+	judy->cursor->stack[judy->cursor->level].off = off;
+	return judy_commit (judy, &node[-1]);
+}
+
+//	judyL_del: delete an index, returning zero if it was
+//	not set
+
+int judyL_del (Judy *judy, judyvalue index)
+{
+judyslot *cell = judyL_cslot (judy->cursor, index);
+
+	if( !cell || !*cell )
+		return 0;
+
+	judy_remove (judy, 1);
+	return 1;
+}
+
+#ifdef __GNUC__
+	#define judy_prefetch(addr)	__builtin_prefetch (addr)
+#else
+	#define judy_prefetch(addr)
+#endif
+
+//	image writer: with neither out nor buff set it only sizes
+//	the image, and it fills buff only as far as max
+
+typedef struct {
+	FILE *out;			// image file
+	uchar *buff;		// image buffer
+	judyslot max;		// size of image buffer
+	judyslot pos;		// image offset of next node
+	judyslot base;		// base address of the array's links
+} JudyWriter;
+
+//	judy_writenode: the node is preceded by its count
+//	word with JUDY_COUNTS, which is written as well
+
+judyslot judy_writenode (JudyWriter *writer, void *node, int type)
+{
+judyslot link = (writer->pos + JUDY_head) | type;
+uint amt = JudySize[type];
+
+	if( amt & 0x07 )
+		amt |= 0x07, amt++;
+
+	amt += JUDY_head;
+	node = (uchar *)node - JUDY_head;
+
+	if( writer->out )
+		fwrite (node, amt, 1, writer->out);
+	else if( writer->buff && writer->pos + amt <= writer->max )
+		memcpy (writer->buff + writer->pos, node, amt);
+
+	writer->pos += amt;
+	return link;
+}
+
+//	write the subtree at next, returning its image link
+
+judyslot judy_writetree (JudyWriter *writer, judyslot next, uint off)
+{
+judyslot copybuff[1 + 64];	// room for a count and a JUDY_32 node
+judyslot innerbuff[1 + 16], outerbuff[1 + 16];
+judyslot *copy = copybuff + 1, *inner = innerbuff + 1, *outer = outerbuff + 1;
+judyslot *table, *node;
+int slot, cnt, keysize;
+uchar *base;
+uint size;
+
+	if( !next )
+		return 0;
+
+	size = JudySize[next & 0x07];
+	base = (uchar *)(writer->base + (next & JUDY_mask));
+#ifdef JUDY_COUNTS
+	copy[-1] = outer[-1] = judy_below (base);
+#endif
+
+	switch( next & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		cnt = size / (sizeof(judyslot) + keysize);
+		node = (judyslot *)(base + size);
+		memcpy (copy, base, size);
+
+		//	start the loads of all the children before the first descent
+
+		for( slot = 0; slot < cnt; slot++ )
+			if( node[-slot-1] )
+				judy_prefetch ((uchar *)(writer->base + (node[-slot-1] & JUDY_mask)));
+
+		for( slot = 0; slot < cnt; slot++ ) {
+#if BYTE_ORDER != BIG_ENDIAN
+			if( !node[-slot-1] || !base[slot * keysize] )
+#else
+			if( !node[-slot-1] || !base[slot * keysize + keysize - 1] )
+#endif
+				continue;	// empty slot or leaf cell
+
+			((judyslot *)((uchar *)copy + size))[-slot-1] = judy_writetree (writer, node[-slot-1], (off | JUDY_key_mask) + 1);
+		}
+
+		return judy_writenode (writer, copy, next & 0x07);
+
+	case JUDY_radix:
+		table = (judyslot *)base;
+
+		for( cnt = 0; cnt < 16; cnt++ ) {
+			if( !(outer[cnt] = table[cnt]) )
+				continue;
+
+			node = (judyslot *)(writer->base + (table[cnt] & JUDY_mask));
+#ifdef JUDY_COUNTS
+			inner[-1] = judy_below (node);
+#endif
+
+			for( slot = 0; slot < 16; slot++ )
+				if( cnt || slot )
+					inner[slot] = judy_writetree (writer, node[slot], off + 1);
+				else
+					inner[slot] = node[slot];	// leaf cell
+
+			outer[cnt] = judy_writenode (writer, inner, JUDY_radix);
+		}
+
+		return judy_writenode (writer, outer, JUDY_radix);
+
+	case JUDY_span:
+		node = (judyslot *)(base + size);
+		memcpy (copy, base, size);
+
+		if( base[JUDY_span_bytes - 1] )
+			((judyslot *)((uchar *)copy + size))[-1] = judy_writetree (writer, node[-1], off + JUDY_span_bytes);
+
+		return judy_writenode (writer, copy, JUDY_span);
+	}
+
+	return 0;
+}
+
+//	write the image header and nodes of the array, into buff
+//	if it holds max bytes or more, or to out when it is set,
+//	returning the image size
+
+judyslot judy_writeimage (Judy *judy, FILE *out, uchar *buff, judyslot max)
+{
+JudyWriter writer[1];
+JudyImage image[1];
+
+	memset (writer, 0, sizeof(writer));
+	memset (image, 0, sizeof(image));
+#ifdef JUDY_COUNTS
+	//	sum the nodes without counts so the image has them all
+
+	judy_total (judy->cursor, judy_load (judy->root), 0);
+	judy->counted = 1;
+#endif
+	memcpy (image->magic, JUDY_magic, 8);
+	image->keysize = JUDY_key_size;
+	image->order = 0x01020304;
+
+	writer->buff = buff;
+	writer->max = max;
+	writer->base = judy->cursor->base;
+	writer->pos = sizeof(JudyImage);
+	image->root = judy_writetree (writer, *judy->root, 0);
+	image->size = writer->pos;
+
+	if( buff && image->size <= max )
+		memcpy (buff, image, sizeof(JudyImage));
+
+	//	a file needs the size first so the header can lead it
+
+	if( !out )
+		return image->size;
+
+	writer->out = out;
+	writer->pos = sizeof(JudyImage);
+	fwrite (image, sizeof(JudyImage), 1, out);
+	judy_writetree (writer, *judy->root, 0);
+
+	if( ferror (out) )
+		return 0;
+
+	return image->size;
+}
+
+//	check that an image header was written by a compatible judy
+
+int judy_imageok (JudyImage *image, judyslot size)
+{
+	if( size < sizeof(JudyImage) || memcmp (image->magic, JUDY_magic, 8) )
+		return 0;
+
+	if( image->keysize != JUDY_key_size || image->order != 0x01020304 )
+		return 0;
+
+	return image->size == size && (image->root & JUDY_mask) < size;
+}
+
+//	judy_save: write the array to an image file for judy_map,
+//	returning the image size or zero on failure
+
+judyslot judy_save (Judy *judy, char *path)
+{
+judyslot size;
+FILE *out;
+
+	if( !(out = fopen (path, "wb")) )
+		return 0;
+
+	size = judy_writeimage (judy, out, NULL, 0);
+
+	if( fclose (out) )
+		return 0;
+
+	return size;
+}
+
+//	judy_map: open an image written by judy_save read-only in place,
+//	with a cursor of max levels.  The query calls work on the result;
+//	judy_cell, judy_del and the other writers must not be used on it.
+
+Judy *judy_map (char *path, uint max)
+{
+#if !defined(_WIN32)
+JudyImage *image;
+struct stat st;
+Judy *judy;
+int fd;
+
+	if( (fd = open (path, O_RDONLY)) < 0 )
+		return NULL;
+
+	if( fstat (fd, &st) || st.st_size < (off_t)sizeof(JudyImage) ) {
+		close (fd);
+		return NULL;
+	}
+
+	image = (JudyImage *)mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if( image == MAP_FAILED )
+		return NULL;
+
+	if( !judy_imageok (image, st.st_size) ) {
+		munmap (image, st.st_size);
+		return NULL;
+	}
+
+	if( !(judy = (Judy *)judy_open (max)) ) {
+		munmap (image, st.st_size);
+		return NULL;
+	}
+
+	judy->root[0] = image->root;
+	judy->cursor->base = (judyslot)image;
+	return judy;
+#else
+	return NULL;
+#endif
+}
+
+//	judy_dump: write the array as an image into buff, returning
+//	the image size.  Nothing is written when the size is over
+//	max, so judy_dump (judy, NULL, 0) sizes a buffer.  The image
+//	is the one judy_save writes, for judy_map or judy_restore.
+//	There must be no writer while it runs.
+
+judyslot judy_dump (Judy *judy, uchar *buff, judyslot max)
+{
+	return judy_writeimage (judy, NULL, buff, max);
+}
+
+//	judy_dump_fd: stream the array as an image to fd, returning
+//	the image size or zero on failure
+
+judyslot judy_dump_fd (Judy *judy, int fd)
+{
+#if !defined(_WIN32)
+judyslot size;
+FILE *out;
+int dupfd;
+
+	if( (dupfd = dup (fd)) < 0 )
+		return 0;
+
+	if( !(out = fdopen (dupfd, "wb")) ) {
+		close (dupfd);
+		return 0;
+	}
+
+	setvbuf (out, NULL, _IOFBF, JUDY_seg);
+	size = judy_writeimage (judy, out, NULL, 0);
+
+	if( fclose (out) )
+		return 0;
+
+	return size;
+#else
+	return 0;
+#endif
+}
+
+//	add an image segment of size bytes to the array, behind the
+//	segment holding the judy object so the remaining room there
+//	still serves new nodes.  The image nodes fill the segment.
+
+uchar *judy_arena (Judy *judy, judyslot size)
+{
+JudySeg *seg;
+uint amt;
+
+	amt = sizeof(JudySeg);
+
+	if( amt & 0x07 )
+		amt |= 0x07, amt++;
+
+	if( !(seg = judy_segalloc (judy->alloc, amt + size)) )
+		return NULL;
+
+	seg->next = amt;
+	seg->seg = judy->seg->seg;
+	judy->seg->seg = seg;
+	return (uchar *)seg + amt;
+}
+
+//	turn the image offset in link, and those in the subtree it
+//	leads to, into addresses in the image at base, counting the
+//	nodes by type.  Children are written before their parents,
+//	so every link must point below limit, the offset of the node
+//	holding it; returns zero when one does not.
+
+int judy_inimage (judyslot link, uint amt, judyslot limit)
+{
+	return (link & JUDY_mask) >= sizeof(JudyImage) + JUDY_head && (link & JUDY_mask) + amt <= limit;
+}
+
+int judy_relocate (judyslot *link, uchar *base, judyslot limit, uint off, judyslot *nodes)
+{
+judyslot *table, *inner, *node;
+int slot, cnt, keysize;
+judyslot pos, tbl;
+uchar *key;
+uint amt;
+
+	if( !*link )
+		return 1;
+
+	amt = JudySize[*link & 0x07];
+	pos = *link & JUDY_mask;
+
+	if( !judy_inimage (*link, amt, limit) )
+		return 0;
+
+	*link += (judyslot)base;
+	key = base + pos;
+	nodes[*link & 0x07]++;
+
+	switch( *link & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		cnt = amt / (sizeof(judyslot) + keysize);
+		node = (judyslot *)(key + amt);
+
+		for( slot = 0; slot < cnt; slot++ ) {
+#if BYTE_ORDER != BIG_ENDIAN
+			if( !node[-slot-1] || !key[slot * keysize] )
+#else
+			if( !node[-slot-1] || !key[slot * keysize + keysize - 1] )
+#endif
+				continue;	// empty slot or leaf cell
+
+			if( !judy_relocate (&node[-slot-1], base, pos, (off | JUDY_key_mask) + 1, nodes) )
+				return 0;
+		}
+
+		return 1;
+
+	case JUDY_radix:
+		table = (judyslot *)key;
+
+		for( cnt = 0; cnt < 16; cnt++ ) {
+			if( !table[cnt] )
+				continue;
+
+			//	inner tables are radix blocks without a subtree of their own
+
+			if( (table[cnt] & 0x07) != JUDY_radix || !judy_inimage (table[cnt], amt, pos) )
+				return 0;
+
+			tbl = table[cnt];
+			table[cnt] += (judyslot)base;
+			nodes[JUDY_radix]++;
+			inner = (judyslot *)(base + tbl);
+
+			for( slot = 0; slot < 16; slot++ )
+				if( cnt || slot )
+					if( !judy_relocate (&inner[slot], base, tbl, off + 1, nodes) )
+						return 0;
+		}
+
+		return 1;
+
+	case JUDY_span:
+		node = (judyslot *)(key + amt);
+
+		if( key[JUDY_span_bytes - 1] )
+			return judy_relocate (&node[-1], base, pos, off + JUDY_span_bytes, nodes);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+//	point the array at the image read into its arena, relocating
+//	the links; closes the array when they leave the image
+
+Judy *judy_adopt (Judy *judy, uchar *image, judyslot size)
+{
+judyslot root = ((JudyImage *)image)->root;
+
+	if( !judy_relocate (&root, image, size, 0, judy->nodes) ) {
+		judy_close (judy);
+		return NULL;
+	}
+
+	judy->root[0] = root;
+#ifdef JUDY_COUNTS
+	judy->counted = 1;	// the image carries its counts
+#endif
+	return judy;
+}
+
+//	judy_restore: rebuild a live, writable array from an image
+//	of size bytes in buff, such as judy_dump or judy_save wrote.
+//	The nodes are copied into one segment in a single pass and
+//	their links relocated in place; returns NULL on a bad image.
+
+Judy *judy_restore (uchar *buff, judyslot size, uint max)
+{
+uchar *image;
+Judy *judy;
+
+	if( !judy_imageok ((JudyImage *)buff, size) )
+		return NULL;
+
+	if( !(judy = (Judy *)judy_open (max)) )
+		return NULL;
+
+	if( !(image = judy_arena (judy, size)) ) {
+		judy_close (judy);
+		return NULL;
+	}
+
+	memcpy (image, buff, size);
+	return judy_adopt (judy, image, size);
+}
+
+//	judy_restore_fd: rebuild a live array from an image read
+//	from fd, such as judy_dump_fd wrote
+
+Judy *judy_restore_fd (int fd, uint max)
+{
+#if !defined(_WIN32)
+JudyImage header[1];
+judyslot size, pos;
+uchar *image;
+Judy *judy;
+ssize_t amt;
+
+	for( pos = 0; pos < sizeof(JudyImage); pos += amt )
+		if( (amt = read (fd, (uchar *)header + pos, sizeof(JudyImage) - pos)) <= 0 )
+			return NULL;
+
+	size = header->size;
+
+	if( !judy_imageok (header, size) )
+		return NULL;
+
+	if( !(judy = (Judy *)judy_open (max)) )
+		return NULL;
+
+	if( !(image = judy_arena (judy, size)) ) {
+		judy_close (judy);
+		return NULL;
+	}
+
+	memcpy (image, header, sizeof(JudyImage));
+
+	for( ; pos < size; pos += amt )
+		if( (amt = read (fd, image + pos, size - pos)) <= 0 ) {
+			judy_close (judy);
+			return NULL;
+		}
+
+	return judy_adopt (judy, image, size);
+#else
+	return NULL;
+#endif
+}
+
+//	judy_stats: fill stats from the counters the array keeps, in
+//	time proportional to its segment count.  The walk fields are
+//	left zero.
+
+typedef struct {
+	judyslot nodes[8];		// live nodes of each type, radix tables included
+	judyslot bytes[8];		// bytes in those nodes
+	judyslot countbytes;	// bytes of JUDY_COUNTS words included in bytes
+	judyslot reuse[8];		// bytes of each type on the reuse lists
+	judyslot limbo;			// bytes of replaced nodes and segments awaiting readers
+	judyslot segments;		// segments allocated
+	judyslot segbytes;		// bytes in those segments
+	judyslot databytes;		// bytes handed out by judy_data
+	judyslot keys;			// walk: keys in the array
+	judyslot slots[8];		// walk: occupied slots in nodes of each type
+	judyslot capacity[8];	// walk: slots in nodes of each type
+	judyslot depth[JUDY_depths];	// walk: keys by nodes on their path, deeper in the last
+	judyslot perkey;		// walk: segment bytes per key
+} JudyStats;
+
+void judy_stats (Judy *judy, JudyStats *stats)
+{
+JudySeg *seg;
+int type;
+uint amt;
+#ifdef JUDY_CONCURRENT
+uint idx;
+#endif
+
+	memset (stats, 0, sizeof(JudyStats));
+
+	for( type = 0; type < 8; type++ ) {
+		amt = JudySize[type];
+
+		if( amt & 0x07 )
+			amt |= 0x07, amt += 1;
+
+		amt += JUDY_head;
+		stats->nodes[type] = judy->nodes[type];
+		stats->countbytes += judy->nodes[type] * JUDY_head;
+		stats->bytes[type] = judy->nodes[type] * amt;
+		stats->reuse[type] = judy->reused[type] * amt;
+	}
+
+#ifdef JUDY_CONCURRENT
+	for( idx = 0; idx < judy->limbocnt; idx++ ) {
+		if( judy->limbo[idx].type == JUDY_segment ) {
+			stats->limbo += ((JudySeg *)judy->limbo[idx].block)->size;
+			continue;
+		}
+
+		amt = JudySize[judy->limbo[idx].type];
+
+		if( amt & 0x07 )
+			amt |= 0x07, amt += 1;
+
+		stats->limbo += amt + JUDY_head;
+	}
+#endif
+
+	for( seg = judy->seg; seg; seg = (JudySeg *)seg->seg )
+		stats->segments++, stats->segbytes += seg->size;
+
+	stats->databytes = judy->databytes;
+}
+
+//	count the keys, slots and depths of the subtree at next
+
+void judy_shapetree (JudyCursor *cursor, JudyStats *stats, judyslot next, uint off, uint depth)
+{
+judyslot *table, *inner, *node;
+int slot, cnt, keysize;
+uchar *base;
+uint size;
+
+	if( !next )
+		return;
+
+	size = JudySize[next & 0x07];
+	base = (uchar *)judy_addr (cursor, next);
+	depth++;
+
+	switch( next & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		cnt = size / (sizeof(judyslot) + keysize);
+		node = (judyslot *)(base + size);
+		stats->capacity[next & 0x07] += cnt;
+
+		for( slot = 0; slot < cnt; slot++ ) {
+			if( !node[-slot-1] )
+				continue;
+
+			stats->slots[next & 0x07]++;
+#if BYTE_ORDER != BIG_ENDIAN
+			if( !base[slot * keysize] )
+#else
+			if( !base[slot * keysize + keysize - 1] )
+#endif
+				stats->keys++, stats->depth[depth < JUDY_depths ? depth : JUDY_depths - 1]++;
+			else
+				judy_shapetree (cursor, stats, node[-slot-1], (off | JUDY_key_mask) + 1, depth);
+		}
+		return;
+
+	case JUDY_radix:
+		table = (judyslot *)base;
+		stats->capacity[JUDY_radix] += 256;
+
+		for( cnt = 0; cnt < 16; cnt++ ) {
+			if( !(inner = (judyslot *)judy_table (cursor, table[cnt])) )
+				continue;
+
+			for( slot = 0; slot < 16; slot++ ) {
+				if( !inner[slot] )
+					continue;
+
+				stats->slots[JUDY_radix]++;
+
+				if( cnt || slot )
+					judy_shapetree (cursor, stats, inner[slot], off + 1, depth);
+				else
+					stats->keys++, stats->depth[depth < JUDY_depths ? depth : JUDY_depths - 1]++;
+			}
+		}
+		return;
+
+	case JUDY_span:
+		node = (judyslot *)(base + size);
+		stats->capacity[JUDY_span]++;
+		stats->slots[JUDY_span]++;
+
+		if( base[JUDY_span_bytes - 1] )
+			judy_shapetree (cursor, stats, node[-1], off + JUDY_span_bytes, depth);
+		else
+			stats->keys++, stats->depth[depth < JUDY_depths ? depth : JUDY_depths - 1]++;
+		return;
+	}
+}
+
+//	judy_shape: judy_stats plus the walk fields, in time
+//	proportional to the array's node count.  Call it from
+//	the thread that writes the array.
+
+void judy_shape (Judy *judy, JudyStats *stats)
+{
+	judy_stats (judy, stats);
+	judy_shapetree (judy->cursor, stats, *judy->root, 0, 0);
+
+	if( stats->keys )
+		stats->perkey = stats->segbytes / stats->keys;
+}
+
+#ifdef JUDY_INSTRUMENT
+//	judy_ccounters: copy the JUDY_INSTRUMENT counters of a private
+//	cursor's walks and start them over.  judy_counters does the
+//	same for the array, whose cursor shares its counters.
+
+void judy_ccounters (JudyCursor *cursor, JudyCounters *counters)
+{
+	memcpy (counters, cursor->counters, sizeof(JudyCounters));
+	memset (cursor->counters, 0, sizeof(JudyCounters));
+}
+
+void judy_counters (Judy *judy, JudyCounters *counters)
+{
+	judy_ccounters (judy->cursor, counters);
+}
+#endif
+
+//	judy_compact moves the live nodes out of segments with at
+//	least 1/JUDY_idle of their bytes idle, into free blocks of
+//	the others or into new segments, fixes up the parent links
+//	and releases the emptied segments.  A pass first picks the
+//	victims and takes their blocks off the reuse lists, then
+//	walks the tree in key order.  The walk can stop after a
+//	budget of nodes and resume at the key it reached, so
+//	judy_compact_step can spread a pass over many calls with the
+//	array in use in between: nodes made or freed meanwhile never
+//	land in a victim.  Segments holding the judy object or
+//	judy_data blocks stay put.  Moving nodes invalidates cell
+//	pointers and cursor positions like any other write.  Under
+//	JUDY_CONCURRENT readers go on in the old copies, and the
+//	emptied segments wait in limbo until they leave.
+
+#define JUDY_idle	4
+
+typedef struct {
+	uchar *key;			// key prefix of the node being walked
+	uint max;			// allocated bytes for it
+	uint budget;		// nodes left to walk this call
+	int failed;			// out of memory, the pass is abandoned
+} JudyCompact;
+
+int judy_segcmp (const void *a, const void *b)
+{
+	if( *(JudySeg **)a < *(JudySeg **)b )
+		return -1;
+
+	return *(JudySeg **)a > *(JudySeg **)b;
+}
+
+//	pick the victim segments and take their blocks off the
+//	reuse lists, returning the number of victims
+
+uint judy_compactstart (Judy *judy)
+{
+JudySeg *seg, **segs;
+judyslot *used, live;
+void **block, **prev;
+uint cnt = 0, idx;
+int type, vic;
+uint amt;
+
+	for( seg = judy->seg; seg; seg = (JudySeg *)seg->seg )
+		cnt++;
+
+	segs = (JudySeg **)malloc (cnt * sizeof(JudySeg *));
+	used = (judyslot *)calloc (cnt, sizeof(judyslot));
+
+	if( !segs || !used ) {
+		free (segs);
+		free (used);
+		return 0;
+	}
+
+	//	the segment taking new nodes stays put
+
+	for( cnt = 0, seg = (JudySeg *)judy->seg->seg; seg; seg = (JudySeg *)seg->seg )
+		if( !seg->pinned )
+			segs[cnt++] = seg;
+
+	qsort (segs, cnt, sizeof(JudySeg *), judy_segcmp);
+	free (judy->victims);	// emptied by judy_reclaim
+	judy->victims = segs;
+	judy->victimcnt = cnt;
+
+	//	count the free bytes in each candidate
+
+	for( type = 0; type < 8; type++ ) {
+		amt = JudySize[type];
+
+		if( amt & 0x07 )
+			amt |= 0x07, amt += 1;
+
+		amt += JUDY_head;
+
+		for( block = judy->reuse[type]; block; block = (void **)*block )
+			if( (vic = judy_victim (judy, block)) >= 0 )
+				used[vic] += amt;
+	}
+
+	//	keep the sparse ones
+
+	for( idx = judy->victimcnt = 0; idx < cnt; idx++ ) {
+		live = segs[idx]->size - segs[idx]->next - used[idx];
+
+		if( (segs[idx]->size - live) * JUDY_idle >= segs[idx]->size )
+			segs[judy->victimcnt++] = segs[idx];
+	}
+
+	free (used);
+
+	if( !judy->victimcnt ) {
+		free (judy->victims);
+		judy->victims = NULL;
+		return 0;
+	}
+
+	for( type = 0; type < 8; type++ )
+		for( prev = (void **)&judy->reuse[type]; (block = (void **)*prev); )
+			if( judy_victim (judy, block) >= 0 )
+				*prev = *block, judy->reused[type]--;
+			else
+				prev = block;
+
+	judy->fromlen = 0;
+	judy->compacting = 1;
+	return judy->victimcnt;
+}
+
+//	move the node at link out of its victim segment
+
+void judy_compactmove (Judy *judy, JudyCompact *walk, judyslot *link)
+{
+int type = *link & 0x07;
+void *block;
+uint amt;
+
+	if( judy_victim (judy, (void *)(*link & JUDY_mask)) < 0 )
+		return;
+
+	if( !(block = judy_alloc (judy, type)) ) {
+		walk->failed = 1;
+		return;
+	}
+
+	amt = JudySize[type];
+
+	if( amt & 0x07 )
+		amt |= 0x07, amt += 1;
+
+	memcpy ((uchar *)block - JUDY_head, (uchar *)(*link & JUDY_mask) - JUDY_head, amt + JUDY_head);
+	judy->nodes[type]--;	// the old copy goes with its segment
+	judy_store (link, (judyslot)block | type);
+}
+
+//	compare the child key walk->key[off .. off + len] with the
+//	resume key: below zero to skip the child, zero if the resume
+//	key continues past it, above zero to walk all of it
+
+int judy_compactcmp (Judy *judy, uchar *key, uint off, uint len)
+{
+uint cnt = judy->fromlen - off;
+int cmp;
+
+	if( cnt > len )
+		cnt = len;
+
+	if( (cmp = memcmp (key + off, judy->from + off, cnt)) )
+		return cmp;
+
+	return off + len >= judy->fromlen;
+}
+
+//	walk the subtree at link, whose key starts at off, moving
+//	nodes out of the victims.  While onpath the key so far is a
+//	prefix of the resume key and the nodes below it are skipped.
+//	Returns zero when the budget runs out, with the resume key
+//	set to the node reached.
+
+int judy_compactwalk (Judy *judy, JudyCompact *walk, judyslot *link, uint off, int onpath)
+{
+judyslot *table, *inner, *node;
+int slot, cnt, keysize, cmp;
+judyvalue value;
+uchar *base, *key;
+uint size, idx;
+
+	if( !*link || walk->failed )
+		return 1;
+
+	if( !onpath && !walk->budget-- ) {
+		if( judy->frommax < off ) {
+			if( !(key = (uchar *)realloc (judy->from, off)) ) {
+				walk->failed = 1;
+				return 1;
+			}
+			judy->from = key;
+			judy->frommax = off;
+		}
+
+		memcpy (judy->from, walk->key, off);
+		judy->fromlen = off;
+		return 0;
+	}
+
+	//	room for the longest step down
+
+	if( walk->max < off + JUDY_span_bytes ) {
+		if( !(key = (uchar *)realloc (walk->key, 2 * (off + JUDY_span_bytes))) ) {
+			walk->failed = 1;
+			return 1;
+		}
+		walk->key = key;
+		walk->max = 2 * (off + JUDY_span_bytes);
+	}
+
+	judy_compactmove (judy, walk, link);
+	size = JudySize[*link & 0x07];
+	base = (uchar *)(*link & JUDY_mask);
+
+	switch( *link & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		cnt = size / (sizeof(judyslot) + keysize);
+		node = (judyslot *)(base + size);
+
+		for( slot = 0; slot < cnt; slot++ ) {
+#if BYTE_ORDER != BIG_ENDIAN
+			if( !node[-slot-1] || !base[slot * keysize] )
+#else
+			if( !node[-slot-1] || !base[slot * keysize + keysize - 1] )
+#endif
+				continue;	// empty slot or leaf cell
+
+			value = judy_keyat (base, slot, keysize);
+
+			for( idx = keysize; idx--; value >>= 8 )
+				walk->key[off + idx] = (uchar)value;
+
+			cmp = onpath ? judy_compactcmp (judy, walk->key, off, keysize) : 1;
+
+			if( cmp >= 0 && !judy_compactwalk (judy, walk, &node[-slot-1], off + keysize, !cmp) )
+				return 0;
+		}
+
+		return 1;
+
+	case JUDY_radix:
+		table = (judyslot *)base;
+
+		for( cnt = 0; cnt < 16; cnt++ ) {
+			if( !table[cnt] || (onpath && (cnt << 4 | 0x0F) < judy->from[off]) )
+				continue;
+
+			judy_compactmove (judy, walk, &table[cnt]);
+			inner = (judyslot *)(table[cnt] & JUDY_mask);
+
+			for( slot = 0; slot < 16; slot++ ) {
+				if( !(cnt | slot) )
+					continue;	// leaf cell
+
+				walk->key[off] = cnt << 4 | slot;
+				cmp = onpath ? judy_compactcmp (judy, walk->key, off, 1) : 1;
+
+				if( cmp >= 0 && !judy_compactwalk (judy, walk, &inner[slot], off + 1, !cmp) )
+					return 0;
+			}
+		}
+
+		return 1;
+
+	case JUDY_span:
+		node = (judyslot *)(base + size);
+
+		if( !base[JUDY_span_bytes - 1] )
+			return 1;	// leaf cell
+
+		memcpy (walk->key + off, base, JUDY_span_bytes);
+		cmp = onpath ? judy_compactcmp (judy, walk->key, off, JUDY_span_bytes) : 1;
+
+		if( cmp >= 0 )
+			return judy_compactwalk (judy, walk, &node[-1], off + JUDY_span_bytes, !cmp);
+
+		return 1;
+	}
+
+	return 1;
+}
+
+//	end a pass: release the victims, or just forget them
+//	when a node could not be moved.  Returns the bytes freed.
+
+judyslot judy_compactfinish (Judy *judy, int failed)
+{
+JudySeg **prev, *seg;
+judyslot bytes = 0;
+uint idx;
+
+	judy->compacting = 0;
+
+	if( !failed ) {
+		for( prev = &judy->seg; (seg = *prev); )
+			if( judy_victim (judy, seg) >= 0 )
+				*prev = (JudySeg *)seg->seg;
+			else
+				prev = (JudySeg **)&seg->seg;
+
+		for( idx = 0; idx < judy->victimcnt; idx++ ) {
+			bytes += judy->victims[idx]->size;
+#ifdef JUDY_CONCURRENT
+			judy_park (judy, judy->victims[idx], JUDY_segment);
+#else
+			judy_segfree (judy->alloc, judy->victims[idx]);
+#endif
+		}
+
+#ifdef JUDY_CONCURRENT
+		//	the victims stay listed until the next scan frees them
+
+		judy->limbomark = 0;
+		return bytes;
+#endif
+	}
+
+	free (judy->victims);
+	judy->victims = NULL;
+	judy->victimcnt = 0;
+	return bytes;
+}
+
+//	judy_compact_step: walk up to budget nodes of a compaction
+//	pass, starting a pass if none is under way.  Returns nonzero
+//	while the pass has more to do.
+
+int judy_compact_step (Judy *judy, uint budget)
+{
+JudyCompact walk[1];
+int done;
+
+	if( judy->cursor->base )
+		return 0;	// mapped image
+
+	judy_reclaim (judy);
+	judy->cursor->keylevel = 0;
+
+	//	under JUDY_CONCURRENT the last victims must be gone first
+
+	if( !judy->compacting )
+		if( judy->victimcnt || !judy_compactstart (judy) )
+			return 0;
+
+	memset (walk, 0, sizeof(walk));
+	walk->budget = budget ? budget : 1;
+	done = judy_compactwalk (judy, walk, judy->root, 0, judy->fromlen > 0);
+	judy->cursor->level = 0;
+	free (walk->key);
+
+	if( !done && !walk->failed )
+		return 1;
+
+	judy_compactfinish (judy, walk->failed);
+	return 0;
+}
+
+//	judy_compact: run a whole compaction pass, returning the
+//	bytes of the segments it released
+
+judyslot judy_compact (Judy *judy)
+{
+judyslot before = 0, after = 0;
+JudySeg *seg;
+
+	for( seg = judy->seg; seg; seg = (JudySeg *)seg->seg )
+		before += seg->size;
+
+	while( judy_compact_step (judy, ~0U) );
+
+	for( seg = judy->seg; seg; seg = (JudySeg *)seg->seg )
+		after += seg->size;
+
+	return before - after;
+}
+
+//	bulk load helpers
+
+//	gather the key bytes at off up to the next key boundary
+
+judyvalue judy_chunk (uchar *buff, uint max, uint off)
+{
+judyvalue value = 0;
+
+#if defined(__GNUC__) && BYTE_ORDER != BIG_ENDIAN
+	//	load a whole key word when the key covers it
+
+	if( (off | JUDY_key_mask) < max ) {
+		memcpy (&value, buff + (off & ~JUDY_key_mask), JUDY_key_size);
+#if JUDY_key_size > 4
+		return __builtin_bswap64 (value) & JudyMask[JUDY_key_size - (off & JUDY_key_mask)];
+#else
+		return __builtin_bswap32 (value) & JudyMask[JUDY_key_size - (off & JUDY_key_mask)];
+#endif
+	}
+#endif
+	do {
+		value <<= 8;
+		if( off < max )
+			value |= buff[off];
+	} while( ++off & JUDY_key_mask );
+
+	return value;
+}
+
+//	build a chain of span nodes for the rest of a single key
+
+judyslot judy_buildspan (Judy *judy, uchar *buff, uint max, uint off, judyslot value)
+{
+judyslot link = 0, *next = &link;
+judyslot *node;
+uchar *base;
+int cnt, tst;
+
+	while( off <= max ) {
+		base = (uchar *)judy_alloc (judy, JUDY_span);
+		*next = (judyslot)base | JUDY_span;
+		node = (judyslot *)(base + JudySize[JUDY_span]);
+		cnt = tst = JUDY_span_bytes;
+		if( tst > (int)(max - off) )
+			tst = max - off;
+		memcpy (base, buff + off, tst);
+
+		next = &node[-1];
+		off += tst;
+		if( !base[cnt-1] )	// done on leaf
+			break;
+	}
+
+	*next = value;
+	return link;
+}
+
+//	most slots in a JUDY_32 node, reached with one byte keys
+
+#define JUDY_most ((32 * JUDY_slot_size + 32 * JUDY_key_size) / (JUDY_slot_size + 1))
+
+//	build the subtree for sorted keys[0..cnt-1], which all share
+//	their first off bytes, choosing each node's type up front
+
+judyslot judy_build (Judy *judy, uchar **keys, uint *lens, judyslot *values, uint cnt, uint off, uint *loaded)
+{
+judyvalue value, chunks[JUDY_most + 1];
+uint idx, start, end, groups, keysize, type, size;
+uint starts[JUDY_most + 1];
+judyslot *table, *inner;
+judyslot *node, link;
+uchar *base;
+uint key;
+int slot;
+
+	//	a single key on a key boundary becomes span nodes.
+	//	sorted duplicates collapse onto the last value
+
+	if( !(off & JUDY_key_mask) )
+	  if( lens[0] == lens[cnt - 1] && !memcmp (keys[0] + off, keys[cnt - 1] + off, lens[0] - off) ) {
+		*loaded += 1;
+		return judy_buildspan (judy, keys[cnt - 1], lens[cnt - 1], off, values[cnt - 1]);
+	  }
+
+	//	count the distinct key values at this offset,
+	//	stopping once they overflow the largest linear node
+
+	keysize = JUDY_key_size - (off & JUDY_key_mask);
+	size = JudySize[JUDY_max] / (sizeof(judyslot) + keysize);
+	chunks[0] = judy_chunk (keys[0], lens[0], off);
+	starts[0] = 0;
+
+	for( groups = idx = 1; idx < cnt && groups <= size; idx++ )
+		if( (value = judy_chunk (keys[idx], lens[idx], off)) != chunks[groups - 1] )
+			starts[groups] = idx, chunks[groups++] = value;
+
+	//	too many for the largest linear node: fan out by one byte
+
+	if( groups > size ) {
+		table = (judyslot *)judy_alloc (judy, JUDY_radix);
+
+		for( start = idx = 0; idx < cnt; start = idx ) {
+			key = off < lens[start] ? keys[start][off] : 0;
+
+			while( ++idx < cnt )
+				if( (off < lens[idx] ? keys[idx][off] : 0) != key )
+					break;
+
+			if( !table[key >> 4] )
+				table[key >> 4] = (judyslot)judy_alloc (judy, JUDY_radix) | JUDY_radix;
+
+			inner = (judyslot *)(table[key >> 4] & JUDY_mask);
+
+			if( key )
+				inner[key & 0x0F] = judy_build (judy, keys + start, lens + start, values + start, idx - start, off + 1, loaded);
+			else
+				inner[0] = values[idx - 1], *loaded += 1;
+		}
+
+		return (judyslot)table | JUDY_radix;
+	}
+
+	//	otherwise the smallest linear node that holds every value
+
+	type = JUDY_1;
+
+	while( groups > JudySize[type] / (sizeof(judyslot) + keysize) )
+		type++;
+
+	size = JudySize[type];
+	base = (uchar *)judy_alloc (judy, type);
+	node = (judyslot *)(base + size);
+	slot = size / (sizeof(judyslot) + keysize) - groups;
+
+	for( idx = 0; idx < groups; idx++, slot++ ) {
+		start = starts[idx];
+		end = idx + 1 < groups ? starts[idx + 1] : cnt;
+		value = chunks[idx];
+
+#if BYTE_ORDER != BIG_ENDIAN
+		memcpy (base + slot * keysize, &value, keysize);
+#else
+		for( key = keysize; key--; value >>= 8 )
+			base[slot * keysize + key] = value;
+
+		value = chunks[idx];
+#endif
+		if( !(value & 0xFF) )	// leaf?
+			link = values[end - 1], *loaded += 1;
+		else
+			link = judy_build (judy, keys + start, lens + start, values + start, end - start, (off | JUDY_key_mask) + 1, loaded);
+
+		node[-slot-1] = link;
+	}
+
+	return (judyslot)base | type;
+}
+
+//	judy_bulk_load: build an empty array from keys in ascending
+//	order, returning the number of distinct keys loaded or zero
+//	if the array is not empty or the keys are out of order.
+
+uint judy_bulk_load (Judy *judy, uchar **keys, uint *lens, judyslot *values, uint cnt)
+{
+uint idx, len, loaded = 0;
+int diff;
+
+	if( *judy->root || !cnt )
+		return 0;
+
+	for( idx = 1; idx < cnt; idx++ ) {
+		len = lens[idx] < lens[idx - 1] ? lens[idx] : lens[idx - 1];
+		diff = memcmp (keys[idx - 1], keys[idx], len);
+		if( diff > 0 || (!diff && lens[idx - 1] > lens[idx]) )
+			return 0;
+	}
+
+	judy->cursor->level = judy->cursor->keylevel = 0;
+	judy_store (judy->root, judy_build (judy, keys, lens, values, cnt, 0, &loaded));
+	return loaded;
+}
+
+//	set operations: judy_setwalk merges two arrays by walking
+//	both at once, node by node from a JudyChild place in each,
+//	and hands each key of the result in order to emit.  The
+//	edges leaving two places are merged by their first bytes,
+//	so for an intersection a subtree that only one array holds,
+//	such as a run of radix slots, is passed over unvisited and
+//	each node is read once rather than on a descent per key.
+//	The node under the next edge is prefetched while the walk
+//	goes down the current one.  merge, or
+//	the first array's value without one, gives the value of a
+//	key in both arrays; a zero value leaves the key out.  The
+//	arrays must not change during the walk.
+
+#define JUDY_union		1
+#define JUDY_intersect	2
+#define JUDY_difference	3
+
+typedef struct {
+	Judy *judy[2];		// the two arrays
+	int op;				// JUDY_union, JUDY_intersect or JUDY_difference
+	judyslot (*merge) (void *ctx, uchar *key, uint len, judyslot a, judyslot b);
+	int (*emit) (void *ctx, uchar *key, uint len, judyslot value);
+	void *ctx;			// passed to merge and emit
+	uchar *key;			// key bytes down to the places
+	uint max;			// allocated bytes for it
+	judyslot count;		// keys emitted
+	int failed;			// out of memory
+} JudySetOp;
+
+//	judy_edge: the next run of key bytes leaving the place at
+//	within its node: a radix byte, the rest of a linear node
+//	key or of a span, cut short where a key ends.  Stores the
+//	bytes in label and the place after them in child, returning
+//	their count, or zero when there are no more.  *pos starts
+//	at zero and keeps the place in the node reached.  When the
+//	edge ends the only key that takes it, *leaf is its cell.
+
+uint judy_edge (Judy *judy, JudyChild *at, int *pos, uchar *label, JudyChild *child, judyslot **leaf)
+{
+JudyCursor *cursor = judy->cursor;
+int slot, last, cnt, size, keysize, idx, shift;
+judyslot *table, *inner, *node;
+judyvalue key, high;
+judyslot next;
+uchar *base;
+uint len;
+
+	*leaf = NULL;
+
+	if( !at->next )
+		return 0;
+
+	base = (uchar *)judy_addr (cursor, at->next);
+	size = JudySize[at->next & 0x07];
+	idx = at->depth - at->off;
+
+	switch( at->next & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+		keysize = JUDY_key_size - (at->off & JUDY_key_mask);
+		node = (judyslot *)(base + size);
+		cnt = size / (sizeof(judyslot) + keysize);
+
+		//	the keys starting with the place's bytes follow
+		//	the first one above them, or the unused slots.
+		//	*pos is one past the next slot to look at
+
+		if( !*pos )
+			*pos = judy_search (base, cnt, keysize, at->value) + 2;
+
+		while( (slot = *pos - 1) < cnt ) {
+			key = judy_keyat (base, slot, keysize);
+
+			if( idx && key >> 8 * (keysize - idx) != at->value >> 8 * (keysize - idx) )
+				return 0;
+
+			//	the keys going on with the same byte make one
+			//	edge, as far as the first and last agree
+
+			shift = 8 * (keysize - idx - 1);
+
+			for( last = slot; last + 1 < cnt; last++ )
+			  if( judy_keyat (base, last + 1, keysize) >> shift != key >> shift )
+				break;
+
+			*pos = last + 2;
+			high = judy_keyat (base, last, keysize);
+
+			for( len = 0; idx + len < (uint)keysize; len++, shift -= 8 )
+			  if( !(label[len] = key >> shift) || (uchar)(high >> shift) != label[len] )
+				break;
+
+			if( !len )	// the key ending at the place
+				continue;
+
+			*child = *at;
+			child->depth += len;
+
+			if( idx + len < (uint)keysize ) {
+				child->value = key >> shift >> 8 << shift << 8;
+				if( last == slot )
+					*leaf = &node[-slot-1];
+			} else {
+				child->next = judy_load (&node[-slot-1]);
+				child->off += keysize;
+				child->value = 0;
+			}
+
+			//	start loading the node of the edge after
+
+			if( last + 1 < cnt && judy_keyat (base, last + 1, keysize) & 0xFF )
+				judy_prefetch ((uchar *)judy_addr (cursor, judy_load (&node[-last-2])));
+
+			return len;
+		}
+
+		return 0;
+
+	case JUDY_radix:
+		table = (judyslot *)base;
+
+		for( slot = *pos ? *pos : 1; slot < 256; slot++ )
+		  if( (inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) ) {
+			if( !(next = judy_load (&inner[slot & 0x0F])) )
+				continue;
+
+			*pos = slot + 1;
+			label[0] = slot;
+			*child = *at;
+			child->next = next;
+			child->off++;
+			child->depth++;
+
+			if( (slot & 0x0F) < 0x0F && (next = judy_load (&inner[(slot & 0x0F) + 1])) )
+				judy_prefetch ((uchar *)judy_addr (cursor, next));
+
+			return 1;
+		  } else
+			slot |= 0x0F;
+
+		*pos = 256;
+		return 0;
+
+	case JUDY_span:
+		if( (*pos)++ )
+			return 0;
+
+		for( len = 0; idx + len < JUDY_span_bytes; len++ )
+		  if( !(label[len] = base[idx + len]) )
+			break;
+
+		if( !len )
+			return 0;
+
+		*child = *at;
+		child->depth += len;
+		node = (judyslot *)(base + size);
+
+		if( idx + len == JUDY_span_bytes ) {
+			child->next = judy_load (&node[-1]);
+			child->off += JUDY_span_bytes;
+		} else
+			*leaf = &node[-1];
+
+		return len;
+	}
+
+	return 0;
+}
+
+//	judy_edgefirst: judy_child_cell for the place at, also
+//	starting *pos for judy_edge from the same node search
+
+judyslot *judy_edgefirst (Judy *judy, JudyChild *at, int *pos)
+{
+JudyCursor *cursor = judy->cursor;
+int slot, cnt, size, keysize;
+judyslot *table, *node;
+uchar *base;
+
+	*pos = 0;
+
+	if( !at->next )
+		return NULL;
+
+	base = (uchar *)judy_addr (cursor, at->next);
+	size = JudySize[at->next & 0x07];
+
+	switch( at->next & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+		keysize = JUDY_key_size - (at->off & JUDY_key_mask);
+		node = (judyslot *)(base + size);
+		cnt = size / (sizeof(judyslot) + keysize);
+		slot = judy_search (base, cnt, keysize, at->value);
+		*pos = slot + 2;
+
+		if( slot >= 0 && judy_keyat (base, slot, keysize) == at->value && judy_load (&node[-slot-1]) )
+			return &node[-slot-1];
+
+		return NULL;
+
+	case JUDY_radix:
+		table = (judyslot *)base;
+		*pos = 1;
+
+		if( (table = (judyslot *)judy_table (cursor, judy_load (&table[0]))) && judy_load (&table[0]) )
+			return &table[0];
+
+		return NULL;
+	}
+
+	return judy_child_cell (judy, at);
+}
+
+//	judy_edgecut: the place len bytes along an edge from at,
+//	short of its end, where the two arrays' keys part
+
+void judy_edgecut (JudyChild *at, uchar *label, uint len, JudyChild *child)
+{
+int keysize = JUDY_key_size - (at->off & JUDY_key_mask);
+int idx = at->depth - at->off;
+uint cnt;
+
+	*child = *at;
+	child->depth += len;
+
+	if( (at->next & 0x07) == JUDY_span )
+		return;
+
+	for( cnt = 0; cnt < len; cnt++ )
+		child->value |= (judyvalue)label[cnt] << 8 * (keysize - idx - cnt - 1);
+}
+
+//	judy_setemit: emit the key in op->key of length len, for
+//	its cells in the two arrays, as the operation has it
+
+int judy_setemit (JudySetOp *op, uint len, judyslot *cella, judyslot *cellb)
+{
+judyslot value = 0;
+
+	if( cella && cellb ) {
+	  if( op->op != JUDY_difference )
+		value = op->merge ? op->merge (op->ctx, op->key, len, *cella, *cellb) : *cella;
+	} else if( cella ) {
+	  if( op->op != JUDY_intersect )
+		value = *cella;
+	} else if( cellb ) {
+	  if( op->op == JUDY_union )
+		value = *cellb;
+	}
+
+	if( !value )
+		return 0;
+
+	op->key[len] = 0;
+	op->count++;
+	return op->emit (op->ctx, op->key, len, value);
+}
+
+//	judy_setstep: emit the keys below the places a and b, whose
+//	key is the first len bytes of op->key; a place with a zero
+//	next stands for an array with no keys there.  The edges
+//	leaving the two places are merged by their first byte, and
+//	the two sides go down an edge they share together as far
+//	as its bytes agree.  Returns non-zero to end the walk.
+
+int judy_setstep (JudySetOp *op, JudyChild *a, JudyChild *b, uint len)
+{
+uchar labela[JUDY_span_bytes], labelb[JUDY_span_bytes];
+JudyChild childa[1], childb[1], cuta[1], cutb[1], none[1];
+judyslot *cella, *cellb, *leafa, *leafb;
+int posa, posb, cmp;
+uint lena, lenb, cnt;
+uchar *key;
+
+	if( !a->next && (op->op != JUDY_union || !b->next) )
+		return 0;
+
+	if( !b->next && op->op == JUDY_intersect )
+		return 0;
+
+	//	room for the longest edge and a terminator
+
+	if( op->max < len + JUDY_span_bytes + 1 ) {
+		if( !(key = (uchar *)realloc (op->key, 2 * (len + JUDY_span_bytes + 1))) ) {
+			op->failed = 1;
+			return 1;
+		}
+		op->key = key;
+		op->max = 2 * (len + JUDY_span_bytes + 1);
+	}
+
+	//	the key ending at the places
+
+	cella = judy_edgefirst (op->judy[0], a, &posa);
+	cellb = judy_edgefirst (op->judy[1], b, &posb);
+
+	if( judy_setemit (op, len, cella, cellb) )
+		return 1;
+
+	memset (none, 0, sizeof(none));
+	lena = judy_edge (op->judy[0], a, &posa, labela, childa, &leafa);
+	lenb = judy_edge (op->judy[1], b, &posb, labelb, childb, &leafb);
+
+	while( lena || lenb ) {
+		if( !lena )
+			cmp = 1;
+		else if( !lenb )
+			cmp = -1;
+		else
+			cmp = labela[0] - labelb[0];
+
+		//	an edge on one side only, going down it
+		//	unless it ends a key of its own
+
+		if( cmp < 0 ) {
+			if( op->op != JUDY_intersect ) {
+				memcpy (op->key + len, labela, lena);
+				if( leafa ? judy_setemit (op, len + lena, leafa, NULL) : judy_setstep (op, childa, none, len + lena) )
+					return 1;
+			}
+			lena = judy_edge (op->judy[0], a, &posa, labela, childa, &leafa);
+			continue;
+		}
+
+		if( cmp > 0 ) {
+			if( op->op == JUDY_union ) {
+				memcpy (op->key + len, labelb, lenb);
+				if( leafb ? judy_setemit (op, len + lenb, NULL, leafb) : judy_setstep (op, none, childb, len + lenb) )
+					return 1;
+			} else if( !lena )
+				return 0;
+			lenb = judy_edge (op->judy[1], b, &posb, labelb, childb, &leafb);
+			continue;
+		}
+
+		//	a shared edge, cut where the bytes part
+
+		for( cnt = 1; cnt < lena && cnt < lenb; cnt++ )
+			if( labela[cnt] != labelb[cnt] )
+				break;
+
+		if( cnt < lena )
+			judy_edgecut (a, labela, cnt, cuta);
+		else
+			*cuta = *childa;
+
+		if( cnt < lenb )
+			judy_edgecut (b, labelb, cnt, cutb);
+		else
+			*cutb = *childb;
+
+		memcpy (op->key + len, labela, cnt);
+
+		if( cnt == lena && cnt == lenb && leafa && leafb ) {
+			if( judy_setemit (op, len + cnt, leafa, leafb) )
+				return 1;
+		} else if( judy_setstep (op, cuta, cutb, len + cnt) )
+			return 1;
+
+		lena = judy_edge (op->judy[0], a, &posa, labela, childa, &leafa);
+		lenb = judy_edge (op->judy[1], b, &posb, labelb, childb, &leafb);
+	}
+
+	return 0;
+}
+
+//	judy_setwalk: emit the keys of the union, intersection or
+//	difference of arrays a and b in order, returning their count,
+//	or zero if memory runs out.  emit returns non-zero to end the
+//	walk early.
+
+judyslot judy_setwalk (Judy *a, Judy *b, int op,
+	judyslot (*merge) (void *ctx, uchar *key, uint len, judyslot a, judyslot b),
+	int (*emit) (void *ctx, uchar *key, uint len, judyslot value), void *ctx)
+{
+JudyChild roota[1], rootb[1];
+JudySetOp walk[1];
+
+	memset (walk, 0, sizeof(walk));
+	walk->judy[0] = a;
+	walk->judy[1] = b;
+	walk->op = op;
+	walk->merge = merge;
+	walk->emit = emit;
+	walk->ctx = ctx;
+
+	memset (roota, 0, sizeof(roota));
+	memset (rootb, 0, sizeof(rootb));
+	roota->next = judy_load (a->root);
+	rootb->next = judy_load (b->root);
+
+	judy_setstep (walk, roota, rootb, 0);
+	free (walk->key);
+	return walk->failed ? 0 : walk->count;
+}
+
+//	the keys of a result gathered for judy_bulk_load
+
+typedef struct {
+	uchar *bytes;		// key bytes, one key after another
+	judyslot used;		// bytes taken
+	judyslot size;		// allocated bytes
+	judyslot *offs;		// offset of each key in bytes
+	uint *lens;			// length of each key
+	judyslot *values;	// value of each key
+	uint cnt;			// keys gathered
+	uint max;			// allocated keys
+	judyslot (*merge) (void *ctx, uchar *key, uint len, judyslot a, judyslot b);
+	void *ctx;			// the caller's, for merge
+} JudySetKeys;
+
+//	call the caller's merge with the caller's ctx
+
+judyslot judy_setmerge (void *ctx, uchar *key, uint len, judyslot a, judyslot b)
+{
+JudySetKeys *keys = (JudySetKeys *)ctx;
+
+	return keys->merge (keys->ctx, key, len, a, b);
+}
+
+int judy_setkeep (void *ctx, uchar *key, uint len, judyslot value)
+{
+JudySetKeys *keys = (JudySetKeys *)ctx;
+judyslot size;
+void *mem;
+uint max;
+
+	if( keys->cnt == keys->max ) {
+		max = keys->max ? 2 * keys->max : 1024;
+		if( !(mem = realloc (keys->offs, max * sizeof(judyslot))) )
+			return 1;
+		keys->offs = (judyslot *)mem;
+		if( !(mem = realloc (keys->lens, max * sizeof(uint))) )
+			return 1;
+		keys->lens = (uint *)mem;
+		if( !(mem = realloc (keys->values, max * sizeof(judyslot))) )
+			return 1;
+		keys->values = (judyslot *)mem;
+		keys->max = max;
+	}
+
+	if( keys->used + len > keys->size ) {
+		size = 2 * (keys->size + len) + 65536;
+		if( !(mem = realloc (keys->bytes, size)) )
+			return 1;
+		keys->bytes = (uchar *)mem;
+		keys->size = size;
+	}
+
+	memcpy (keys->bytes + keys->used, key, len);
+	keys->offs[keys->cnt] = keys->used;
+	keys->lens[keys->cnt] = len;
+	keys->values[keys->cnt++] = value;
+	keys->used += len;
+	return 0;
+}
+
+//	judy_setbuild: judy_setwalk into the empty array out with
+//	judy_bulk_load, returning the number of keys loaded, or zero
+//	if out is not empty or memory runs out
+
+uint judy_setbuild (Judy *out, Judy *a, Judy *b, int op,
+	judyslot (*merge) (void *ctx, uchar *key, uint len, judyslot a, judyslot b), void *ctx)
+{
+JudySetKeys keys[1];
+uchar **ptrs = NULL;
+uint idx, loaded = 0;
+judyslot cnt;
+
+	if( judy_load (out->root) )
+		return 0;
+
+	memset (keys, 0, sizeof(keys));
+	keys->merge = merge;
+	keys->ctx = ctx;
+	cnt = judy_setwalk (a, b, op, merge ? judy_setmerge : NULL, judy_setkeep, keys);
+
+	if( cnt && cnt == keys->cnt && (ptrs = (uchar **)malloc (cnt * sizeof(uchar *))) ) {
+		for( idx = 0; idx < cnt; idx++ )
+			ptrs[idx] = keys->bytes + keys->offs[idx];
+
+		loaded = judy_bulk_load (out, ptrs, keys->lens, keys->values, cnt);
+	}
+
+	free (ptrs);
+	free (keys->bytes);
+	free (keys->offs);
+	free (keys->lens);
+	free (keys->values);
+	return loaded;
+}
+
+//	judy_union, judy_intersect, judy_difference: build the keys
+//	in either, both, or a but not b into the empty array out.
+//	merge combines the values of keys in both; NULL keeps a's.
+
+uint judy_union (Judy *out, Judy *a, Judy *b,
+	judyslot (*merge) (void *ctx, uchar *key, uint len, judyslot a, judyslot b), void *ctx)
+{
+	return judy_setbuild (out, a, b, JUDY_union, merge, ctx);
+}
+
+uint judy_intersect (Judy *out, Judy *a, Judy *b,
+	judyslot (*merge) (void *ctx, uchar *key, uint len, judyslot a, judyslot b), void *ctx)
+{
+	return judy_setbuild (out, a, b, JUDY_intersect, merge, ctx);
+}
+
+uint judy_difference (Judy *out, Judy *a, Judy *b)
+{
+	return judy_setbuild (out, a, b, JUDY_difference, NULL, NULL);
+}
+
+//	judy_slot_batch: find the cells for cnt keys at once, storing
+//	NULL for missing keys.  Each key advances one node per pass
+//	and its next node is prefetched before the pass comes back to
+//	it, so the cache misses of up to JUDY_batch lookups overlap.
+//	Both radix tables are read in the same pass, as splitting them
+//	costs more than the inner miss on the hot upper levels.
+//	Links are resolved through the cursor base like judy_cslot,
+//	so a judy_map image works too.  The judy stack is left
+//	untouched.
+
+#define JUDY_batch	16
+
+//	prefetch the part of a node that a lookup will read:
+//	the outer radix entry, or the first key and last slot
+//	lines of a linear or span node.
+
+void judy_prefetchnode (JudyCursor *cursor, judyslot next, uchar *buff, uint max, uint off)
+{
+uchar *base = (uchar *)judy_addr (cursor, next);
+int size;
+
+	if( (next & 0x07) == JUDY_radix ) {
+		judy_prefetch (base + ((off < max ? buff[off] : 0) >> 4) * sizeof(judyslot));
+		return;
+	}
+
+	size = JudySize[next & 0x07];
+
+	judy_prefetch (base);
+	judy_prefetch (base + size - 1);
+}
+
+void judy_slot_batch (Judy *judy, uchar **keys, uint *lens, uint cnt, judyslot **cells)
+{
+JudyCursor *cursor = judy->cursor;
+judyslot next[JUDY_batch];
+uint off[JUDY_batch];
+uint which[JUDY_batch];
+int slot, size, keysize, tst, live = 0;
+uint idx, lane, max, start = 0;
+judyslot *table, *node;
+judyvalue value;
+uchar *base, *buff;
+
+	//	start the first lookups
+
+	while( live < JUDY_batch && start < cnt ) {
+		which[live] = start;
+		next[live] = judy_load (cursor->root);
+		off[live] = 0;
+		cells[start] = NULL;
+		if( next[live] )
+			judy_prefetchnode (cursor, next[live], keys[start], lens[start], 0);
+		live++, start++;
+	}
+
+	while( live ) {
+	  for( lane = 0; lane < (uint)live; lane++ ) {
+		idx = which[lane];
+		buff = keys[idx];
+		max = lens[idx];
+		base = (uchar *)judy_addr (cursor, next[lane]);
+		slot = off[lane] < max ? buff[off[lane]] : 0;
+
+		if( next[lane] ) switch( next[lane] & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+			size = JudySize[next[lane] & 0x07];
+			node = (judyslot *)(base + size);
+			keysize = JUDY_key_size - (off[lane] & JUDY_key_mask);
+			value = judy_chunk (buff, max, off[lane]);
+			slot = judy_search (base, size / (sizeof(judyslot) + keysize), keysize, value);
+			next[lane] = 0;
+
+			if( slot >= 0 && judy_keyat (base, slot, keysize) == value ) {
+				if( !(value & 0xFF) ) {	// leaf?
+					cells[idx] = &node[-slot-1];
+					break;
+				}
+				next[lane] = judy_load (&node[-slot-1]);
+				off[lane] = (off[lane] | JUDY_key_mask) + 1;
+			}
+			break;
+
+		case JUDY_radix:
+			table = (judyslot *)base;
+
+			if( !(next[lane] = judy_load (&table[slot >> 4])) )
+				break;
+
+			table = (judyslot *)judy_addr (cursor, next[lane]);
+
+			if( !slot ) {	// leaf?
+				cells[idx] = &table[0];
+				next[lane] = 0;
+				break;
+			}
+
+			next[lane] = judy_load (&table[slot & 0x0F]);
+			off[lane] += 1;
+			break;
+
+		case JUDY_span:
+			node = (judyslot *)(base + JudySize[JUDY_span]);
+			size = tst = JUDY_span_bytes;
+			if( tst > (int)(max - off[lane]) )
+				tst = max - off[lane];
+			value = memcmp (base, buff + off[lane], tst);
+			next[lane] = 0;
+
+			if( !value && tst < size && !base[tst] ) {	// leaf?
+				cells[idx] = &node[-1];
+				break;
+			}
+
+			if( !value && tst == size ) {
+				next[lane] = judy_load (&node[-1]);
+				off[lane] += size;
+			}
+			break;
+		}
+
+		if( next[lane] ) {
+			judy_prefetchnode (cursor, next[lane], buff, max, off[lane]);
+			continue;
+		}
+
+		//	this lookup is finished: start another in its lane
+
+		if( start < cnt ) {
+			which[lane] = start;
+			next[lane] = judy_load (cursor->root);
+			off[lane] = 0;
+			cells[start] = NULL;
+			if( next[lane] )
+				judy_prefetchnode (cursor, next[lane], keys[start], lens[start], 0);
+			start++;
+			continue;
+		}
+
+		//	or retire the lane
+
+		if( --live > (int)lane ) {
+			which[lane] = which[live];
+			next[lane] = next[live];
+			off[lane] = off[live];
+			lane--;
+		}
+	  }
+	}
+}
+
+//	judy_cnxt_batch: step past up to max entries as that many
+//	judy_cnxt calls would, filling pairs with their keys and
+//	cells.  After each judy_cnxt step the rest of the node it
+//	stopped in is read off in one loop: the leaf slots of a
+//	linear node, and the slots of a linear or radix node whose
+//	children are span leaves.  The child of the next slot, and
+//	the node the walk goes on to after this one, are prefetched
+//	while the current slot is emitted.  The keys are zero
+//	terminated in a buffer the cursor keeps, valid until the
+//	next call.  The cursor is left on the last entry returned,
+//	so a call after a short one returns zero.
+
+typedef struct {
+	uchar *key;			// zero terminated key
+	uint len;			// its length
+	judyslot *cell;		// its cell
+} JudyPair;
+
+//	room for amt more bytes of keys after used
+
+uchar *judy_batchroom (JudyCursor *cursor, uint used, uint amt)
+{
+uchar *batch;
+
+	if( used + amt > cursor->batchmax ) {
+		if( !(batch = (uchar *)realloc (cursor->batch, (used + amt) * 2)) )
+			return NULL;
+		cursor->batch = batch;
+		cursor->batchmax = (used + amt) * 2;
+	}
+
+	return cursor->batch + used;
+}
+
+//	prefetch the node under the slot after the current one at
+//	level, when that slot's link is at hand
+
+void judy_prefetchnext (JudyCursor *cursor, uint level)
+{
+judyslot next = cursor->stack[level].next, *inner;
+int slot = cursor->stack[level].slot + 1;
+uint keysize, size;
+uchar *base;
+
+	switch( next & 0x07 ) {
+	case JUDY_radix:
+		if( !(slot & 0x0F) )
+			return;
+		inner = (judyslot *)judy_table (cursor, judy_load ((judyslot *)judy_addr (cursor, next) + (slot >> 4)));
+		if( inner && (next = judy_load (&inner[slot & 0x0F])) )
+			judy_prefetch ((uchar *)judy_addr (cursor, next));
+		return;
+	case JUDY_span:
+		return;
+	}
+
+	keysize = JUDY_key_size - (cursor->stack[level].off & JUDY_key_mask);
+	size = JudySize[next & 0x07];
+	base = (uchar *)judy_addr (cursor, next);
+
+	if( slot >= (int)(size / (sizeof(judyslot) + keysize)) )
+		return;
+#if BYTE_ORDER != BIG_ENDIAN
+	if( base[slot * keysize] )
+#else
+	if( base[slot * keysize + keysize - 1] )
+#endif
+		judy_prefetch ((uchar *)judy_addr (cursor, judy_load ((judyslot *)(base + size) - slot - 1)));
+}
+
+//	read off the rest of the node holding the current entry, or
+//	holding the span leaf it is in, while its slots are leaves or
+//	span leaves.  prefix holds the current key.
+
+uint judy_batchrun (JudyCursor *cursor, JudyPair *pairs, uint cnt, uint max, uint *used, uchar *prefix)
+{
+uint level = cursor->level, off, keysize, len, tail;
+judyslot next, child, *table, *inner, *node;
+uchar *base, *span, *out;
+int slot, last, size, idx;
+
+	if( (cursor->stack[level].next & 0x07) == JUDY_span )
+		if( !--level )
+			return cnt;
+
+	if( level > 1 )
+		judy_prefetchnext (cursor, level - 1);
+
+	next = cursor->stack[level].next;
+	slot = cursor->stack[level].slot;
+	off = cursor->stack[level].off;
+	base = (uchar *)judy_addr (cursor, next);
+	size = JudySize[next & 0x07];
+
+	switch( next & 0x07 ) {
+	case JUDY_radix:
+		table = (judyslot *)base;
+
+		while( cnt < max && level < cursor->max && ++slot < 256 ) {
+			if( !(inner = (judyslot *)judy_table (cursor, judy_load (&table[slot >> 4]))) ) {
+				slot |= 0x0F;
+				continue;
+			}
+
+			if( !(child = judy_load (&inner[slot & 0x0F])) )
+				continue;
+
+			if( (child & 0x07) != JUDY_span )
+				break;
+
+			span = (uchar *)judy_addr (cursor, child);
+
+			if( span[JUDY_span_bytes - 1] )
+				break;
+
+			if( (slot & 0x0F) < 0x0F && (next = judy_load (&inner[(slot & 0x0F) + 1])) )
+				judy_prefetch ((uchar *)judy_addr (cursor, next));
+
+			for( tail = 0; span[tail]; tail++ );
+
+			if( !(out = judy_batchroom (cursor, *used, off + tail + 2)) )
+				break;
+
+			memcpy (out, prefix, off);
+			out[off] = slot;
+			memcpy (out + off + 1, span, tail);
+			out[off + tail + 1] = 0;
+
+			pairs[cnt].len = off + tail + 1;
+			pairs[cnt++].cell = (judyslot *)(span + JudySize[JUDY_span]) - 1;
+			*used += off + tail + 2;
+
+			cursor->stack[level].slot = slot;
+			cursor->stack[level + 1].next = child;
+			cursor->stack[level + 1].off = off + 1;
+			cursor->level = level + 1;
+		}
+		return cnt;
+
+	case JUDY_span:
+		return cnt;
+	}
+
+	keysize = JUDY_key_size - (off & JUDY_key_mask);
+	last = size / (sizeof(judyslot) + keysize);
+	node = (judyslot *)(base + size);
+
+	while( cnt < max && ++slot < last ) {
+#if BYTE_ORDER != BIG_ENDIAN
+		span = base + slot * keysize + keysize;
+		for( len = 0; len < keysize && span[-1 - (int)len]; len++ );
+#else
+		span = base + slot * keysize;
+		for( len = 0; len < keysize && span[len]; len++ );
+#endif
+		child = 0;
+		tail = 0;
+
+		//	a slot with key bytes to go leads to a span leaf
+
+		if( len == keysize ) {
+			child = judy_load (&node[-slot - 1]);
+			if( level >= cursor->max || (child & 0x07) != JUDY_span )
+				break;
+			span = (uchar *)judy_addr (cursor, child);
+			if( span[JUDY_span_bytes - 1] )
+				break;
+			for( ; span[tail]; tail++ );
+		}
+
+		if( slot + 1 < last )
+#if BYTE_ORDER != BIG_ENDIAN
+		  if( base[(slot + 1) * keysize] )
+#else
+		  if( base[(slot + 1) * keysize + keysize - 1] )
+#endif
+			judy_prefetch ((uchar *)judy_addr (cursor, judy_load (&node[-slot - 2])));
+
+		if( !(out = judy_batchroom (cursor, *used, off + len + tail + 1)) )
+			break;
+
+		memcpy (out, prefix, off);
+#if BYTE_ORDER != BIG_ENDIAN
+		for( idx = 0; idx < (int)len; idx++ )
+			out[off + idx] = base[slot * keysize + keysize - 1 - idx];
+#else
+		memcpy (out + off, base + slot * keysize, len);
+#endif
+		memcpy (out + off + len, span, tail);
+		out[off + len + tail] = 0;
+
+		pairs[cnt].len = off + len + tail;
+		*used += off + len + tail + 1;
+		cursor->stack[level].slot = slot;
+
+		if( child ) {
+			pairs[cnt++].cell = (judyslot *)(span + JudySize[JUDY_span]) - 1;
+			cursor->stack[level + 1].next = child;
+			cursor->stack[level + 1].off = off + keysize;
+			cursor->level = level + 1;
+		} else {
+			pairs[cnt++].cell = &node[-slot - 1];
+			cursor->level = level;
+		}
+	}
+
+	return cnt;
+}
+
+uint judy_cnxt_batch (JudyCursor *cursor, JudyPair *pairs, uint max)
+{
+uint cnt = 0, used = 0, len, idx;
+judyslot *cell;
+uchar *key, *out;
+
+	while( cnt < max ) {
+		if( !(cell = judy_cnxt (cursor)) ) {
+			if( cnt )	// back onto the last entry returned
+				judy_cend (cursor);
+			break;
+		}
+
+		if( !(key = judy_ckeyref (cursor, &len)) || !(out = judy_batchroom (cursor, used, len + 1)) ) {
+			judy_cprv (cursor);
+			break;
+		}
+
+		memcpy (out, key, len + 1);
+		pairs[cnt].len = len;
+		pairs[cnt++].cell = cell;
+		used += len + 1;
+
+		cnt = judy_batchrun (cursor, pairs, cnt, max, &used, key);
+	}
+
+	//	the buffer may have moved while it grew
+
+	for( idx = used = 0; idx < cnt; idx++ )
+		pairs[idx].key = cursor->batch + used, used += pairs[idx].len + 1;
+
+	return cnt;
+}
+
+//	judy_nxt_batch: judy_cnxt_batch on the array's own cursor
+
+uint judy_nxt_batch (Judy *judy, JudyPair *pairs, uint max)
+{
+	return judy_cnxt_batch (judy->cursor, pairs, max);
+}
+
+#ifdef STANDALONE
+#include "judy-lines.c"
+
+//	a line's key stops at a zero byte, which would end it inside
+//	the judy array anyway, and is cut to the JUDY_sortmax bytes
+//	the sorter's arrays are deep enough for, counting it in *cut
+
+#define JUDY_sortmax	16383
+
+uint judy_sortkey (uchar *line, uint len, judyslot *cut)
+{
+uchar *zero = memchr (line, 0, len);
+
+	if( zero )
+		len = zero - line;
+
+	if( len > JUDY_sortmax ) {
+		if( cut )
+			*cut += 1;
+		len = JUDY_sortmax;
+	}
+
+	return len;
+}
+
+//	open an array for the sorter: a key can take a level per byte,
+//	and the cursor stack for them must fit in the first segment
+
+void *judy_sortopen (void)
+{
+JudyAlloc alloc[1];
+
+	memset (alloc, 0, sizeof(alloc));
+	alloc->segsize = 2 * (JUDY_sortmax + 1) * sizeof(JudyStack);
+	return judy_openx (JUDY_sortmax + 1, alloc);
+}
+
+//	external string sorter.  When the array's segments reach the
+//	memory budget its keys are spilled in order with their counts
+//	to a run file and the array is started over.  At the end the
+//	runs are merged, a heap at a time, adding up the counts of a
+//	key found in several runs.  Run records are the count, the key
+//	length and the key bytes, read and written sequentially.
+
+#define JUDY_sortfanin	128				// runs merged at once
+#define JUDY_runbuff	(1024 * 1024)	// stdio buffer of each run
+
+typedef struct {
+	FILE *file;
+	judyslot count;				// duplicates of the current key
+	uint len;					// its length
+	uint max;					// bytes allocated for it
+	uchar *key;
+} JudyRun;
+
+//	create an anonymous run file
+
+FILE *judy_runopen (void)
+{
+#if !defined(_WIN32)
+char *dir = getenv ("TMPDIR");
+char path[1024];
+int fd;
+#endif
+FILE *run;
+
+#if !defined(_WIN32)
+	snprintf (path, sizeof(path), "%s/judy-sort-XXXXXX", dir && *dir ? dir : "/tmp");
+
+	if( (fd = mkstemp (path)) < 0 )
+		judy_abort ("unable to create sort run file");
+
+	unlink (path);		// gone once closed
+
+	if( !(run = fdopen (fd, "w+b")) )
+		judy_abort ("unable to create sort run file");
+#else
+	if( !(run = tmpfile ()) )
+		judy_abort ("unable to create sort run file");
+#endif
+	setvbuf (run, NULL, _IOFBF, JUDY_runbuff);
+	return run;
+}
+
+void judy_runput (FILE *run, uchar *key, uint len, judyslot count)
+{
+uint32_t amt = len;
+
+	fwrite (&count, sizeof(judyslot), 1, run);
+	fwrite (&amt, sizeof(amt), 1, run);
+	fwrite (key, 1, len, run);
+}
+
+//	read the next record of a run, returning zero at its end
+
+int judy_runget (JudyRun *run)
+{
+uint32_t amt;
+
+	if( fread (&run->count, sizeof(judyslot), 1, run->file) != 1 )
+		return 0;
+
+	if( fread (&amt, sizeof(amt), 1, run->file) != 1 )
+		judy_abort ("sort run file is damaged");
+
+	if( amt > run->max )
+		if( !(run->key = realloc (run->key, run->max = amt)) )
+			judy_abort ("No virtual memory");
+
+	if( fread (run->key, 1, amt, run->file) != amt )
+		judy_abort ("sort run file is damaged");
+
+	run->len = amt;
+	return 1;
+}
+
+//	finish writing a run and rewind it for reading
+
+FILE *judy_runend (FILE *run)
+{
+	if( fflush (run) || ferror (run) )
+		judy_abort ("unable to write sort run file");
+
+	rewind (run);
+	return run;
+}
+
+//	spill the array's keys in order with their counts to a new run
+
+FILE *judy_spill (Judy *judy)
+{
+FILE *run = judy_runopen ();
+judyslot *cell;
+uchar *key;
+uint len;
+
+	if( (cell = judy_strt (judy, NULL, 0)) ) do {
+		if( !(key = judy_keyref (judy, &len)) )
+			judy_abort ("No virtual memory");
+		judy_runput (run, key, len, *cell);
+	} while( (cell = judy_nxt (judy)) );
+
+	return judy_runend (run);
+}
+
+//	order runs by their current keys, which hold no zero bytes,
+//	the way the judy array orders them
+
+int judy_runcmp (JudyRun *a, JudyRun *b)
+{
+int diff = memcmp (a->key, b->key, a->len < b->len ? a->len : b->len);
+
+	if( diff )
+		return diff;
+
+	return a->len < b->len ? -1 : a->len > b->len;
+}
+
+void judy_runsift (JudyRun **heap, uint cnt, uint idx)
+{
+JudyRun *run = heap[idx];
+uint child;
+
+	while( (child = 2 * idx + 1) < cnt ) {
+		if( child + 1 < cnt && judy_runcmp (heap[child + 1], heap[child]) < 0 )
+			child++;
+
+		if( judy_runcmp (heap[child], run) >= 0 )
+			break;
+
+		heap[idx] = heap[child];
+		idx = child;
+	}
+
+	heap[idx] = run;
+}
+
+//	merge cnt runs, closing them, either into a new run returned,
+//	or as the sorted lines written to out when it is given
+
+FILE *judy_merge (FILE **files, uint cnt, FILE *out)
+{
+JudyRun *runs = calloc (cnt, sizeof(JudyRun));
+JudyRun **heap = calloc (cnt, sizeof(JudyRun *));
+FILE *run = out ? NULL : judy_runopen ();
+uint live = 0, idx, len, max = 0;
+uchar *key = NULL;
+judyslot count;
+
+	if( !runs || !heap )
+		judy_abort ("No virtual memory");
+
+	for( idx = 0; idx < cnt; idx++ ) {
+		runs[idx].file = files[idx];
+
+		if( judy_runget (runs + idx) )
+			heap[live++] = runs + idx;
+		else
+			fclose (files[idx]);
+	}
+
+	for( idx = live / 2; idx--; )
+		judy_runsift (heap, live, idx);
+
+	while( live ) {
+		len = heap[0]->len;
+
+		if( len >= max )
+			if( !(key = realloc (key, max = len + 1)) )
+				judy_abort ("No virtual memory");
+
+		memcpy (key, heap[0]->key, len);
+		count = 0;
+
+		//	take the key from every run it is next in
+
+		do {
+			count += heap[0]->count;
+
+			if( !judy_runget (heap[0]) )
+				fclose (heap[0]->file), heap[0] = heap[--live];
+
+			if( live )
+				judy_runsift (heap, live, 0);
+		} while( live && heap[0]->len == len && !memcmp (heap[0]->key, key, len) );
+
+		if( run ) {
+			judy_runput (run, key, len, count);
+			continue;
+		}
+
+		key[len] = '\n';
+
+		while( count-- )		// spit out duplicates
+			fwrite (key, 1, len + 1, out);
+	}
+
+	for( idx = 0; idx < cnt; idx++ )
+		free (runs[idx].key);
+
+	free (key);
+	free (heap);
+	free (runs);
+
+	if( run )
+		return judy_runend (run);
+
+	if( fflush (out) || ferror (out) )
+		judy_abort ("unable to write output file");
+
+	return NULL;
+}
+
+//	merge the runs down to one heap's worth, then into out
+
+void judy_sortruns (FILE **runs, uint cnt, FILE *out)
+{
+	while( cnt > JUDY_sortfanin ) {
+		runs[cnt] = judy_merge (runs, JUDY_sortfanin, NULL);
+		memmove (runs, runs + JUDY_sortfanin, (cnt - JUDY_sortfanin + 1) * sizeof(FILE *));
+		cnt -= JUDY_sortfanin - 1;
+	}
+
+	judy_merge (runs, cnt, out);
+}
+#endif
+
+#if defined(STANDALONE) && !defined(_WIN32)
+//	parallel string sorter.  The input is cut into one chunk per
+//	thread at line boundaries and each chunk counts its lines by
+//	their two leading bytes.  The prefixes are then dealt out in
+//	order as contiguous ranges, one partition per thread, so the
+//	partitions sort into disjoint runs of the output whose sizes
+//	are known before any is sorted.  Each thread gathers its
+//	partition's lines from every chunk, counts them into its own
+//	judy array and writes its run at its own output offset.
+
+#define JUDY_sortprefix	65536
+
+typedef struct {
+	uchar *base;			// input text
+	uint64_t size;			// input bytes
+	uint threads;			// chunks and partitions
+	uint64_t *chunk;		// chunk boundaries, threads + 1 of them
+	uint64_t *hist;			// lines then output bytes by prefix, per chunk
+	uint16_t *route;		// partition for each prefix
+	uint64_t *fill;			// next record of chunk x partition
+	uint64_t **recs;		// input offset of each line, per partition
+	uint64_t *lines;		// lines in each partition
+	uint64_t *origin;		// output offset of each partition
+	FILE *out;
+	int fd;					// output for pwrite, or -1 to take turns
+	uint turn;				// partition whose turn it is to write
+	pthread_mutex_t lock[1];
+	pthread_cond_t wait[1];
+	double loaded;			// when the last partition was counted
+	judyslot cut;			// lines cut to JUDY_sortmax
+	int failed;
+} JudySort;
+
+typedef struct {
+	JudySort *sort;
+	uint idx;
+} JudySortJob;
+
+//	cut the line at *off as judy_lines_next would, advance *off
+//	past it and return its key length
+
+uint judy_sortrec (uchar *base, uint64_t size, uint64_t *off, judyslot *cut)
+{
+uchar *rec = base + *off;
+uint len;
+
+	*off = judy_lines_cut (rec, base + size, &len) - base;
+	return judy_sortkey (rec, len, cut);
+}
+
+uint judy_sortprefix (uchar *rec, uint len)
+{
+	return (len > 0 ? rec[0] << 8 : 0) | (len > 1 ? rec[1] : 0);
+}
+
+//	first pass over a chunk: count its lines and output bytes by prefix
+
+void *judy_sortcount (void *arg)
+{
+JudySortJob *job = arg;
+JudySort *sort = job->sort;
+uint64_t *hist = sort->hist + (uint64_t)job->idx * 2 * JUDY_sortprefix;
+uint64_t off = sort->chunk[job->idx];
+uint64_t end = sort->chunk[job->idx + 1];
+uint len, pfx;
+uchar *rec;
+
+	while( off < end ) {
+		rec = sort->base + off;
+		len = judy_sortrec (sort->base, end, &off, NULL);
+		pfx = judy_sortprefix (rec, len);
+		hist[pfx]++;
+		hist[JUDY_sortprefix + pfx] += len + 1;
+	}
+
+	return NULL;
+}
+
+//	second pass over a chunk: file each line under its partition
+
+void *judy_sortdeal (void *arg)
+{
+JudySortJob *job = arg;
+JudySort *sort = job->sort;
+uint64_t *fill = sort->fill + (uint64_t)job->idx * sort->threads;
+uint64_t off = sort->chunk[job->idx];
+uint64_t end = sort->chunk[job->idx + 1];
+uint64_t start;
+uint len, part;
+
+	while( off < end ) {
+		start = off;
+		len = judy_sortrec (sort->base, end, &off, NULL);
+		part = sort->route[judy_sortprefix (sort->base + start, len)];
+		sort->recs[part][fill[part]++] = start;
+	}
+
+	return NULL;
+}
+
+int judy_sortwrite (JudySort *sort, uchar *buff, uint amt, uint64_t *off)
+{
+ssize_t done;
+
+	if( sort->fd < 0 )
+		return fwrite (buff, 1, amt, sort->out) == amt;
+
+	while( amt ) {
+		if( (done = pwrite (sort->fd, buff, amt, *off)) <= 0 )
+			return 0;
+
+		buff += done, amt -= done, *off += done;
+	}
+
+	return 1;
+}
+
+//	sort one partition into its own judy array and write it out,
+//	waiting for the partitions before it when the output is a pipe
+
+void *judy_sortpart (void *arg)
+{
+JudySortJob *job = arg;
+JudySort *sort = job->sort;
+uint64_t off = sort->origin[job->idx];
+uint64_t *recs = sort->recs[job->idx];
+uint len, fill = 0;
+judyslot cut = 0;
+uint64_t idx, rec;
+uchar *key, *buff;
+judyslot *cell;
+judyslot dup;
+void *judy;
+int ok = 1;
+
+	judy = judy_sortopen ();
+
+	for( idx = 0; idx < sort->lines[job->idx]; idx++ ) {
+		rec = recs[idx];
+		len = judy_sortrec (sort->base, sort->size, &rec, &cut);
+		*(judy_cell (judy, sort->base + recs[idx], len)) += 1;
+	}
+
+	free (recs);
+	sort->recs[job->idx] = NULL;
+
+	pthread_mutex_lock (sort->lock);
+	if( sort->loaded < judy_lines_now () )
+		sort->loaded = judy_lines_now ();
+	sort->cut += cut;
+	pthread_mutex_unlock (sort->lock);
+
+	if( !(buff = malloc (JUDY_seg)) )
+		judy_abort ("No virtual memory");
+
+	if( sort->fd < 0 ) {
+		pthread_mutex_lock (sort->lock);
+		while( sort->turn != job->idx )
+			pthread_cond_wait (sort->wait, sort->lock);
+		pthread_mutex_unlock (sort->lock);
+	}
+
+	if( (cell = judy_strt (judy, NULL, 0)) ) do {
+		if( !(key = judy_keyref (judy, &len)) )
+			judy_abort ("No virtual memory");
+
+		for( dup = 0; ok && dup < *cell; dup++ ) {		// spit out duplicates
+			if( fill + len + 1 > JUDY_seg )
+				ok = judy_sortwrite (sort, buff, fill, &off), fill = 0;
+			if( len < JUDY_seg ) {
+				memcpy (buff + fill, key, len), fill += len;
+				buff[fill++] = '\n';
+			} else if( ok )
+				ok = judy_sortwrite (sort, key, len, &off) && judy_sortwrite (sort, (uchar *)"\n", 1, &off);
+		}
+	} while( ok && (cell = judy_nxt (judy)) );
+
+	if( ok && fill )
+		ok = judy_sortwrite (sort, buff, fill, &off);
+
+	pthread_mutex_lock (sort->lock);
+	if( !ok )
+		sort->failed = 1;
+	sort->turn++;
+	pthread_cond_broadcast (sort->wait);
+	pthread_mutex_unlock (sort->lock);
+
+	free (buff);
+	judy_close (judy);
+	return NULL;
+}
+
+void judy_sortpass (JudySort *sort, void *(*pass)(void *))
+{
+pthread_t *tids = malloc (sort->threads * sizeof(pthread_t));
+JudySortJob *jobs = malloc (sort->threads * sizeof(JudySortJob));
+uint idx;
+
+	if( !tids || !jobs )
+		judy_abort ("No virtual memory");
+
+	for( idx = 0; idx < sort->threads; idx++ ) {
+		jobs[idx].sort = sort;
+		jobs[idx].idx = idx;
+		if( pthread_create (tids + idx, NULL, pass, jobs + idx) )
+			judy_abort ("Unable to start sort thread");
+	}
+
+	for( idx = 0; idx < sort->threads; idx++ )
+		pthread_join (tids[idx], NULL);
+
+	free (jobs);
+	free (tids);
+}
+
+//	read all of the input, mapping it when it is a file
+
+uchar *judy_sortinput (FILE *in, uint64_t *size, int *mapped)
+{
+uint64_t max = JUDY_seg, amt;
+struct stat st[1];
+uchar *base;
+
+	*mapped = 0;
+	*size = 0;
+
+	if( !fstat (fileno (in), st) && S_ISREG(st->st_mode) && st->st_size > 0 ) {
+		base = mmap (NULL, st->st_size, PROT_READ, MAP_PRIVATE, fileno (in), 0);
+		if( base != MAP_FAILED ) {
+			*size = st->st_size;
+			*mapped = 1;
+			return base;
+		}
+	}
+
+	if( !(base = malloc (max)) )
+		judy_abort ("No virtual memory");
+
+	while( (amt = fread (base + *size, 1, max - *size, in)) )
+		if( (*size += amt) == max )
+			if( !(base = realloc (base, max <<= 1)) )
+				judy_abort ("No virtual memory");
+
+	return base;
+}
+
+int judy_sort (FILE *in, FILE *out, uint threads)
+{
+uint64_t total = 0, seen, idx, *hist;
+uint64_t *bytes, *sum;
+JudySort sort[1];
+struct stat st[1];
+uint part, chunk;
+double start;
+off_t at;
+int mapped;
+uchar *eol;
+
+	memset (sort, 0, sizeof(sort));
+	start = judy_lines_now ();
+	sort->base = judy_sortinput (in, &sort->size, &mapped);
+	sort->threads = threads;
+	sort->out = out;
+
+	sort->chunk = calloc (threads + 1, sizeof(uint64_t));
+	sort->hist = calloc ((uint64_t)threads * 2 * JUDY_sortprefix, sizeof(uint64_t));
+	sort->route = calloc (JUDY_sortprefix, sizeof(uint16_t));
+	sort->fill = calloc ((uint64_t)threads * threads, sizeof(uint64_t));
+	sort->recs = calloc (threads, sizeof(uint64_t *));
+	sort->lines = calloc (threads, sizeof(uint64_t));
+	sort->origin = calloc (threads, sizeof(uint64_t));
+	bytes = calloc (threads, sizeof(uint64_t));
+	sum = calloc (2 * JUDY_sortprefix, sizeof(uint64_t));
+
+	if( !sort->chunk || !sort->hist || !sort->route || !sort->fill || !sort->recs || !sort->lines || !sort->origin || !bytes || !sum )
+		judy_abort ("No virtual memory");
+
+	//	cut the chunks just after a newline, where fgets starts a line too
+
+	for( chunk = 1; chunk < threads; chunk++ ) {
+		idx = sort->size * chunk / threads;
+		if( idx < sort->chunk[chunk - 1] )
+			idx = sort->chunk[chunk - 1];
+		else if( idx && (eol = memchr (sort->base + idx - 1, '\n', sort->size - idx + 1)) )
+			idx = eol - sort->base + 1;
+		else if( idx )
+			idx = sort->size;
+		sort->chunk[chunk] = idx;
+	}
+
+	sort->chunk[threads] = sort->size;
+	judy_sortpass (sort, judy_sortcount);
+
+	//	deal the prefixes out so each partition gets its share of lines
+
+	for( chunk = 0; chunk < threads; chunk++ )
+	  for( idx = 0; idx < 2 * JUDY_sortprefix; idx++ )
+		sum[idx] += sort->hist[(uint64_t)chunk * 2 * JUDY_sortprefix + idx];
+
+	for( idx = 0; idx < JUDY_sortprefix; idx++ )
+		total += sum[idx];
+
+	for( seen = idx = 0; idx < JUDY_sortprefix; idx++ ) {
+		if( seen < total )
+			sort->route[idx] = (seen + sum[idx] / 2) * threads / total;
+		else
+			sort->route[idx] = threads - 1;
+		bytes[sort->route[idx]] += sum[JUDY_sortprefix + idx];
+		seen += sum[idx];
+	}
+
+	//	every chunk fills its own stretch of each partition's records
+
+	for( chunk = 0; chunk < threads; chunk++ ) {
+		hist = sort->hist + (uint64_t)chunk * 2 * JUDY_sortprefix;
+		for( idx = 0; idx < JUDY_sortprefix; idx++ )
+			sort->fill[chunk * threads + sort->route[idx]] += hist[idx];
+	}
+
+	for( part = 0; part < threads; part++ ) {
+		for( seen = chunk = 0; chunk < threads; chunk++ ) {
+			idx = sort->fill[chunk * threads + part];
+			sort->fill[chunk * threads + part] = seen;
+			seen += idx;
+		}
+
+		sort->lines[part] = seen;
+
+		if( !(sort->recs[part] = malloc (seen * sizeof(uint64_t) + 1)) )
+			judy_abort ("No virtual memory");
+	}
+
+	free (sort->hist);
+	free (sum);
+	judy_sortpass (sort, judy_sortdeal);
+
+	//	write in place when the output is a file we can seek,
+	//	otherwise the partitions take their turns
+
+	fflush (out);
+	sort->fd = -1;
+	seen = 0;
+
+	if( !fstat (fileno (out), st) && S_ISREG(st->st_mode) && !(fcntl (fileno (out), F_GETFL) & O_APPEND) )
+		if( (at = lseek (fileno (out), 0, SEEK_CUR)) != -1 )
+			sort->fd = fileno (out), seen = at;
+
+	for( part = 0; part < threads; part++ )
+		sort->origin[part] = seen, seen += bytes[part];
+
+	pthread_mutex_init (sort->lock, NULL);
+	pthread_cond_init (sort->wait, NULL);
+	judy_sortpass (sort, judy_sortpart);
+	pthread_cond_destroy (sort->wait);
+	pthread_mutex_destroy (sort->lock);
+
+	if( sort->loaded > start )
+		fprintf (stderr, "%.1f MB/s load\n", sort->size / (sort->loaded - start) / 1e6);
+
+	if( sort->cut )
+		fprintf (stderr, "%" PRIjudyvalue " lines cut to %d bytes\n", sort->cut, JUDY_sortmax);
+
+	if( sort->fd >= 0 )
+		lseek (sort->fd, seen, SEEK_SET);
+	else
+		fflush (out);
+
+	if( mapped )
+		munmap (sort->base, sort->size);
+	else
+		free (sort->base);
+
+	free (sort->chunk);
+	free (sort->route);
+	free (sort->fill);
+	free (sort->recs);
+	free (sort->lines);
+	free (sort->origin);
+	free (bytes);
+	return !sort->failed;
+}
+#endif
+
+#ifdef STANDALONE
+int main (int argc, char **argv)
+{
+uchar *buff;
+judyslot max = 0;
+judyslot *cell;
+FILE *in, *out;
+judyslot budget = 0, mark, cut = 0;
+uint cnt = 0, runmax = 0;
+FILE **runs = NULL;
+JudyLines *lines;
+uint threads = 1;
+void *judy;
+uint len;
+uint idx;
+
+	while( argc > 2 && argv[1][0] == '-' ) {
+		if( !strcmp (argv[1], "-t") )
+			threads = atoi (argv[2]);
+		else if( !strcmp (argv[1], "-m") )
+			budget = (judyslot)strtoul (argv[2], NULL, 10) << 20;
+		else
+			break;
+		argc -= 2, argv += 2;
+	}
 
 	if( argc > 1 )
 		in = fopen (argv[1], "r");
@@ -1309,31 +7051,82 @@ uint idx;
 		out = stdout;
 
 	if( !in )
-		fprintf (stderr, "unable to open input file\n");
+		judy_abort ("unable to open input file");
 
 	if( !out )
-		fprintf (stderr, "unable to open output file\n");
+		judy_abort ("unable to open output file");
+
+#if !defined(_WIN32)
+	if( !threads )
+		threads = sysconf (_SC_NPROCESSORS_ONLN);
 
-	judy = judy_open (512);
+	if( threads > 1024 )
+		threads = 1024;
 
-	while( fgets((char *)buff, sizeof(buff), in) ) {
-		len = strlen((const char *)buff);
-		buff[--len] = '\0';
-		if( len && buff[len - 1] == 0x0d ) // Detect and remove Windows CR
-			buff[--len] = '\0';
+	if( threads > 1 && !budget ) {
+		if( !judy_sort (in, out, threads) )
+			judy_abort ("unable to write output file");
+		fprintf(stderr, "%" PRIjudyvalue " memory used\n", MaxMem);
+		return 0;
+	}
+#endif
+
+	if( !(lines = judy_lines_open (in)) )
+		judy_abort ("unable to read input file");
+
+	judy = judy_sortopen ();
+	mark = MaxMem;
+
+	while( (buff = judy_lines_next (lines, &len)) ) {
+		len = judy_sortkey (buff, len, &cut);
 		*(judy_cell (judy, buff, len)) += 1;		// count instances of string
 		max++;
+
+		if( !budget || MaxMem - mark < budget )
+			continue;
+
+		//	over budget: spill to a run and start over, keeping
+		//	room for the last run and judy_sortruns' spare entry
+
+		if( cnt + 3 > runmax )
+			if( !(runs = realloc (runs, (runmax = 2 * runmax + 16) * sizeof(FILE *))) )
+				judy_abort ("No virtual memory");
+
+		runs[cnt++] = judy_spill (judy);
+		judy_close (judy);
+		judy = judy_sortopen ();
+		mark = MaxMem;
+	}
+
+	fprintf(stderr, "%.1f MB/s load\n", judy_lines_rate (lines));
+	judy_lines_close (lines);
+
+	if( cut )
+		fprintf(stderr, "%" PRIjudyvalue " lines cut to %d bytes\n", cut, JUDY_sortmax);
+
+	//	the rest goes to a run of its own once there are any
+
+	if( cnt ) {
+		runs[cnt++] = judy_spill (judy);
+		judy_close (judy);
+		judy_sortruns (runs, cnt, out);
+		fprintf(stderr, "%" PRIjudyvalue " memory used\n", MaxMem);
+		free (runs);
+		return 0;
 	}
 
 	cell = judy_strt (judy, NULL, 0);
 
 	if( cell ) do {
-		judy_key(judy, buff, sizeof(buff));
-		for( idx = 0; idx < *cell; idx++ )		// spit out duplicates
-			fprintf(out, "%s\n", buff);
+		if( !(buff = judy_keyref (judy, &len)) )
+			judy_abort ("No virtual memory");
+		for( idx = 0; idx < *cell; idx++ ) {		// spit out duplicates
+			fwrite (buff, 1, len, out);
+			putc ('\n', out);
+		}
 	} while( (cell = judy_nxt (judy)) );
 
-	fprintf(stderr, "%" PRIuint " memory used\n", MaxMem);
+	fprintf(stderr, "%" PRIjudyvalue " memory used\n", MaxMem);
 
 #if 1
 	// test deletion all the way to an empty tree
@@ -1350,3 +7143,4 @@ uint idx;
 	return 0;
 }
 #endif // of STANDALONE
+#endif // of JUDY_ARRAYS_C
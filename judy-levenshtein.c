@@ -58,7 +58,8 @@ void processResult(FILE *out, const char *word, ldint distance) {
 
 // This recursive helper is used by the search function below. 
 // It assumes that the previousRow has been filled in already.
-void searchRecursive(judyslot *cell, search_data_struct *d, int key_index, char prevLetter, char thisLetter, ldint *penultimateRow, ldint *previousRow) {
+// at is the place in the trie after the key_index letters in key_buffer.
+void searchRecursive(JudyChild *at, search_data_struct *d, int key_index, char prevLetter, char thisLetter, ldint *penultimateRow, ldint *previousRow) {
 	
 	const char *word = d->word;
 	int columns = d->columns;
@@ -108,12 +109,12 @@ void searchRecursive(judyslot *cell, search_data_struct *d, int key_index, char
 #endif
 	}
 	
-    cell = judy_slot(d->judy, d->key_buffer, key_index);
+	judyslot *cell = judy_child_cell(d->judy, at);
     
 	// If the last entry in the row indicates the optimal cost is less than the
 	// maximum cost, and there is a word in this trie cell, then add it.
 	if (currentRow[currentRowLastIndex] <= d->maxCost && cell != NULL && *cell > 0) {
-		judy_key(d->judy, d->key_buffer, d->key_buffer_size);
+		d->key_buffer[key_index] = '\0';
 		d->resultCallback((FILE *)d->results, (const char *)d->key_buffer, currentRow[currentRowLastIndex]);
 	}
 	
@@ -126,13 +127,14 @@ void searchRecursive(judyslot *cell, search_data_struct *d, int key_index, char
 	// recursively search each branch of the trie
 	if (currentRowMinCost <= d->maxCost) {
         char key_chars[256];
-        int key_char_count = judy_key_chars_below_key(d->judy, d->key_buffer, key_index, d->key_buffer_size, (uchar *)key_chars);
+        JudyChild children[256];
+        int key_char_count = judy_children_at(d->judy, at, NULL, 0, (uchar *)key_chars, children);
         
         char nextLetter;
         for (int key_char_index = 0; key_char_index < key_char_count; key_char_index++) {
             nextLetter = key_chars[key_char_index];	
             d->key_buffer[key_index] = nextLetter;
-            searchRecursive(NULL, d, key_index+1, thisLetter, nextLetter, previousRow, currentRow);
+            searchRecursive(&children[key_char_index], d, key_index+1, thisLetter, nextLetter, previousRow, currentRow);
 		}
 	}
 	
@@ -176,13 +178,14 @@ void search(void *judy, const char *word, ldint maxCost, void *results, void (*r
 	int key_index = 0;
 	
     char key_chars[256];
-    int key_char_count = judy_key_chars_below_key(judy, (uchar *)key_buffer, key_index, key_buffer_size, (uchar *)key_chars);
+    JudyChild children[256];
+    int key_char_count = judy_children(judy, NULL, 0, (uchar *)key_chars, children);
     
 	char letter;
     for (int key_char_index = 0; key_char_index < key_char_count; key_char_index++) {
 		letter = key_chars[key_char_index];	
         key_buffer[key_index] = letter;
-        searchRecursive(NULL, &d, key_index+1, 0, letter, NULL, currentRow);
+        searchRecursive(&children[key_char_index], &d, key_index+1, 0, letter, NULL, currentRow);
 	}
 	
 	free(currentRow);
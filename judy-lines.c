@@ -0,0 +1,192 @@
+/*
+ *  judy-lines.c
+ *  judy-arrays
+ *
+ *  License: same as for judy-arrays.c
+ *
+ *  Line input for the sorter and the test drivers. A regular file is
+ *  mapped and its lines are handed out as pointers into the mapping, so
+ *  a line goes to judy_cell without being copied. Anything else, such
+ *  as a pipe on stdin, is streamed through one large read buffer that
+ *  grows to hold the longest line. Line ends are found with memchr,
+ *  which the C library vectorizes. Lines have no length limit; each
+ *  comes without its newline and without a carriage return before it.
+ */
+
+#ifndef JUDY_LINES_C
+#define JUDY_LINES_C
+
+#include "judy-arrays.c"
+
+#if !defined(_WIN32)
+	#include <sys/time.h>
+#else
+	#include <time.h>
+#endif
+
+#define JUDY_LINES_BUFF	(4 * 1024 * 1024)	// streaming read size
+
+typedef struct {
+	uchar *next;			// first byte not yet handed out
+	uchar *end;				// end of the bytes read so far
+	uchar *map;				// mapped file, or NULL when streaming
+	uint64_t mapsize;
+	uchar *buff;			// streaming buffer
+	uint64_t buffsize;
+	FILE *in;				// streamed input, unbuffered
+	int eof;
+	uint64_t bytes;			// bytes handed out, line ends included
+	uint64_t lines;			// lines handed out
+	double start;			// when the input was opened
+} JudyLines;
+
+
+double judy_lines_now(void) {
+#if !defined(_WIN32)
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// Cut the line at next, which ends at a newline or at end. Sets *len to
+// its length without the line end and returns the start of the next line.
+uchar *judy_lines_cut(uchar *next, uchar *end, uint *len) {
+	uchar *eol = memchr(next, '\n', end - next);
+	uchar *after = eol ? eol + 1 : end;
+
+	if (!eol)
+		eol = end;
+
+	if (eol > next && eol[-1] == 0x0d)
+		eol--;
+
+	*len = eol - next;
+	return after;
+}
+
+// Read lines from in, which stays open and owned by the caller.
+JudyLines *judy_lines_open(FILE *in) {
+	JudyLines *lines;
+#if !defined(_WIN32)
+	struct stat st[1];
+	void *map;
+#endif
+
+	if (!in || !(lines = calloc(1, sizeof(JudyLines))))
+		return NULL;
+
+	lines->start = judy_lines_now();
+
+#if !defined(_WIN32)
+	if (!fstat(fileno(in), st) && S_ISREG(st->st_mode) && st->st_size > 0) {
+		map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st->st_size, MADV_SEQUENTIAL);
+			lines->map = lines->next = map;
+			lines->mapsize = st->st_size;
+			lines->end = lines->map + lines->mapsize;
+			lines->eof = 1;
+			return lines;
+		}
+	}
+#endif
+
+	// reads go straight into our buffer, not through a stdio copy
+
+	setvbuf(in, NULL, _IONBF, 0);
+	lines->in = in;
+	lines->buffsize = JUDY_LINES_BUFF;
+
+	if (!(lines->buff = malloc(lines->buffsize))) {
+		free(lines);
+		return NULL;
+	}
+
+	lines->next = lines->end = lines->buff;
+	return lines;
+}
+
+// Move the unfinished line to the front of the buffer, growing it when
+// the line fills it, and read more behind it. Returns 0 at end of input.
+int judy_lines_fill(JudyLines *lines) {
+	uint64_t keep = lines->end - lines->next;
+	uchar *buff;
+	size_t amt;
+
+	if (lines->eof)
+		return 0;
+
+	if (keep == lines->buffsize) {
+		if (!(buff = realloc(lines->buff, lines->buffsize * 2)))
+			return lines->eof = 1, 0;
+
+		lines->next = buff + (lines->next - lines->buff);
+		lines->buff = buff;
+		lines->buffsize *= 2;
+	}
+
+	memmove(lines->buff, lines->next, keep);
+	lines->next = lines->buff;
+	lines->end = lines->buff + keep;
+
+	amt = fread(lines->end, 1, lines->buffsize - keep, lines->in);
+	lines->end += amt;
+
+	if (!amt)
+		lines->eof = 1;
+
+	return 1;
+}
+
+// Return the next line and its length, or NULL at end of input. The
+// line stays valid until the next call; it is not zero terminated.
+uchar *judy_lines_next(JudyLines *lines, uint *len) {
+	uchar *line, *eol;
+
+	// a streamed line is complete once its newline is in the buffer
+
+	while (!(eol = memchr(lines->next, '\n', lines->end - lines->next)) && !lines->eof)
+		judy_lines_fill(lines);
+
+	if (lines->next == lines->end)
+		return NULL;
+
+	line = lines->next;
+	lines->next = eol ? eol + 1 : lines->end;
+	lines->bytes += lines->next - line;
+	lines->lines++;
+
+	if (!eol)
+		eol = lines->end;
+
+	if (eol > line && eol[-1] == 0x0d)
+		eol--;
+
+	*len = eol - line;
+	return line;
+}
+
+// Megabytes per second handed out since the input was opened.
+double judy_lines_rate(JudyLines *lines) {
+	double secs = judy_lines_now() - lines->start;
+
+	return secs > 0 ? lines->bytes / secs / 1e6 : 0;
+}
+
+void judy_lines_close(JudyLines *lines) {
+	if (!lines)
+		return;
+
+#if !defined(_WIN32)
+	if (lines->map)
+		munmap(lines->map, lines->mapsize);
+#endif
+	free(lines->buff);
+	free(lines);
+}
+
+#endif
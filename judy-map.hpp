@@ -0,0 +1,511 @@
+/*
+ *  judy-map.hpp
+ *  judy-arrays
+ *
+ *  License: same as for judy-arrays.c
+ *
+ *  judy::map<Key, T>, an ordered map over one judy array. Key is
+ *  std::string, for keys without zero bytes, or an integer type, which
+ *  goes through the judyL calls and sorts in numeric order. The map
+ *  owns the array and can be moved but not copied.
+ *
+ *  A trivially copyable T smaller than a cell lives in the cell itself,
+ *  with the cell's last byte set so the cell is never zero, as the
+ *  array needs. Anything else, a full cell wide value included, lives
+ *  in a block from judy_data the cell points to; blocks of erased
+ *  values are kept on a free list for the next insert.
+ *
+ *  Lookups run on the array's own cursor, and each iterator copies the
+ *  path found into a cursor of its own from judy_copen, so iterators
+ *  walk on independently of each other and of lookups. Any insert or
+ *  erase invalidates them all except the one returned, and none may
+ *  outlive its map or follow it through a move, though one left over
+ *  from before a clear() may still be destroyed. An iterator's key is
+ *  read from its cursor, the string keys from the buffer of
+ *  judy_ckeyref, and stays valid until that iterator moves. Values stay
+ *  put until their key is erased.
+ *
+ *  Like the .c files this includes judy-arrays.c, so use it from a
+ *  single translation unit. It needs C++17.
+ */
+
+#ifndef JUDY_MAP_HPP
+#define JUDY_MAP_HPP
+
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "judy-arrays.c"
+
+namespace judy {
+
+// The judy calls for a key type. view is what lookups take and what
+// iterators hand out. Lookups use the array's own cursor; next, prev and
+// key take the iterator's.
+
+template <class Key, class Enable = void>
+struct keys;
+
+template <>
+struct keys<std::string> {
+	typedef std::string_view view;
+	static const uint depth = 1024;
+
+	static judyslot *cell(Judy *judy, view key) {
+		return judy_cell(judy, (uchar *)key.data(), key.size());
+	}
+
+	static judyslot *slot(Judy *judy, view key) {
+		return judy_slot(judy, (uchar *)key.data(), key.size());
+	}
+
+	static judyslot *strt(Judy *judy, view key) {
+		return judy_strt(judy, (uchar *)key.data(), key.size());
+	}
+
+	static judyslot *first(Judy *judy) {
+		return judy_strt(judy, NULL, 0);
+	}
+
+	static judyslot *last(Judy *judy) {
+		return judy_end(judy);
+	}
+
+	static judyslot *next(JudyCursor *cursor) {
+		return judy_cnxt(cursor);
+	}
+
+	static judyslot *prev(JudyCursor *cursor) {
+		return judy_cprv(cursor);
+	}
+
+	static view key(JudyCursor *cursor) {
+		uint len = 0;
+		uchar *key = judy_ckeyref(cursor, &len);
+
+		return view((const char *)key, key ? len : 0);
+	}
+
+	// Remove the key the cursor is on, returning the cell of the key
+	// after it.
+	static judyslot *erase(Judy *judy) {
+		judyslot *cell = judy_del(judy);
+
+		return cell ? judy_nxt(judy) : judy_strt(judy, NULL, 0);
+	}
+};
+
+template <class Key>
+struct keys<Key, typename std::enable_if<std::is_integral<Key>::value>::type> {
+	typedef Key view;
+	static const uint depth = JUDY_key_size;
+
+	static_assert(sizeof(Key) <= sizeof(judyvalue), "integer keys must fit a judyvalue");
+
+	// signed keys have their sign bit flipped, so they sort in order
+
+	static judyvalue index(Key key) {
+		if (std::is_signed<Key>::value)
+			return (judyvalue)(int64_t)key ^ (judyvalue)1 << (sizeof(judyvalue) * 8 - 1);
+
+		return (judyvalue)key;
+	}
+
+	static Key unindex(judyvalue index) {
+		if (std::is_signed<Key>::value)
+			return (Key)(int64_t)(index ^ (judyvalue)1 << (sizeof(judyvalue) * 8 - 1));
+
+		return (Key)index;
+	}
+
+	static judyslot *cell(Judy *judy, view key) {
+		return judyL_ins(judy, index(key));
+	}
+
+	static judyslot *slot(Judy *judy, view key) {
+		return judyL_get(judy, index(key));
+	}
+
+	static judyslot *strt(Judy *judy, view key) {
+		judyvalue at = index(key);
+
+		return judyL_first(judy, &at);
+	}
+
+	static judyslot *first(Judy *judy) {
+		judyvalue at = 0;
+
+		return judyL_first(judy, &at);
+	}
+
+	static judyslot *last(Judy *judy) {
+		judyvalue at = ~(judyvalue)0;
+
+		return judyL_last(judy, &at);
+	}
+
+	static judyslot *next(JudyCursor *cursor) {
+		return judyL_cnxt(cursor);
+	}
+
+	static judyslot *prev(JudyCursor *cursor) {
+		return judyL_cprv(cursor);
+	}
+
+	static view key(JudyCursor *cursor) {
+		return unindex(judyL_ckey(cursor));
+	}
+
+	static judyslot *erase(Judy *judy) {
+		judyvalue at = judyL_ckey(judy->cursor);
+
+		judyL_del(judy, at);
+		return judyL_first(judy, &at);
+	}
+};
+
+template <class Key, class T>
+class map {
+public:
+	typedef Key key_type;
+	typedef T mapped_type;
+	typedef typename keys<Key>::view key_view;
+	typedef std::pair<key_view, T &> value_type;
+	typedef std::size_t size_type;
+
+	// values that fit the cell beside the byte that keeps it non-zero
+	static const bool inline_values = std::is_trivially_copyable<T>::value
+		&& sizeof(T) < sizeof(judyslot) && alignof(T) <= alignof(judyslot);
+
+	static_assert(alignof(T) <= 8, "judy_data blocks are 8 byte aligned");
+
+	class iterator {
+	public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef typename map::value_type value_type;
+		typedef value_type reference;
+		typedef std::ptrdiff_t difference_type;
+
+		struct pointer {
+			value_type pair;
+			value_type *operator->() { return &pair; }
+		};
+
+		iterator() : owner(NULL), cursor(NULL), cell(NULL), generation(0) {}
+
+		iterator(const iterator &other) : owner(other.owner), cursor(NULL), cell(other.cell), generation(0) {
+			if (other.cursor)
+				owner->place(*this, other.cursor);
+		}
+
+		iterator(iterator &&other) noexcept : owner(other.owner), cursor(other.cursor), cell(other.cell), generation(other.generation) {
+			other.cursor = NULL;
+		}
+
+		iterator &operator=(iterator other) noexcept {
+			std::swap(owner, other.owner);
+			std::swap(cursor, other.cursor);
+			std::swap(cell, other.cell);
+			std::swap(generation, other.generation);
+			return *this;
+		}
+
+		~iterator() {
+			if (cursor)
+				owner->release(cursor, generation);
+		}
+
+		key_view key() const { return keys<Key>::key(cursor); }
+
+		T &value() const { return map::value(cell); }
+
+		reference operator*() const { return value_type(key(), value()); }
+		pointer operator->() const { return pointer{**this}; }
+
+		iterator &operator++() {
+			cell = keys<Key>::next(cursor);
+			return *this;
+		}
+
+		// from end() this finds the last key on the array's cursor
+		iterator &operator--() {
+			if (cell)
+				cell = keys<Key>::prev(cursor);
+			else if ((cell = keys<Key>::last(owner->judy)))
+				owner->place(*this, owner->judy->cursor);
+
+			return *this;
+		}
+
+		iterator operator++(int) { iterator was = *this; ++*this; return was; }
+		iterator operator--(int) { iterator was = *this; --*this; return was; }
+
+		bool operator==(const iterator &other) const { return cell == other.cell; }
+		bool operator!=(const iterator &other) const { return cell != other.cell; }
+
+	private:
+		friend class map;
+
+		iterator(map *owner, judyslot *cell) : owner(owner), cursor(NULL), cell(cell), generation(0) {}
+
+		map *owner;
+		JudyCursor *cursor;	// one of the map's, once the iterator has had a key
+		judyslot *cell;
+		size_type generation;	// the map's when the cursor was handed out
+	};
+
+	explicit map(uint depth = keys<Key>::depth) : judy((Judy *)judy_open(depth)), spare(NULL), count(0), generation(0) {
+		if (!judy)
+			throw std::bad_alloc();
+	}
+
+	map(const map &) = delete;
+	map &operator=(const map &) = delete;
+
+	map(map &&other) noexcept : judy(other.judy), cursors(std::move(other.cursors)), idle(std::move(other.idle)),
+			spare(other.spare), count(other.count), generation(0) {
+		other.judy = NULL;
+		other.spare = NULL;
+		other.count = 0;
+		other.generation++;
+	}
+
+	map &operator=(map &&other) noexcept {
+		if (this != &other) {
+			close();
+			judy = other.judy, other.judy = NULL;
+			cursors.swap(other.cursors);
+			idle.swap(other.idle);
+			spare = other.spare, other.spare = NULL;
+			count = other.count, other.count = 0;
+			other.generation++;
+		}
+
+		return *this;
+	}
+
+	~map() { close(); }
+
+	size_type size() const { return count; }
+	bool empty() const { return !count; }
+
+	// The raw array, for the C calls the map does not wrap. Writes through
+	// it leave size() wrong.
+	Judy *array() const { return judy; }
+
+	iterator begin() { return position(keys<Key>::first(judy)); }
+	iterator end() { return iterator(this, NULL); }
+
+	iterator find(key_view key) {
+		judyslot *cell = keys<Key>::slot(judy, key);
+
+		return position(cell && *cell ? cell : NULL);
+	}
+
+	// the first key at or after key
+	iterator lower_bound(key_view key) { return position(keys<Key>::strt(judy, key)); }
+
+	bool contains(key_view key) {
+		judyslot *cell = keys<Key>::slot(judy, key);
+
+		return cell && *cell;
+	}
+
+	// Build the value from args if key is new; an existing value is left
+	// as it is. Returns its position and whether it was new.
+	template <class... Args>
+	std::pair<iterator, bool> emplace(key_view key, Args &&...args) {
+		judyslot *cell = insert(key);
+		bool added = !*cell;
+
+		if (added)
+			construct(cell, std::forward<Args>(args)...);
+
+		// the insert leaves the array's cursor on the key's path
+
+		return std::pair<iterator, bool>(position(cell), added);
+	}
+
+	T &operator[](key_view key) {
+		judyslot *cell = insert(key);
+
+		if (!*cell)
+			construct(cell);
+
+		return value(cell);
+	}
+
+	size_type erase(key_view key) {
+		judyslot *cell = keys<Key>::slot(judy, key);
+
+		if (!cell || !*cell)
+			return 0;
+
+		destroy(cell);
+		count--;
+		keys<Key>::erase(judy);
+		return 1;
+	}
+
+	// Erase the key at it, returning the position of the key after it.
+	iterator erase(iterator it) {
+		judy_ccopy(judy->cursor, it.cursor);
+		destroy(it.cell);
+		count--;
+		it.cell = keys<Key>::erase(judy);
+
+		if (it.cell)
+			judy_ccopy(it.cursor, judy->cursor);
+
+		return it;
+	}
+
+	void clear() {
+		map empty(judy ? judy->cursor->max : keys<Key>::depth);
+
+		*this = std::move(empty);
+	}
+
+	void swap(map &other) noexcept {
+		std::swap(judy, other.judy);
+		std::swap(cursors, other.cursors);
+		std::swap(idle, other.idle);
+		generation++, other.generation++;
+		std::swap(spare, other.spare);
+		std::swap(count, other.count);
+	}
+
+private:
+	static T &value(judyslot *cell) {
+		if constexpr (inline_values)
+			return *reinterpret_cast<T *>(cell);
+
+		return *reinterpret_cast<T *>(*cell);
+	}
+
+	// An iterator at cell, on the path the array's cursor just found.
+	iterator position(judyslot *cell) {
+		iterator it(this, cell);
+
+		if (cell)
+			place(it, judy->cursor);
+
+		return it;
+	}
+
+	// Put it where from is, handing it a cursor first if it has none.
+	// Cursors are opened as iterators need them and kept until the
+	// array is closed, so iterators that come and go reuse them.
+	void place(iterator &it, JudyCursor *from) {
+		if (!it.cursor) {
+			if (idle.empty()) {
+				// room for all of them in idle, so release cannot fail
+				cursors.push_back(NULL);
+				idle.reserve(cursors.capacity());
+
+				if (!(it.cursor = judy_copen(judy, judy->cursor->max))) {
+					cursors.pop_back();
+					throw std::bad_alloc();
+				}
+
+				cursors.back() = it.cursor;
+			} else {
+				it.cursor = idle.back();
+				idle.pop_back();
+			}
+
+			it.generation = generation;
+		}
+
+		judy_ccopy(it.cursor, from);
+	}
+
+	// A cursor from an array since closed or swapped away has gone with it.
+	void release(JudyCursor *cursor, size_type given) noexcept {
+		if (judy && given == generation)
+			idle.push_back(cursor);
+	}
+
+	judyslot *insert(key_view key) {
+		judyslot *cell = keys<Key>::cell(judy, key);
+
+		if (!cell)
+			throw std::bad_alloc();
+
+		return cell;
+	}
+
+	template <class... Args>
+	void construct(judyslot *cell, Args &&...args) {
+		void *block;
+
+		if constexpr (inline_values) {
+			new (cell) T(std::forward<Args>(args)...);
+			((uchar *)cell)[sizeof(judyslot) - 1] = 1;
+		} else {
+			if ((block = spare))
+				spare = *(void **)block;
+			else if (!(block = judy_data(judy, sizeof(T) > sizeof(void *) ? sizeof(T) : sizeof(void *))))
+				throw std::bad_alloc();
+
+			try {
+				new (block) T(std::forward<Args>(args)...);
+			} catch (...) {
+				*(void **)block = spare, spare = block;
+				throw;
+			}
+
+			*cell = (judyslot)block;
+		}
+
+		count++;
+	}
+
+	void destroy(judyslot *cell) {
+		void *block;
+
+		if constexpr (inline_values)
+			return;
+
+		block = (void *)*cell;
+		((T *)block)->~T();
+		*(void **)block = spare, spare = block;
+	}
+
+	void close() {
+		judyslot *cell;
+
+		if (!judy)
+			return;
+
+		if constexpr (!std::is_trivially_destructible<T>::value && !inline_values)
+			for (cell = keys<Key>::first(judy); cell; cell = keys<Key>::next(judy->cursor))
+				((T *)*cell)->~T();
+
+		for (JudyCursor *cursor : cursors)
+			judy_cclose(cursor);
+
+		cursors.clear();
+		idle.clear();
+		judy_close(judy);
+		judy = NULL;
+		generation++;
+	}
+
+	Judy *judy;
+	std::vector<JudyCursor *> cursors;	// opened for iterators
+	std::vector<JudyCursor *> idle;		// of those, the ones free again
+	void *spare;		// judy_data blocks of erased values
+	size_type count;
+	size_type generation;	// bumped when the array goes away
+};
+
+}
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ *  judy-shard.c
+ *  judy-arrays
+ *
+ *  License: same as for judy-arrays.c
+ *
+ *  A judy array split into shards so that many threads can insert at once.
+ *  Each shard is an independent Judy with its own lock and its own JudySeg
+ *  allocator. Keys are routed by their two leading bytes through a table
+ *  that never maps a higher prefix to a lower shard, so the shards hold
+ *  disjoint, ordered key ranges and a walk over the shards in turn visits
+ *  every key in sorted order.
+ */
+
+#include <pthread.h>
+
+#include "judy-arrays.c"
+
+#define JUDY_SHARDS_PREFIXES	65536
+
+typedef struct {
+	pthread_mutex_t lock;
+	Judy *judy;
+} __attribute__((aligned(64))) JudyShard;
+
+typedef struct {
+	uint count;								// number of shards
+	uint current;							// shard of the most recent walk call
+	JudyShard *shards;
+	uint16_t route[JUDY_SHARDS_PREFIXES];	// shard for each two byte prefix
+} JudyShards;
+
+
+uint judy_shards_prefix(uchar *buff, uint max) {
+	return (max > 0 ? buff[0] << 8 : 0) | (max > 1 ? buff[1] : 0);
+}
+
+uint judy_shards_route(JudyShards *shards, uchar *buff, uint max) {
+	return shards->route[judy_shards_prefix(buff, max)];
+}
+
+// Open count shards (1 to 65536), each a judy array with max stack levels.
+// The prefixes start out spread evenly; see judy_shards_balance.
+JudyShards *judy_shards_open(uint count, uint max) {
+	JudyShards *shards;
+	uint idx;
+
+	if (!count || count > JUDY_SHARDS_PREFIXES)
+		return NULL;
+
+	if (!(shards = calloc(1, sizeof(JudyShards))))
+		return NULL;
+
+	if (posix_memalign((void **)&shards->shards, 64, count * sizeof(JudyShard))) {
+		free(shards);
+		return NULL;
+	}
+
+	shards->count = count;
+
+	for (idx = 0; idx < count; idx++) {
+		pthread_mutex_init(&shards->shards[idx].lock, NULL);
+		shards->shards[idx].judy = judy_open(max);
+	}
+
+	for (idx = 0; idx < JUDY_SHARDS_PREFIXES; idx++)
+		shards->route[idx] = (uint64_t)idx * count / JUDY_SHARDS_PREFIXES;
+
+	return shards;
+}
+
+void judy_shards_close(JudyShards *shards) {
+	uint idx;
+
+	for (idx = 0; idx < shards->count; idx++) {
+		pthread_mutex_destroy(&shards->shards[idx].lock);
+		judy_close(shards->shards[idx].judy);
+	}
+
+	free(shards->shards);
+	free(shards);
+}
+
+// Spread the prefixes so that a sample of the expected keys lands evenly
+// across the shards. Call this before any key is inserted.
+void judy_shards_balance(JudyShards *shards, uchar **keys, uint *lens, uint cnt) {
+	uint *counts = calloc(JUDY_SHARDS_PREFIXES, sizeof(uint));
+	uint64_t seen = 0;
+	uint idx;
+
+	if (!counts || !cnt) {
+		free(counts);
+		return;
+	}
+
+	for (idx = 0; idx < cnt; idx++)
+		counts[judy_shards_prefix(keys[idx], lens[idx])]++;
+
+	// each prefix goes to the shard holding the middle of its sample range;
+	// those past the last sampled key would land one past the last shard
+
+	for (idx = 0; idx < JUDY_SHARDS_PREFIXES; idx++) {
+		shards->route[idx] = (seen + counts[idx] / 2) * shards->count / cnt;
+		if (shards->route[idx] >= shards->count)
+			shards->route[idx] = shards->count - 1;
+		seen += counts[idx];
+	}
+
+	free(counts);
+}
+
+// Store value in the cell for the key, returning the previous value.
+judyslot judy_shards_insert(JudyShards *shards, uchar *buff, uint max, judyslot value) {
+	JudyShard *shard = &shards->shards[judy_shards_route(shards, buff, max)];
+	judyslot *cell, old;
+
+	pthread_mutex_lock(&shard->lock);
+	cell = judy_cell(shard->judy, buff, max);
+	old = *cell;
+	*cell = value;
+	pthread_mutex_unlock(&shard->lock);
+
+	return old;
+}
+
+// Add delta to the cell for the key, returning the new value.
+judyslot judy_shards_add(JudyShards *shards, uchar *buff, uint max, judyslot delta) {
+	JudyShard *shard = &shards->shards[judy_shards_route(shards, buff, max)];
+	judyslot value;
+
+	pthread_mutex_lock(&shard->lock);
+	value = (*judy_cell(shard->judy, buff, max) += delta);
+	pthread_mutex_unlock(&shard->lock);
+
+	return value;
+}
+
+// Return the value for the key, or 0 if it is missing.
+judyslot judy_shards_get(JudyShards *shards, uchar *buff, uint max) {
+	JudyShard *shard = &shards->shards[judy_shards_route(shards, buff, max)];
+	judyslot *cell, value;
+
+	pthread_mutex_lock(&shard->lock);
+	cell = judy_slot(shard->judy, buff, max);
+	value = cell ? *cell : 0;
+	pthread_mutex_unlock(&shard->lock);
+
+	return value;
+}
+
+
+// Sorted walks across all shards. These use the built-in cursor of each
+// shard and hand out cell pointers, so only call them while no thread is
+// inserting. A walk that runs off either end leaves current at count, so
+// judy_shards_nxt and judy_shards_prv return NULL until it is restarted.
+
+judyslot *judy_shards_strt(JudyShards *shards, uchar *buff, uint max) {
+	judyslot *cell;
+
+	shards->current = judy_shards_route(shards, buff, max);
+	cell = judy_strt(shards->shards[shards->current].judy, buff, max);
+
+	while (!cell && ++shards->current < shards->count)
+		cell = judy_strt(shards->shards[shards->current].judy, NULL, 0);
+
+	return cell;
+}
+
+judyslot *judy_shards_nxt(JudyShards *shards) {
+	judyslot *cell;
+
+	if (shards->current >= shards->count)
+		return NULL;
+
+	cell = judy_nxt(shards->shards[shards->current].judy);
+
+	while (!cell && ++shards->current < shards->count)
+		cell = judy_strt(shards->shards[shards->current].judy, NULL, 0);
+
+	return cell;
+}
+
+judyslot *judy_shards_end(JudyShards *shards) {
+	judyslot *cell = NULL;
+
+	shards->current = shards->count;
+
+	while (!cell && shards->current)
+		cell = judy_end(shards->shards[--shards->current].judy);
+
+	if (!cell)
+		shards->current = shards->count;
+
+	return cell;
+}
+
+judyslot *judy_shards_prv(JudyShards *shards) {
+	judyslot *cell;
+
+	if (shards->current >= shards->count)
+		return NULL;
+
+	cell = judy_prv(shards->shards[shards->current].judy);
+
+	while (!cell && shards->current)
+		cell = judy_end(shards->shards[--shards->current].judy);
+
+	if (!cell)
+		shards->current = shards->count;
+
+	return cell;
+}
+
+uint judy_shards_key(JudyShards *shards, uchar *buff, uint max) {
+	if (shards->current >= shards->count) {
+		buff[0] = 0;
+		return 0;
+	}
+
+	return judy_key(shards->shards[shards->current].judy, buff, max);
+}
@@ -9,11 +9,14 @@
 
 #include <stdio.h>
 #include "judy-utilities.c"
+#include "judy-lines.c"
 
 int main(int argc, char **argv) {
 	uchar buff[1024];
-	uchar key[BOTTOM_UP_SIZE+1] = {0};
 	FILE *in, *out;
+	JudyLines *lines;
+	uchar *line;
+	uint len;
 	
 	judyvalue index;					// array index
 	judyvalue value;					// array element value
@@ -52,20 +55,22 @@ int main(int argc, char **argv) {
 	} while (test != 0);
 #endif
 	
-	judy = judy_open(BOTTOM_UP_MAX_JUDY_STACK_LEVELS);
+	judy = judy_open(JUDY_key_size);
 	
-	while( fgets((char *)buff, sizeof(buff), in) ) {
+	lines = judy_lines_open(in);
+	
+	while( lines && (line = judy_lines_next(lines, &len)) ) {
+		if (len >= sizeof(buff))			// sscanf needs the line zero terminated
+			len = sizeof(buff) - 1;
+		memcpy(buff, line, len);
+		buff[len] = 0;
+		
 		if (sscanf((char *)buff, "%"PRIjudyvalue " %"PRIjudyvalue, &index, &value)) {
-			judyvalue_native_to_bottom_up(index, key);
 #define ENABLE_READ_LOGGING	0
 #if ENABLE_READ_LOGGING
-			for (int i = 0; i < BOTTOM_UP_SIZE; i++) {
-				printf("%02x", key[i]);
-			}
-			printf(" ");
 			printf("%"PRIjudyvalue " %"PRIjudyvalue "\n", index, value);
 #endif
-			cell = judy_cell(judy, key, BOTTOM_UP_SIZE);
+			cell = judyL_ins(judy, index);
 			if (value) {
 				*cell = value;                 // store new value
 			} else {
@@ -74,42 +79,42 @@ int main(int argc, char **argv) {
 		}
 	}
 	
+	if (lines) {
+		fprintf(stderr, "%.1f MB/s load\n", judy_lines_rate(lines));
+		judy_lines_close(lines);
+	}
+	
 	// Next, visit all the stored indexes in sorted order, first ascending,
 	// then descending, and delete each index during the descending pass.
 	
 	index = 0;
-	cell = judy_strt(judy, NULL, 0);
+	cell = judyL_first(judy, &index);
 	while (cell != NULL)
 	{
-		judy_key(judy, key, sizeof(key));
-		index = judyvalue_bottom_up_to_native(key);
-		
 		value = *cell;
 		if (value == -1) value = 0;
 		printf("%"PRIjudyvalue " %"PRIjudyvalue "\n", index, value);
 
-		cell = judy_nxt(judy);
+		cell = judyL_next(judy, &index);
 #define SYMMETRY_TEST	0
 #if SYMMETRY_TEST
-		cell = judy_prv(judy); // This will work if judy_prv() and judy_nxt() are symmetric. 
-		cell = judy_nxt(judy);
+		cell = judyL_prev(judy, &index); // This will work if judyL_prev() and judyL_next() are symmetric. 
+		cell = judyL_next(judy, &index);
 #endif
 	}
 
 	printf("\n");
 
-	cell = judy_end(judy);
+	index = ~(judyvalue)0;
+	cell = judyL_last(judy, &index);
 	while (cell != NULL)
 	{
-		judy_key(judy, key, sizeof(key));
-		index = judyvalue_bottom_up_to_native(key);
-		
 		value = *cell;
 		if (value == -1) value = 0;
 		printf("%"PRIjudyvalue " %"PRIjudyvalue "\n", index, value);
 		
-		cell = judy_del(judy);
-		//cell = judy_prv(judy);
+		judyL_del(judy, index);
+		cell = index-- ? judyL_last(judy, &index) : NULL;
 	}
 
 	return 0;